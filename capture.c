@@ -0,0 +1,414 @@
+/****************************************************************************
+ File        : capture.c
+
+ Description : Example program for the p9813 library.  Uses an output sink
+               (see TCsetSink()) to record everything the library would send
+               to the FTDI device into a file, with no device attached.  A
+               few frames of random colors are issued, in any of the output
+               modes.  Frames can be checked against the colors that were
+               sent by passing the output through a pixel emulator, and
+               a captured MPSSE command stream can be listed.
+
+               Example calling sequences:
+
+               capture -s 4 -p 25 -n 10 -o bitbang.bin
+               capture -M -p 100 -k 15000000 -n 3 -d
+               capture -c -s 3 -p 500 -n 100 -e
+
+               -s and -p set the number of strands and the number of pixels
+               per strand, as in the other programs.  -c selects the CBUS
+               clock, or -M selects MPSSE (single strand) output, with -k
+               setting its clock rate in Hz.  -n is the number of frames to
+               issue (default 1) following the blank frame that TCopen()
+               always sends, and -o names the output file (default
+               "capture.bin").  -e feeds the output to an emulated chain of
+               pixels (see TCemuCreate()) and reports any pixel that isn't
+               showing what was sent, in any mode.  With more than three
+               strands, each is given its own pin as the plan program
+               lists them (DTR, DSR, DCD and RI for strands 3 to 6, or
+               CTS through RI with the CBUS clock).  -d lists the MPSSE
+               commands in the capture and decodes each frame of pixel data
+               from them.  Gamma correction is disabled so that colors
+               compare directly.
+
+ License     : Copyright 2011 Phillip Burgess.    www.PaintYourDragon.com
+
+               This Program is free software: you can redistribute it and/or
+               modify it under the terms of the GNU General Public License as
+               published by the Free Software Foundation, either version 3 of
+               the License, or (at your option) any later version.
+
+               This Program is distributed in the hope that it will be
+               useful, but WITHOUT ANY WARRANTY; without even the implied
+               warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+               PURPOSE.  See the GNU General Public License for more details.
+
+               You should have received a copy of the GNU General Public
+               License along with this Program.  If not, see
+               <http://www.gnu.org/licenses/>.
+
+               Additional permission under GNU GPL version 3 section 7
+
+               If you modify this Program, or any covered work, by linking
+               or combining it with libftd2xx (or a modified version of that
+               library), containing parts covered by the license terms of
+               Future Technology Devices International Limited, the licensors
+               of this Program grant you additional permission to convey the
+               resulting work.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "p9813.h"
+
+#define SEED 1
+
+static TCemulator *emu = NULL;
+
+/* Pin for each strand when more than three are used, for the software
+   and CBUS clock modes, matching the plan program's table.  A zero ends
+   the list (strand 7 is the clock with the software clock). */
+static const unsigned char pins[2][8] = {
+  { TC_FTDI_TX,TC_FTDI_RX,TC_FTDI_RTS,TC_FTDI_DTR,
+    TC_FTDI_DSR,TC_FTDI_DCD,TC_FTDI_RI,0 },
+  { TC_FTDI_TX,TC_FTDI_RX,TC_FTDI_RTS,TC_FTDI_CTS,
+    TC_FTDI_DTR,TC_FTDI_DSR,TC_FTDI_DCD,TC_FTDI_RI } };
+
+/* Output sink: append everything to the capture file, and pass it along
+   to the emulator if one is in use. */
+static TCstatusCode fileSink(
+  const unsigned char *data,
+  int                  len,
+  void                *arg)
+{
+	if(emu) (void)TCemuSink(data,len,emu);
+
+	return (1 == fwrite(data,len,1,(FILE *)arg)) ? TC_OK : TC_ERR_WRITE;
+}
+
+/* Random frame contents; reseeded so the decoder can regenerate them. */
+static void makeFrame(TCpixel *pixels,int n)
+{
+	while(n--) *pixels++ = rand() & 0xffffff;
+}
+
+/* Lists the MPSSE commands in a capture and checks the pixel data against
+   the frames that were sent.  Returns number of errors found. */
+static int decodeMpsse(
+  const unsigned char *buf,
+  long                 len,
+  TCpixel             *expect,
+  int                  nPixels,
+  int                  nFrames)
+{
+	unsigned char *data;
+	long           i,n,dataLen = 0;
+	unsigned long  w,rgb,sent;
+	int            p = 0,frame = 0,errors = 0,inFrame = 0;
+
+	if(!(data = (unsigned char *)malloc(len))) return 1;
+
+	/* Pass 1: walk the command stream, gathering SPI data. */
+	for(i=0;i<len;)
+	{
+		switch(buf[i])
+		{
+		   case 0x8a:
+			printf("  8A  Clock divide-by-5 off\n");
+			i++;
+			break;
+		   case 0x97:
+			printf("  97  Adaptive clocking off\n");
+			i++;
+			break;
+		   case 0x8d:
+			printf("  8D  3-phase clocking off\n");
+			i++;
+			break;
+		   case 0x85:
+			printf("  85  Loopback off\n");
+			i++;
+			break;
+		   case 0x80:
+			if(i + 3 > len) goto truncated;
+			printf("  80  Low pins: value %02X, direction %02X\n",
+			  buf[i + 1],buf[i + 2]);
+			i += 3;
+			break;
+		   case 0x86:
+			if(i + 3 > len) goto truncated;
+			n = buf[i + 1] | (buf[i + 2] << 8);
+			printf("  86  Clock divisor %ld (%.0f Hz)\n",
+			  n,30000000.0 / (double)(n + 1));
+			i += 3;
+			break;
+		   case 0x11:
+			if(i + 3 > len) goto truncated;
+			n = (buf[i + 1] | (buf[i + 2] << 8)) + 1;
+			if(i + 3 + n > len) goto truncated;
+			printf("  11  Write %ld bytes\n",n);
+			memcpy(&data[dataLen],&buf[i + 3],n);
+			dataLen += n;
+			i       += 3 + n;
+			break;
+		   default:
+			printf("  %02X  Unknown command at offset %ld\n",
+			  buf[i],i);
+			free(data);
+			return errors + 1;
+		}
+	}
+
+	/* Pass 2: SPI data as 32-bit P9813 words.  All-zero words are
+	   latch/start; anything else must carry the flag and checksum.
+	   Frame 0 is the blank frame issued by TCopen(). */
+	for(i=0;i+4<=dataLen;i+=4)
+	{
+		w = ((unsigned long)data[i] << 24) | (data[i + 1] << 16) |
+		    (data[i + 2] << 8) | data[i + 3];
+		if(!w)
+		{
+			if(inFrame)
+			{
+				if(p != nPixels)
+				{
+					printf("Frame %d: %d pixels, "
+					  "expected %d\n",frame,p,nPixels);
+					errors++;
+				}
+				frame++;
+				inFrame = 0;
+				p       = 0;
+			}
+			continue;
+		}
+		inFrame = 1;
+		rgb     = ((w & 0xff) << 16) | (w & 0xff00) |
+		          ((w >> 16) & 0xff);
+		if((w & 0xff000000) != (~((((w >> 16) & 0xc0) << 22) |
+		  (((w >> 8) & 0xc0) << 20) | ((w & 0xc0) << 18)) & 0xff000000))
+		{
+			printf("Frame %d pixel %d: bad flag byte %02lX\n",
+			  frame,p,w >> 24);
+			errors++;
+		} else if((p < nPixels) && (frame <= nFrames))
+		{
+			sent = frame ? expect[(frame - 1) * nPixels + p] : 0;
+			if(rgb != sent)
+			{
+				printf("Frame %d pixel %d: "
+				  "got %06lX, sent %06lX\n",frame,p,rgb,sent);
+				errors++;
+			}
+		}
+		p++;
+	}
+	if(frame != nFrames + 1)
+	{
+		printf("Decoded %d frames, expected %d\n",frame,nFrames + 1);
+		errors++;
+	}
+
+	free(data);
+	return errors;
+
+  truncated:
+	printf("Command truncated at offset %ld\n",i);
+	free(data);
+	return errors + 1;
+}
+
+int main(int argc,char *argv[])
+{
+	int            i,f,s,p,totalPixels,
+	  nStrands        = 1,
+	  pixelsPerStrand = 25,
+	  nFrames         = 1,
+	  mode            = 0,
+	  decode          = 0,
+	  emulate         = 0,
+	  errors          = 0;
+	unsigned long  clock = 0;
+	long           len;
+	char          *filename = "capture.bin";
+	unsigned char *buf;
+	FILE          *fp;
+	TCpixel       *pixelBuf;
+	const TCpixel *shown,*sent;
+	TCemuStats     emuStats;
+
+	while((i = getopt(argc,argv,"s:p:n:o:k:cMde")) != -1)
+	{
+		switch(i)
+		{
+		   case 's':
+			nStrands        = strtol(optarg,NULL,0);
+			break;
+		   case 'p':
+			pixelsPerStrand = strtol(optarg,NULL,0);
+			break;
+		   case 'n':
+			nFrames         = strtol(optarg,NULL,0);
+			break;
+		   case 'o':
+			filename        = optarg;
+			break;
+		   case 'k':
+			clock           = strtoul(optarg,NULL,0);
+			break;
+		   case 'c':
+			mode            = TC_CBUS_CLOCK;
+			break;
+		   case 'M':
+			mode            = TC_MPSSE;
+			break;
+		   case 'd':
+			decode          = 1;
+			break;
+		   case 'e':
+			emulate         = 1;
+			break;
+		   case '?':
+		   default:
+			(void)printf(
+			  "usage: %s [-s strands] [-p pixels] [-n frames] "
+			  "[-o file] [-c | -M [-k hz]] [-e] [-d]\n",argv[0]);
+			return 1;
+		}
+	}
+
+	/* Strand counts past the pin table would also run into the mode
+	   bits of TCopen()'s first argument. */
+	if(TC_MPSSE == mode) nStrands = 1;
+	if((nFrames < 0) || (nStrands < 1) ||
+	   (nStrands > ((TC_CBUS_CLOCK == mode) ? 8 : 7)))
+	{
+		TCprintError(TC_ERR_VALUE);
+		return 1;
+	}
+	if(decode && (TC_MPSSE != mode))
+	{
+		(void)printf("Decoding (-d) requires MPSSE mode (-M).\n");
+		return 1;
+	}
+
+	totalPixels = nStrands * pixelsPerStrand;
+	i           = totalPixels * (nFrames ? nFrames : 1) * sizeof(TCpixel);
+	if(NULL == (pixelBuf = (TCpixel *)malloc(i)))
+	{
+		printf("Could not allocate space for %d pixels (%d bytes).\n",
+		  totalPixels,i);
+		return 1;
+	}
+
+	if(!(fp = fopen(filename,"w+b")))
+	{
+		TCprintError(TC_ERR_FILE);
+		return 1;
+	}
+
+	/* Defaults cover three strands; beyond that, each strand gets a
+	   pin of its own, as the plan program assigns them.  The emulator
+	   reads the same pin assignments as the library. */
+	if((TC_MPSSE != mode) && (nStrands > 3))
+	{
+		f = (TC_CBUS_CLOCK == mode) ? 1 : 0;
+		for(s=0;(s<nStrands) && (s<8) && pins[f][s];s++)
+		{
+			if((i = TCsetStrandPin(s,pins[f][s])) != TC_OK)
+			{
+				TCprintError(i);
+				return 1;
+			}
+		}
+	}
+
+	/* Emulator takes the same layout as TCopen(). */
+	if(emulate && !(emu = TCemuCreate(mode | nStrands,pixelsPerStrand)))
+	{
+		TCprintError(TC_ERR_MALLOC);
+		return 1;
+	}
+
+	/* Sink must be set before TCopen(); no FTDI device is used. */
+	TCsetSink(fileSink,fp);
+	if(clock && ((i = TCsetMpsseClock(clock)) != TC_OK))
+	{
+		TCprintError(i);
+		return 1;
+	}
+	if((i = TCopen(mode | nStrands,pixelsPerStrand)) != TC_OK)
+	{
+		TCprintError(i);
+		if(i < TC_ERR_DIVISOR) return 1;
+	}
+	TCdisableGamma();
+
+	srand(SEED);
+	for(f=0;f<nFrames;f++)
+	{
+		makeFrame(&pixelBuf[f * totalPixels],totalPixels);
+		if((i = TCrefresh(&pixelBuf[f * totalPixels],
+		  NULL,NULL)) != TC_OK)
+			TCprintError(i);
+		if(!emu) continue;
+
+		/* Each TCrefresh() ends with a latch, so the emulated pixels
+		   should now all be showing this frame. */
+		for(s=0;s<nStrands;s++)
+		{
+			shown = TCemuPixels(emu,s);
+			sent  = &pixelBuf[(f * nStrands + s) * pixelsPerStrand];
+			for(p=0;p<pixelsPerStrand;p++)
+			{
+				if((shown[p] != sent[p]) && (errors++ < 10))
+					printf("Frame %d strand %d pixel %d: "
+					  "showing %06X, sent %06X\n",f,s,p,
+					  (unsigned int)shown[p],
+					  (unsigned int)sent[p]);
+			}
+		}
+	}
+	TCclose();
+
+	len = ftell(fp);
+	printf("%ld bytes captured to %s\n",len,filename);
+
+	if(emu)
+	{
+		TCemuGetStats(emu,&emuStats);
+		printf("Emulator: %lu frames, %lu pixel words, %lu bad words, "
+		  "%lu overruns, %lu short frames\n",emuStats.frames,
+		  emuStats.words,emuStats.badWords,emuStats.overruns,
+		  emuStats.shortFrames);
+		errors += emuStats.badWords + emuStats.overruns +
+		  emuStats.shortFrames;
+		printf("%d pixel error(s)\n",errors);
+		TCemuDestroy(emu);
+	}
+
+	if(decode)
+	{
+		if(!(buf = (unsigned char *)malloc(len)))
+		{
+			TCprintError(TC_ERR_MALLOC);
+			return 1;
+		}
+		rewind(fp);
+		if(1 != fread(buf,len,1,fp))
+		{
+			TCprintError(TC_ERR_FILE);
+			return 1;
+		}
+		i = decodeMpsse(buf,len,pixelBuf,totalPixels,nFrames);
+		printf("%d error(s)\n",i);
+		errors += i;
+		free(buf);
+	}
+
+	fclose(fp);
+	free(pixelBuf);
+	return errors ? 1 : 0;
+}
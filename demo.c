@@ -2,19 +2,23 @@
  File        : demo.c
 
  Description : Example program for the p9813 library.  Displays a soothing
-               and continuously changing pattern of colors across all pixels.
+               and continuously changing pattern of colors across all pixels,
+               showing off the library's procedural pattern generators.
 
                Example calling sequence:
 
-               demo -s 4 -p 25
+               demo -s 4 -p 25 -m 1
 
-               The two parameters set the number of LED strands and the
-               number of pixels per strand, respectively; the above example
-               would be for 4 strands of 25 pixels each, or 100 pixels
-               total.  Default state is for one strand of 25 pixels.
+               The first two parameters set the number of LED strands and
+               the number of pixels per strand, respectively; the above
+               example would be for 4 strands of 25 pixels each, or 100
+               pixels total.  Default state is for one strand of 25 pixels.
                If strands are different lengths, specify longest strand.
-               Parameters may be issued in any order, and may be ommitted
-               to use corresponding defaults.
+               The last parameter selects a single pattern to display:
+               0 = sine waves, 1 = plasma, 2 = noise, 3 = gradients,
+               4 = palette cycling.  If omitted, the demo cycles through
+               all of them, ten seconds each.  Parameters may be issued in
+               any order, and may be ommitted to use corresponding defaults.
 
  License     : Copyright 2011 Phillip Burgess.    www.PaintYourDragon.com
 
@@ -49,18 +53,26 @@
 #include <time.h>
 #include "p9813.h"
 
+#define N_MODES 5
+
 int main(int argc,char *argv[])
 {
-	double        x,s1,s2,s3;
-	int           i,totalPixels,
+	double         x;
+	int            i,s,totalPixels,
 	  nStrands           = 1,
-	  pixelsPerStrand    = 25;
-	unsigned char r,g,b;
-	time_t        t,prev = 0;
-	TCstats       stats;
-	TCpixel       *pixelBuf;
-
-	while((i = getopt(argc,argv,"s:p:")) != -1)
+	  pixelsPerStrand    = 25,
+	  mode               = -1;
+	uint32_t       frame;
+	time_t         t,prev = 0,modeTime;
+	TCstats        stats;
+	TCpixel        *pixelBuf,palette[256];
+	TCwave         wave;
+	unsigned char  *indexBuf;
+	const TCpixel  keys[] = {
+	  TCrgb(255,0,0),TCrgb(255,160,0),TCrgb(0,255,40),
+	  TCrgb(0,80,255),TCrgb(160,0,255) };
+
+	while((i = getopt(argc,argv,"s:p:m:")) != -1)
 	{
 		switch(i)
 		{
@@ -70,23 +82,29 @@ int main(int argc,char *argv[])
 		   case 'p':
 			pixelsPerStrand = strtol(optarg,NULL,0);
 			break;
+		   case 'm':
+			mode            = strtol(optarg,NULL,0) % N_MODES;
+			break;
 		   case '?':
 		   default:
 			(void)printf(
-			  "usage: %s [-s strands] [-p pixels]\n",argv[0]);
+			  "usage: %s [-s strands] [-p pixels] [-m mode]\n",
+			  argv[0]);
 			return 1;
 		}
 	}
 
-	/* Allocate pixel array.  One TCpixel per pixel per strand. */
+	/* Allocate pixel array.  One TCpixel per pixel per strand.
+	   Palette cycling mode also uses one byte per pixel. */
 	totalPixels = nStrands * pixelsPerStrand;
-	i           = totalPixels * sizeof(TCpixel);
+	i           = totalPixels * (sizeof(TCpixel) + 1);
 	if(NULL == (pixelBuf = (TCpixel *)malloc(i)))
 	{
 		printf("Could not allocate space for %d pixels (%d bytes).\n",
 		  totalPixels,i);
 		return 1;
 	}
+	indexBuf = (unsigned char *)&pixelBuf[totalPixels];
 
 	/* Initialize library, open FTDI device.  Baud rate errors
 	   are non-fatal; program displays a warning but continues. */
@@ -99,26 +117,64 @@ int main(int argc,char *argv[])
 	/* Initialize statistics structure before use. */
 	TCinitStats(&stats);
 
+	/* A looping palette through the color wheel is used by several
+	   of the patterns.  The index buffer for palette cycling is a
+	   simple ramp along each strand; the animation comes entirely
+	   from rotating the palette. */
+	TCmakePalette(palette,keys,sizeof(keys) / sizeof(keys[0]));
+	for(i=0;i<totalPixels;i++)
+		indexBuf[i] = (i % pixelsPerStrand) * 256 / pixelsPerStrand;
+
+	/* Per-pixel phase steps for the sine wave pattern.  There's no
+	   meaning to any of this, just applying various constants at each
+	   stage in order to avoid repetition between the component colors. */
+	wave.step[0] = (int32_t)TC_PHASE_RADIANS( 0.273);
+	wave.step[1] = (int32_t)TC_PHASE_RADIANS(-0.231);
+	wave.step[2] = (int32_t)TC_PHASE_RADIANS( 0.428);
+
 	/* The demo animation sets every pixel in every frame.  Your code
 	   doesn't necessarily have to --  it could just change altered
-	   pixels and call TCrefresh().  The example is some swirly color
-	   patterns using a combination of sine waves.  There's no meaning
-	   to any of this, just applying various constants at each stage
-	   in order to avoid repetition between the component colors. */
-	for(x=0.0;;x += (double)pixelsPerStrand / 20000.0)
+	   pixels and call TCrefresh().  All of the per-pixel work is done
+	   by the library's fixed-point pattern functions; floating-point
+	   math is used only for a few values once per frame. */
+	modeTime = time(NULL);
+	for(x=0.0,frame=0;;x += (double)pixelsPerStrand / 20000.0,frame++)
 	{
-		s1 = sin(x                 ) *  11.0;
-		s2 = sin(x *  0.857 - 0.214) * -13.0;
-		s3 = sin(x * -0.923 + 1.428) *  17.0;
-		for(i=0;i<totalPixels;i++)
+		switch((mode >= 0) ? mode :
+		  (int)((time(NULL) - modeTime) / 10) % N_MODES)
 		{
-			r   = (int)((sin(s1) + 1.0) * 127.5);
-			g   = (int)((sin(s2) + 1.0) * 127.5);
-			b   = (int)((sin(s3) + 1.0) * 127.5);
-			pixelBuf[i] = TCrgb(r,g,b);
-			s1 += 0.273;
-			s2 -= 0.231;
-			s3 += 0.428;
+		   case 0: /* Swirly sine waves */
+			wave.phase[0] = TC_PHASE_RADIANS(sin(x) * 11.0);
+			wave.phase[1] = TC_PHASE_RADIANS(
+			  sin(x *  0.857 - 0.214) * -13.0);
+			wave.phase[2] = TC_PHASE_RADIANS(
+			  sin(x * -0.923 + 1.428) *  17.0);
+			TCrenderWave(pixelBuf,0,totalPixels,&wave);
+			break;
+		   case 1: /* Plasma, treating each strand as a row */
+			TCrenderPlasma(pixelBuf,pixelsPerStrand,nStrands,
+			  frame << 22,palette);
+			break;
+		   case 2: /* Flowing noise, different on each strand */
+			for(s=0;s<nStrands;s++)
+			{
+				TCrenderNoise(pixelBuf,s * pixelsPerStrand,
+				  pixelsPerStrand,frame << 11,0x3000,s,palette);
+			}
+			break;
+		   case 3: /* Gradients between opposite palette colors */
+			for(s=0;s<nStrands;s++)
+			{
+				TCrenderGradient(pixelBuf,s * pixelsPerStrand,
+				  pixelsPerStrand,
+				  palette[(frame + s * 32) & 255],
+				  palette[(frame + s * 32 + 128) & 255]);
+			}
+			break;
+		   default: /* Palette cycling */
+			TCrenderPalette(pixelBuf,indexBuf,totalPixels,
+			  palette,frame);
+			break;
 		}
 
 		if((i = TCrefresh(pixelBuf,NULL,&stats)) != TC_OK)
@@ -0,0 +1,530 @@
+/****************************************************************************
+ File        : effect.c
+
+ Description : Effect graphs for the p9813 library.  A show is usually a
+               stack of effects -- generators, masks, fades, color maps --
+               most of whose inputs hold still from one frame to the next.
+               Here each effect is a node that declares its inputs (other
+               nodes) and parameters; the graph keeps every node's output
+               and, when evaluated, re-runs only nodes whose parameters or
+               inputs changed.  Nodes that work pixel by pixel re-run only
+               over the spans their inputs changed in, and every node
+               reports the spans of its output that actually changed, which
+               TCrefreshDirty() uses to encode just those pixels.  A scene
+               that isn't moving costs next to nothing per frame.
+
+               Nodes are evaluated in the order added, and inputs must be
+               nodes added earlier, so a graph can't have cycles.
+
+ License     : Copyright 2011 Phillip Burgess.    www.PaintYourDragon.com
+
+               This Program is free software: you can redistribute it and/or
+               modify it under the terms of the GNU General Public License as
+               published by the Free Software Foundation, either version 3 of
+               the License, or (at your option) any later version.
+
+               This Program is distributed in the hope that it will be
+               useful, but WITHOUT ANY WARRANTY; without even the implied
+               warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+               PURPOSE.  See the GNU General Public License for more details.
+
+               You should have received a copy of the GNU General Public
+               License along with this Program.  If not, see
+               <http://www.gnu.org/licenses/>.
+
+               Additional permission under GNU GPL version 3 section 7
+
+               If you modify this Program, or any covered work, by linking
+               or combining it with libftd2xx (or a modified version of that
+               library), containing parts covered by the license terms of
+               Future Technology Devices International Limited, the licensors
+               of this Program grant you additional permission to convey the
+               resulting work.
+ ****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "p9813.h"
+
+/* Changed runs closer together than this are reported as one span; a
+   few unchanged pixels cost less to re-run or re-encode than the extra
+   span does to track. */
+#define SPAN_GAP 8
+
+typedef struct {
+	TCeffectFunc func;
+	int          flags,
+	             nInputs,
+	             input[TC_GRAPH_MAX_INPUTS],
+	             paramBytes,
+	             changed,   /* Parameters set since last evaluated  */
+	             nSpans;    /* Output changes at last evaluation    */
+	void        *params;
+	TCpixel     *out;
+	TCspan       span[TC_GRAPH_MAX_SPANS];
+} node;
+
+struct TCgraph {
+	int      nPixels,
+	         nNodes,
+	         maxNodes;
+	node    *node;
+	TCpixel *scratch;   /* Effects render here, then diff to output */
+	TCspan  *work;      /* Spans to re-run, merged from inputs      */
+};
+
+/* Appends a span to an ascending list of at most TC_GRAPH_MAX_SPANS,
+   joining it to the last if they're close.  A full list absorbs the
+   new span by merging the two spans with the smallest gap between
+   them, so coverage only ever grows. */
+static void spanAdd(
+  TCspan *list,
+  int    *count,
+  int     start,
+  int     n)
+{
+	TCspan *last;
+	int     i,gap,best,bestGap;
+
+	if(*count)
+	{
+		last = &list[*count - 1];
+		if(start <= last->start + last->n + SPAN_GAP)
+		{
+			if(start + n > last->start + last->n)
+				last->n = start + n - last->start;
+			return;
+		}
+	}
+	if(*count == TC_GRAPH_MAX_SPANS)
+	{
+		for(best=0,bestGap=-1,i=1;i<*count;i++)
+		{
+			gap = list[i].start -
+			  (list[i - 1].start + list[i - 1].n);
+			if((bestGap < 0) || (gap < bestGap))
+			{
+				bestGap = gap;
+				best    = i;
+			}
+		}
+		if(start - (list[*count - 1].start + list[*count - 1].n) <
+		   bestGap)
+		{
+			last    = &list[*count - 1];
+			last->n = start + n - last->start;
+			return;
+		}
+		list[best - 1].n = list[best].start + list[best].n -
+		  list[best - 1].start;
+		memmove(&list[best],&list[best + 1],
+		  (*count - best - 1) * sizeof(TCspan));
+		(*count)--;
+	}
+	list[*count].start = start;
+	list[*count].n     = n;
+	(*count)++;
+}
+
+/* Span order for qsort(). */
+static int spanCompare(const void *a,const void *b)
+{
+	return ((const TCspan *)a)->start - ((const TCspan *)b)->start;
+}
+
+/* Re-runs one node over the given spans and records which pixels of its
+   output came out different. */
+static void nodeRun(
+  TCgraph      *g,
+  node         *nd,
+  const TCspan *todo,
+  int           nTodo)
+{
+	const TCpixel *in[TC_GRAPH_MAX_INPUTS];
+	TCpixel       *out = nd->out,*s = g->scratch;
+	int            i,j,end,first;
+
+	for(i=0;i<nd->nInputs;i++) in[i] = g->node[nd->input[i]].out;
+
+	for(nd->nSpans=i=0;i<nTodo;i++)
+	{
+		nd->func(s,in,nd->params,todo[i].start,todo[i].n);
+		end = todo[i].start + todo[i].n;
+		for(j=todo[i].start;j<end;)
+		{
+			for(;(j < end) && (s[j] == out[j]);j++);
+			if(j == end) break;
+			for(first=j;(j < end) && (s[j] != out[j]);j++)
+				out[j] = s[j];
+			spanAdd(nd->span,&nd->nSpans,first,j - first);
+		}
+	}
+}
+
+/****************************************************************************
+ Function    : TCgraphCreate()
+ Description : Creates an empty effect graph.
+ Parameters  : int  Number of pixels in every node's output image
+                    (normally the image size passed to TCrefresh()).
+ Returns     : Graph handle, or NULL on error.
+ ****************************************************************************/
+TCgraph *TCgraphCreate(int nPixels)
+{
+	TCgraph *g;
+
+	if(nPixels < 1) return NULL;
+	if(!(g = (TCgraph *)calloc(1,sizeof(TCgraph)))) return NULL;
+	g->nPixels = nPixels;
+	if(!(g->scratch = (TCpixel *)malloc(nPixels * sizeof(TCpixel))) ||
+	   !(g->work = (TCspan *)malloc(TC_GRAPH_MAX_INPUTS *
+	   TC_GRAPH_MAX_SPANS * sizeof(TCspan))))
+	{
+		TCgraphDestroy(g);
+		return NULL;
+	}
+
+	return g;
+}
+
+/****************************************************************************
+ Function    : TCgraphAdd()
+ Description : Adds an effect node to a graph.  Its output starts out
+               black and is first rendered by the next TCgraphEvaluate().
+               Nodes may be added at any time, but not removed.
+ Parameters  : TCgraph *       Graph from TCgraphCreate().
+               TCeffectFunc    Effect: one of the TCeffect functions, or
+                               the application's own.  It is called with
+                               a scratch image to write the given span of
+                               (and only that), the input nodes' outputs
+                               in the order listed here, and a copy of
+                               the parameters.
+               int             TC_EFFECT_POINTWISE if each output pixel
+                               depends only on the same pixel of the
+                               inputs (all of the built-in effects), else
+                               0.  Generators with no inputs needn't care.
+               const int *     Input node numbers, each one added earlier
+                               (NULL if none).
+               int             Number of inputs, 0 to TC_GRAPH_MAX_INPUTS.
+               const void *    Initial parameters (NULL if none); copied.
+               int             Size of parameters in bytes.
+ Returns     : Node number (0 or more), or -1 on error.
+ ****************************************************************************/
+int TCgraphAdd(
+  TCgraph      *g,
+  TCeffectFunc  func,
+  int           flags,
+  const int    *inputs,
+  int           nInputs,
+  const void   *params,
+  int           paramBytes)
+{
+	node *nd;
+	int   i;
+
+	if(!g || !func || (nInputs < 0) || (nInputs > TC_GRAPH_MAX_INPUTS) ||
+	   (nInputs && !inputs) || (paramBytes < 0) ||
+	   (paramBytes && !params)) return -1;
+	for(i=0;i<nInputs;i++)
+		if((inputs[i] < 0) || (inputs[i] >= g->nNodes)) return -1;
+
+	if(g->nNodes == g->maxNodes)
+	{
+		i = g->maxNodes ? g->maxNodes * 2 : 16;
+		if(!(nd = (node *)realloc(g->node,i * sizeof(node)))) return -1;
+		g->node     = nd;
+		g->maxNodes = i;
+	}
+
+	nd = &g->node[g->nNodes];
+	bzero(nd,sizeof(node));
+	if(!(nd->out = (TCpixel *)calloc(g->nPixels,sizeof(TCpixel))) ||
+	   (paramBytes && !(nd->params = malloc(paramBytes))))
+	{
+		free(nd->out);
+		return -1;
+	}
+	nd->func       = func;
+	nd->flags      = flags;
+	nd->nInputs    = nInputs;
+	nd->paramBytes = paramBytes;
+	nd->changed    = 1;
+	if(nInputs)    memcpy(nd->input,inputs,nInputs * sizeof(int));
+	if(paramBytes) memcpy(nd->params,params,paramBytes);
+
+	return g->nNodes++;
+}
+
+/****************************************************************************
+ Function    : TCgraphSet()
+ Description : Sets a node's parameters.  Only if they differ from the
+               current ones is the node (and whatever depends on it) re-run
+               at the next TCgraphEvaluate(), so an application may simply
+               set every node's parameters every frame.
+ Parameters  : TCgraph *     Graph from TCgraphCreate().
+               int           Node number from TCgraphAdd().
+               const void *  New parameters, the size given to
+                             TCgraphAdd(); copied.
+ Returns     : TC_OK on success, TC_ERR_VALUE if invalid parameter received.
+ ****************************************************************************/
+TCstatusCode TCgraphSet(
+  TCgraph    *g,
+  int         n,
+  const void *params)
+{
+	node *nd;
+
+	if(!g || (n < 0) || (n >= g->nNodes)) return TC_ERR_VALUE;
+	nd = &g->node[n];
+	if(!nd->paramBytes) return TC_OK;
+	if(!params) return TC_ERR_VALUE;
+
+	if(memcmp(nd->params,params,nd->paramBytes))
+	{
+		memcpy(nd->params,params,nd->paramBytes);
+		nd->changed = 1;
+	}
+
+	return TC_OK;
+}
+
+/****************************************************************************
+ Function    : TCgraphEvaluate()
+ Description : Brings every node's output up to date.  A node whose
+               parameters changed is re-run over the whole image.  A
+               pointwise node whose inputs changed is re-run over just
+               those spans; any other node with a changed input is re-run
+               whole.  Anything else is left as is, at no cost.  Each
+               node's changed spans (see TCgraphOutput()) then describe
+               the difference from the previous evaluation.
+ Parameters  : TCgraph *  Graph from TCgraphCreate().
+ Returns     : TC_OK on success, TC_ERR_VALUE if invalid parameter received.
+ ****************************************************************************/
+TCstatusCode TCgraphEvaluate(TCgraph *g)
+{
+	node   *nd,*src;
+	TCspan  all;
+	int     i,j,k,nWork,nTodo;
+
+	if(!g) return TC_ERR_VALUE;
+
+	all.start = 0;
+	all.n     = g->nPixels;
+	for(i=0;i<g->nNodes;i++)
+	{
+		nd = &g->node[i];
+
+		/* Gather the inputs' changes */
+		for(nWork=j=0;j<nd->nInputs;j++)
+		{
+			src = &g->node[nd->input[j]];
+			for(k=0;k<src->nSpans;k++)
+				g->work[nWork++] = src->span[k];
+		}
+
+		if(nd->changed || (nWork && !(nd->flags & TC_EFFECT_POINTWISE)))
+		{
+			nodeRun(g,nd,&all,1);
+		} else if(nWork)
+		{
+			/* Union of the inputs' spans.  Each input's list is in
+			   order already; with more than one, sort the lot. */
+			if(nd->nInputs > 1)
+				qsort(g->work,nWork,sizeof(TCspan),spanCompare);
+			for(nTodo=j=0;j<nWork;j++)
+			{
+				if(nTodo && (g->work[j].start <=
+				   g->work[nTodo - 1].start +
+				   g->work[nTodo - 1].n))
+				{
+					k = g->work[j].start + g->work[j].n -
+					  g->work[nTodo - 1].start;
+					if(k > g->work[nTodo - 1].n)
+						g->work[nTodo - 1].n = k;
+				} else
+				{
+					g->work[nTodo++] = g->work[j];
+				}
+			}
+			nodeRun(g,nd,g->work,nTodo);
+		} else
+		{
+			nd->nSpans = 0;
+		}
+		nd->changed = 0;
+	}
+
+	return TC_OK;
+}
+
+/****************************************************************************
+ Function    : TCgraphOutput()
+ Description : Gets a node's output image, as of the last
+               TCgraphEvaluate(), and optionally the spans of it that
+               changed in that evaluation.  Those may be passed straight to
+               TCrefreshDirty(); for that to be valid, evaluate the graph
+               once per refresh.
+ Parameters  : TCgraph *          Graph from TCgraphCreate().
+               int                Node number from TCgraphAdd().
+               const TCspan **    Returns the changed spans, in order
+                                  (NULL if not needed).  Valid until the
+                                  next evaluation.
+               int *              Returns the number of spans, 0 to
+                                  TC_GRAPH_MAX_SPANS (NULL if not needed).
+ Returns     : Output image (owned by the graph), or NULL on error.
+ ****************************************************************************/
+const TCpixel *TCgraphOutput(
+  TCgraph       *g,
+  int            n,
+  const TCspan **spans,
+  int           *nSpans)
+{
+	if(!g || (n < 0) || (n >= g->nNodes)) return NULL;
+
+	if(spans)  *spans  = g->node[n].span;
+	if(nSpans) *nSpans = g->node[n].nSpans;
+
+	return g->node[n].out;
+}
+
+/****************************************************************************
+ Function    : TCgraphDestroy()
+ Description : Frees an effect graph and all of its nodes.
+ Parameters  : TCgraph *  Graph from TCgraphCreate().
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCgraphDestroy(TCgraph *g)
+{
+	int i;
+
+	if(!g) return;
+	for(i=0;i<g->nNodes;i++)
+	{
+		free(g->node[i].out);
+		free(g->node[i].params);
+	}
+	free(g->node);
+	free(g->scratch);
+	free(g->work);
+	free(g);
+}
+
+/* Built-in effects.  All are pointwise. */
+
+/****************************************************************************
+ Function    : TCeffectFill()
+ Description : Generator: solid color.  No inputs.
+ Parameters  : Per TCeffectFunc; parameters are one TCpixel.
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCeffectFill(
+  TCpixel        *out,
+  const TCpixel **in,
+  const void     *params,
+  int             start,
+  int             n)
+{
+	TCpixel c = *(const TCpixel *)params;
+
+	for(out+=start;n--;) *out++ = c;
+}
+
+/****************************************************************************
+ Function    : TCeffectWave()
+ Description : Generator: sine waves, as TCrenderWave().  No inputs.
+ Parameters  : Per TCeffectFunc; parameters are a TCwave.
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCeffectWave(
+  TCpixel        *out,
+  const TCpixel **in,
+  const void     *params,
+  int             start,
+  int             n)
+{
+	TCrenderWave(out,start,n,(const TCwave *)params);
+}
+
+/****************************************************************************
+ Function    : TCeffectFade()
+ Description : Scales one input's brightness.
+ Parameters  : Per TCeffectFunc; parameters are an unsigned char level,
+               0 (black) to 255 (unchanged), as with TCsetFader().
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCeffectFade(
+  TCpixel        *out,
+  const TCpixel **in,
+  const void     *params,
+  int             start,
+  int             n)
+{
+	const TCpixel *src = &in[0][start];
+	unsigned int   a   = *(const unsigned char *)params,c;
+
+	a += a >> 7;  /* 0-256 */
+	for(out+=start;n--;)
+	{
+		c      = *src++;
+		*out++ = ((((c & 0xff00ff) * a) >> 8) & 0xff00ff) |
+		         ((((c & 0x00ff00) * a) >> 8) & 0x00ff00);
+	}
+}
+
+/* Component of color C at bit SHIFT, scaled by that component of M. */
+#define MASKED(C,M,SHIFT) \
+	(((((C) >> (SHIFT)) & 0xff) * ((((M) >> (SHIFT)) & 0xff) + 1)) >> 8)
+
+/****************************************************************************
+ Function    : TCeffectMask()
+ Description : Multiplies the first input by the second, component by
+               component: a white mask pixel passes the first input
+               unchanged, black blocks it, and colors tint it.
+ Parameters  : Per TCeffectFunc; no parameters.
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCeffectMask(
+  TCpixel        *out,
+  const TCpixel **in,
+  const void     *params,
+  int             start,
+  int             n)
+{
+	const TCpixel *src = &in[0][start],*mask = &in[1][start];
+	TCpixel        c,m;
+
+	for(out+=start;n--;)
+	{
+		c      = *src++;
+		m      = *mask++;
+		*out++ = (MASKED(c,m,16) << 16) | (MASKED(c,m,8) << 8) |
+		          MASKED(c,m,0);
+	}
+}
+
+/****************************************************************************
+ Function    : TCeffectMap()
+ Description : Color map: replaces each pixel of one input by the palette
+               entry for its brightness (luma), e.g. to colorize a
+               grayscale generator.
+ Parameters  : Per TCeffectFunc; parameters are a 256-entry TCpixel
+               palette (see TCmakePalette()).
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCeffectMap(
+  TCpixel        *out,
+  const TCpixel **in,
+  const void     *params,
+  int             start,
+  int             n)
+{
+	const TCpixel *src = &in[0][start],*palette = (const TCpixel *)params;
+	TCpixel        c;
+
+	for(out+=start;n--;)
+	{
+		c      = *src++;
+		*out++ = palette[(((c >> 16) & 0xff) * 77 +
+		                  ((c >>  8) & 0xff) * 150 +
+		                   (c        & 0xff) * 29) >> 8];
+	}
+}
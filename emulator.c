@@ -0,0 +1,371 @@
+/****************************************************************************
+ File        : emulator.c
+
+ Description : Software emulation of chains of P9813 pixels, for the p9813
+               library.  The emulator consumes the same byte stream the
+               library writes to the FTDI device -- bitbang, CBUS-clocked or
+               MPSSE -- recovers each strand's serial clock and data, and
+               shifts the bits through a simulated chain of pixels: start
+               frames and latches are detected, each pixel's flag/checksum
+               byte is verified, and the color every pixel would be showing
+               is available to the application.  TCemuSink() has the form
+               of an output sink, so an emulator can be attached directly
+               with TCsetSink() to check every frame with no hardware.
+
+               Colors are as received by the pixels, i.e. after gamma
+               correction and remapping.
+
+ License     : Copyright 2011 Phillip Burgess.    www.PaintYourDragon.com
+
+               This Program is free software: you can redistribute it and/or
+               modify it under the terms of the GNU General Public License as
+               published by the Free Software Foundation, either version 3 of
+               the License, or (at your option) any later version.
+
+               This Program is distributed in the hope that it will be
+               useful, but WITHOUT ANY WARRANTY; without even the implied
+               warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+               PURPOSE.  See the GNU General Public License for more details.
+
+               You should have received a copy of the GNU General Public
+               License along with this Program.  If not, see
+               <http://www.gnu.org/licenses/>.
+
+               Additional permission under GNU GPL version 3 section 7
+
+               If you modify this Program, or any covered work, by linking
+               or combining it with libftd2xx (or a modified version of that
+               library), containing parts covered by the license terms of
+               Future Technology Devices International Limited, the licensors
+               of this Program grant you additional permission to convey the
+               resulting work.
+ ****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "p9813.h"
+
+/* Per-strand receive state.  Between words the strand is idle, counting
+   zero bits; 32 or more zeros is a start frame (or latch), after which
+   the next 1 bit begins a pixel word (whose flag bits are always 1).
+   Words then follow back-to-back until an all-zero word. */
+typedef struct {
+	uint32_t       word;       /* Bits received so far                */
+	int            bits,       /* Number of bits in word, 0 if idle   */
+	               zeros,      /* Consecutive zero bits while idle    */
+	               synced,     /* Start frame seen                    */
+	               pixel;      /* Next pixel to receive a word        */
+	unsigned char  mask;       /* Data pin(s) (bitbang modes)         */
+	TCpixel       *pending,    /* Words received since last latch     */
+	              *shown;      /* Colors as of last latch             */
+} emuStrand;
+
+struct TCemulator {
+	int            nStrands,
+	               nPixels,    /* Pixels per strand                   */
+	               mode;       /* 0, TC_CBUS_CLOCK or TC_MPSSE        */
+	unsigned char  clockMask,  /* Clock pin (software clock mode)     */
+	               clockPrev;  /* Clock level at end of last byte     */
+	int            cmdArgs;    /* MPSSE: argument bytes still to skip */
+	long           cmdData;    /* MPSSE: data bytes still to come     */
+	unsigned char  cmd,        /* MPSSE: current command              */
+	               cmdLen[2];  /* MPSSE: 0x11 length bytes            */
+	TCemuStats     stats;
+	emuStrand      strand[8];
+};
+
+/****************************************************************************
+ Function    : TCemuCreate()
+ Description : Creates an emulator for a display of the given layout.  Pin
+               assignments are taken from the library's current settings
+               (see TCsetStrandPin()), so must be configured beforehand.
+ Parameters  : unsigned char  Number of strands and mode flags, exactly as
+                              passed to TCopen().
+               int            Number of pixels per strand.
+ Returns     : Emulator handle, or NULL if invalid parameter received or
+               malloc() failure.
+ ****************************************************************************/
+TCemulator *TCemuCreate(
+  unsigned char s,
+  int           p)
+{
+	TCemulator *emu;
+	TCpixel    *buf;
+	int         i,mode;
+
+	if(p < 1) return NULL;
+	if(s & TC_MPSSE)
+	{
+		if((s & ~TC_MPSSE) > 1) return NULL;
+		mode = TC_MPSSE;
+		s    = 1;
+	} else
+	{
+		if((s < 1) || (s > 16)) return NULL;
+		mode = (s >= TC_CBUS_CLOCK) ? TC_CBUS_CLOCK : 0;
+		if(s > TC_CBUS_CLOCK) s -= TC_CBUS_CLOCK;
+	}
+
+	if(!(emu = (TCemulator *)malloc(sizeof(TCemulator) +
+	  2 * s * p * sizeof(TCpixel)))) return NULL;
+
+	bzero(emu,sizeof(TCemulator));
+	emu->nStrands  = s;
+	emu->nPixels   = p;
+	emu->mode      = mode;
+	emu->clockMask = TCgetStrandPin(7);
+	buf            = (TCpixel *)&emu[1];
+	for(i=0;i<s;i++)
+	{
+		emu->strand[i].mask    = TCgetStrandPin(i);
+		emu->strand[i].pending = &buf[(i * 2    ) * p];
+		emu->strand[i].shown   = &buf[(i * 2 + 1) * p];
+	}
+	bzero(buf,2 * s * p * sizeof(TCpixel));
+
+	return emu;
+}
+
+/* Latch: pixels take on the colors received since the last one. */
+static void latch(
+  TCemulator *emu,
+  emuStrand  *st)
+{
+	if(st->pixel < emu->nPixels) emu->stats.shortFrames++;
+	memcpy(st->shown,st->pending,emu->nPixels * sizeof(TCpixel));
+	if(st == emu->strand) emu->stats.frames++;
+	st->pixel = 0;
+}
+
+/* Completed 32-bit word on one strand. */
+static void word(
+  TCemulator *emu,
+  emuStrand  *st)
+{
+	uint32_t w = st->word;
+
+	st->bits = 0;
+	st->word = 0;
+	if(!w)
+	{
+		/* Start frame; if pixels were received, it's a latch. */
+		if(st->pixel) latch(emu,st);
+		st->zeros = 32;
+		return;
+	}
+
+	/* Flag bits (11) and inverted copies of the top two bits of blue,
+	   green and red, as generated by P9813_WORD() in p9813.c. */
+	if((w >> 24) != (0xff & ~(((w >> 18) & 0x30) | ((w >> 12) & 0x0c) |
+	  ((w >> 6) & 0x03))))
+		emu->stats.badWords++;
+
+	emu->stats.words++;
+	if(st->pixel < emu->nPixels)
+	{
+		st->pending[st->pixel++] =
+		  ((w & 0xff) << 16) | (w & 0xff00) | ((w >> 16) & 0xff);
+	} else
+	{
+		/* Passed off the end of the chain */
+		emu->stats.overruns++;
+	}
+}
+
+/* One clocked bit on one strand. */
+static inline void bit(
+  TCemulator *emu,
+  emuStrand  *st,
+  int         b)
+{
+	if(st->bits)
+	{
+		st->word = (st->word << 1) | b;
+		if(++st->bits == 32) word(emu,st);
+	} else if(b)
+	{
+		/* First bit of a pixel word, if a start frame preceded it;
+		   stray bits before then are ignored, as a real chain would
+		   (eventually) resync. */
+		if(st->synced)
+		{
+			st->word = 1;
+			st->bits = 1;
+		}
+		st->zeros = 0;
+	} else if(++st->zeros >= 32)
+	{
+		if(st->pixel) latch(emu,st);
+		st->synced = 1;
+		st->zeros  = 0;
+	}
+}
+
+/* Eight clocked bits (MSB first) on a strand that's in the middle of a
+   word with room for all of them: the common case, done in one step. */
+static inline int byteFast(
+  TCemulator   *emu,
+  emuStrand    *st,
+  unsigned char b)
+{
+	if((st->bits == 0) || (st->bits > 24)) return 0;
+
+	st->word  = (st->word << 8) | b;
+	if((st->bits += 8) == 32) word(emu,st);
+
+	return 1;
+}
+
+/****************************************************************************
+ Function    : TCemuSink()
+ Description : Feeds bytes, as written by the library to the FTDI device,
+               to an emulator.  Has the form of an output sink, so may be
+               passed directly to TCsetSink() (with the emulator handle as
+               its argument); or captured data may be fed in afterward, in
+               pieces of any size.
+ Parameters  : const unsigned char *  Data.
+               int                    Number of bytes.
+               void *                 Emulator handle from TCemuCreate().
+ Returns     : TC_OK (always).
+ ****************************************************************************/
+TCstatusCode TCemuSink(
+  const unsigned char *data,
+  int                  len,
+  void                *arg)
+{
+	TCemulator   *emu = (TCemulator *)arg;
+	emuStrand    *st;
+	unsigned char c,clk,prev;
+	int           i,j,n;
+
+	if(TC_MPSSE == emu->mode)
+	{
+		/* Walk the MPSSE command stream.  Only the data of
+		   "clock bytes out" commands reaches the pixels; other
+		   commands' arguments are skipped. */
+		st = emu->strand;
+		while(len > 0)
+		{
+			if(emu->cmdData)
+			{
+				n = (emu->cmdData < len) ? emu->cmdData : len;
+				for(i=0;i<n;i++)
+				{
+					if(byteFast(emu,st,data[i])) continue;
+					for(j=7;j>=0;j--)
+						bit(emu,st,(data[i] >> j) & 1);
+				}
+				emu->cmdData -= n;
+				data         += n;
+				len          -= n;
+			} else if(emu->cmdArgs)
+			{
+				c = *data++;
+				len--;
+				if(0x11 == emu->cmd)
+				{
+					emu->cmdLen[2 - emu->cmdArgs] = c;
+					if(1 == emu->cmdArgs)
+						emu->cmdData = (emu->cmdLen[0] |
+						  (emu->cmdLen[1] << 8)) + 1L;
+				}
+				emu->cmdArgs--;
+			} else
+			{
+				emu->cmd = *data++;
+				len--;
+				switch(emu->cmd)
+				{
+				   case 0x11:               /* Write bytes   */
+				   case 0x80: case 0x82:    /* Set pins      */
+				   case 0x86:               /* Clock divisor */
+					emu->cmdArgs = 2;
+					break;
+				   default:                 /* No arguments  */
+					emu->cmdArgs = 0;
+					break;
+				}
+			}
+		}
+	} else if(TC_CBUS_CLOCK == emu->mode)
+	{
+		/* Hardware clock: every byte is one clock. */
+		for(i=0;i<len;i++)
+		{
+			c = data[i];
+			for(j=0;j<emu->nStrands;j++)
+			{
+				st = &emu->strand[j];
+				bit(emu,st,(c & st->mask) != 0);
+			}
+		}
+	} else
+	{
+		/* Software clock: data is sampled on rising edges of the
+		   clock pin.  The clock level carries over between calls,
+		   as an edge may straddle two writes. */
+		clk  = emu->clockMask;
+		prev = emu->clockPrev;
+		for(i=0;i<len;i++)
+		{
+			c = data[i];
+			if((c & clk) && !prev)
+			{
+				for(j=0;j<emu->nStrands;j++)
+				{
+					st = &emu->strand[j];
+					bit(emu,st,(c & st->mask) != 0);
+				}
+			}
+			prev = c & clk;
+		}
+		emu->clockPrev = prev;
+	}
+
+	return TC_OK;
+}
+
+/****************************************************************************
+ Function    : TCemuPixels()
+ Description : Returns the colors currently shown by one strand's pixels,
+               as of the most recent latch.
+ Parameters  : TCemulator *  Emulator handle.
+               int           Strand number.
+ Returns     : Pointer to pixel colors, one TCpixel per pixel per strand
+               (valid until next TCemuSink() call), or NULL if invalid
+               strand number.
+ ****************************************************************************/
+const TCpixel *TCemuPixels(
+  TCemulator *emu,
+  int         strand)
+{
+	if((strand < 0) || (strand >= emu->nStrands)) return NULL;
+
+	return emu->strand[strand].shown;
+}
+
+/****************************************************************************
+ Function    : TCemuGetStats()
+ Description : Returns counts of frames, pixel words and errors seen by an
+               emulator since it was created.
+ Parameters  : TCemulator *  Emulator handle.
+               TCemuStats *  Destination structure.
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCemuGetStats(
+  TCemulator *emu,
+  TCemuStats *stats)
+{
+	*stats = emu->stats;
+}
+
+/****************************************************************************
+ Function    : TCemuDestroy()
+ Description : Frees an emulator.
+ Parameters  : TCemulator *  Emulator handle.
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCemuDestroy(TCemulator *emu)
+{
+	free(emu);
+}
@@ -0,0 +1,229 @@
+/****************************************************************************
+ File        : exporter.c
+
+ Description : Metrics exporter for the p9813 library.  Serves the
+               statistics page published by an application with
+               TCpublishStats() over HTTP, in the Prometheus text format,
+               so a display's frame rate, throughput, current draw and
+               errors can be monitored alongside everything else.  Each
+               scrape takes a snapshot of the page (TCstatsRead()); the
+               application's output is never paused or slowed.  When no
+               application is publishing, p9813_up reads 0.
+
+               Example calling sequence:
+
+               exporter -p 9813
+
+               -n  Shared memory object name (default "/p9813", as
+                   TC_STATS_NAME).
+               -a  Address to listen on (default 127.0.0.1, local
+                   connections only).
+               -p  Port to listen on (default 9813).
+
+ License     : Copyright 2011 Phillip Burgess.    www.PaintYourDragon.com
+
+               This Program is free software: you can redistribute it and/or
+               modify it under the terms of the GNU General Public License as
+               published by the Free Software Foundation, either version 3 of
+               the License, or (at your option) any later version.
+
+               This Program is distributed in the hope that it will be
+               useful, but WITHOUT ANY WARRANTY; without even the implied
+               warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+               PURPOSE.  See the GNU General Public License for more details.
+
+               You should have received a copy of the GNU General Public
+               License along with this Program.  If not, see
+               <http://www.gnu.org/licenses/>.
+
+               Additional permission under GNU GPL version 3 section 7
+
+               If you modify this Program, or any covered work, by linking
+               or combining it with libftd2xx (or a modified version of that
+               library), containing parts covered by the license terms of
+               Future Technology Devices International Limited, the licensors
+               of this Program grant you additional permission to convey the
+               resulting work.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "p9813.h"
+
+#define REPLY_SIZE 8192
+
+/* Appends one metric, with help and type lines, to the reply. */
+static int metric(
+  char       *buf,
+  int         len,
+  const char *name,
+  const char *type,
+  const char *help,
+  double      value)
+{
+	return len + snprintf(&buf[len],REPLY_SIZE - len,
+	  "# HELP p9813_%s %s\n# TYPE p9813_%s %s\np9813_%s %.15g\n",
+	  name,help,name,type,name,value);
+}
+
+/* Prometheus text for the current state of the page, if any. */
+static int formatMetrics(
+  const char *name,
+  char       *buf)
+{
+	const TCstatsPage *page;
+	TCstatsPage        p;
+	int                i,len,up = 0;
+
+	if((page = TCstatsAttach(name)))
+	{
+		/* EPERM means the process exists but belongs to another
+		   user, as is usual when the exporter runs separately. */
+		up = (TCstatsRead(page,&p) == TC_OK) &&
+		  (!kill((pid_t)p.pid,0) || (errno != ESRCH));
+		TCstatsDetach(page);
+	}
+
+	len = metric(buf,0,"up","gauge",
+	  "Whether an application is publishing statistics.",up);
+	if(!up) return len;
+
+	len = metric(buf,len,"start_time_seconds","gauge",
+	  "When statistics were first published.",p.usecStart / 1e6);
+	len = metric(buf,len,"last_update_seconds","gauge",
+	  "When statistics were last updated.",p.usecUpdated / 1e6);
+	len = metric(buf,len,"strands","gauge",
+	  "Number of strands.",p.nStrands);
+	len = metric(buf,len,"pixels_per_strand","gauge",
+	  "Pixels per strand.",p.pixelsPerStrand);
+	len = metric(buf,len,"frames_total","counter",
+	  "Frames issued.",p.stats.frames);
+	len = metric(buf,len,"bits_total","counter",
+	  "Bits issued, counting each strand's separately.",
+	  p.stats.bitsTotal);
+	len = metric(buf,len,"io_seconds_total","counter",
+	  "Time spent writing to the device.",p.stats.usecIoTotal / 1e6);
+	len = metric(buf,len,"frame_seconds_total","counter",
+	  "Time from first frame to last.",p.stats.usecFrameTotal / 1e6);
+	len = metric(buf,len,"fps","gauge",
+	  "Frame rate, latest frame.",p.stats.fps);
+	len = metric(buf,len,"bits_per_second","gauge",
+	  "Write speed, latest frame.",p.stats.bps);
+	len = metric(buf,len,"current_milliamps","gauge",
+	  "Estimated current draw, latest frame.",p.stats.ma);
+	len = metric(buf,len,"current_milliamps_peak","gauge",
+	  "Peak estimated current draw.",p.stats.maMax);
+	len = metric(buf,len,"charge_milliamp_hours_total","counter",
+	  "Estimated charge used.",p.stats.mahTotal);
+	len += snprintf(&buf[len],REPLY_SIZE - len,
+	  "# HELP p9813_strand_current_milliamps Estimated current draw of "
+	  "each strand, latest frame.\n"
+	  "# TYPE p9813_strand_current_milliamps gauge\n");
+	for(i=0;(i<p.nStrands) && (i<8);i++)
+		len += snprintf(&buf[len],REPLY_SIZE - len,
+		  "p9813_strand_current_milliamps{strand=\"%d\"} %.15g\n",
+		  i,p.stats.maStrand[i]);
+	len = metric(buf,len,"frames_limited_total","counter",
+	  "Frames dimmed by the current limit.",p.stats.framesLimited);
+	len = metric(buf,len,"write_errors_total","counter",
+	  "Frames with a write error.",p.writeErrors);
+	len = metric(buf,len,"device_outages_total","counter",
+	  "Times the device was lost and recovery begun.",p.stats.outages);
+	len = metric(buf,len,"device_recoveries_total","counter",
+	  "Times the device was reopened.",p.stats.recoveries);
+	len = metric(buf,len,"outage_dropped_frames_total","counter",
+	  "Frames discarded while the device was lost.",p.stats.framesDropped);
+	len = metric(buf,len,"outage_seconds_total","counter",
+	  "Time spent without the device in recovered outages.",
+	  (double)p.stats.usecOutageTotal / 1000000.0);
+	len = metric(buf,len,"mailbox_submitted_total","counter",
+	  "Frames submitted to the frame mailbox.",p.mailbox.submitted);
+	len = metric(buf,len,"mailbox_superseded_total","counter",
+	  "Frames replaced by newer ones before being sent.",
+	  p.mailbox.superseded);
+	len = metric(buf,len,"mailbox_dropped_total","counter",
+	  "Frames dropped from a full mailbox queue.",p.mailbox.dropped);
+	len = metric(buf,len,"mailbox_wire_seconds","gauge",
+	  "Mean time from submission to sending.",p.mailbox.usecWire / 1e6);
+
+	return len;
+}
+
+int main(int argc,char *argv[])
+{
+	int                 i,fd,conn,len,
+	  port        = 9813,
+	  one         = 1;
+	char               *name    = NULL,
+	                   *address = "127.0.0.1",
+	                    request[1024],
+	                    header[128],
+	                   *body;
+	struct sockaddr_in  addr;
+
+	while((i = getopt(argc,argv,"n:a:p:")) != -1)
+	{
+		switch(i)
+		{
+		   case 'n':
+			name    = optarg;
+			break;
+		   case 'a':
+			address = optarg;
+			break;
+		   case 'p':
+			port    = strtol(optarg,NULL,0);
+			break;
+		   case '?':
+		   default:
+			(void)printf("usage: %s [-n name] [-a address] "
+			  "[-p port]\n",argv[0]);
+			return 1;
+		}
+	}
+
+	if(!(body = (char *)malloc(REPLY_SIZE)))
+	{
+		TCprintError(TC_ERR_MALLOC);
+		return 1;
+	}
+
+	bzero(&addr,sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port   = htons(port);
+	if(!inet_aton(address,&addr.sin_addr) ||
+	   ((fd = socket(AF_INET,SOCK_STREAM,0)) < 0) ||
+	   setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one)) ||
+	   bind(fd,(struct sockaddr *)&addr,sizeof(addr)) || listen(fd,8))
+	{
+		perror("exporter");
+		return 1;
+	}
+	(void)signal(SIGPIPE,SIG_IGN);
+	(void)printf("Serving %s on http://%s:%d/metrics\n",
+	  name ? name : TC_STATS_NAME,address,port);
+
+	/* One request per connection; any path gets the metrics. */
+	for(;;)
+	{
+		if((conn = accept(fd,NULL,NULL)) < 0) continue;
+		(void)read(conn,request,sizeof(request));
+		len = formatMetrics(name,body);
+		if(len >= REPLY_SIZE) len = REPLY_SIZE - 1;  /* Truncated */
+		i = snprintf(header,sizeof(header),"HTTP/1.0 200 OK\r\n"
+		  "Content-Type: text/plain; version=0.0.4\r\n"
+		  "Content-Length: %d\r\n\r\n",len);
+		if(write(conn,header,i) == i) (void)write(conn,body,len);
+		close(conn);
+	}
+
+	return 0;
+}
@@ -0,0 +1,243 @@
+/****************************************************************************
+ File        : jitter.c
+
+ Description : Output timing benchmark for the p9813 library.  Frames are
+               submitted at a steady rate to the frame mailbox (see
+               TCsubmit()), whose output thread writes them to a null sink
+               in place of the FTDI device, optionally while other threads
+               load the system.  The output thread's wakeup latency (see
+               TCgetLatency()) is then reported as a histogram, showing
+               the scheduling jitter the output path sees with and without
+               real-time mode (TCsetRealtime()).  No adapter is needed.
+
+               Example calling sequences:
+
+               jitter -l 8
+               sudo jitter -l 8 -R 80 -C 1
+
+               -s  Number of strands (default 1).
+               -p  Pixels per strand (default 100).
+               -f  Frame rate (default 100).
+               -t  Duration in seconds (default 10).
+               -w  Time the null sink spends on each write, in
+                   microseconds, to stand in for USB I/O (default 0).
+               -l  Number of threads to load the system with: each spins,
+                   allocating and touching memory (default 0).
+               -R  Real-time priority for the output thread, 1 to 99
+                   (default 0, normal scheduling).
+               -C  CPU to run the output thread on (default any).
+
+ License     : Copyright 2011 Phillip Burgess.    www.PaintYourDragon.com
+
+               This Program is free software: you can redistribute it and/or
+               modify it under the terms of the GNU General Public License as
+               published by the Free Software Foundation, either version 3 of
+               the License, or (at your option) any later version.
+
+               This Program is distributed in the hope that it will be
+               useful, but WITHOUT ANY WARRANTY; without even the implied
+               warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+               PURPOSE.  See the GNU General Public License for more details.
+
+               You should have received a copy of the GNU General Public
+               License along with this Program.  If not, see
+               <http://www.gnu.org/licenses/>.
+
+               Additional permission under GNU GPL version 3 section 7
+
+               If you modify this Program, or any covered work, by linking
+               or combining it with libftd2xx (or a modified version of that
+               library), containing parts covered by the license terms of
+               Future Technology Devices International Limited, the licensors
+               of this Program grant you additional permission to convey the
+               resulting work.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "p9813.h"
+
+#define LOAD_BYTES (4 * 1024 * 1024)
+
+static volatile int running = 1;
+
+static unsigned long long usecNow(void)
+{
+	struct timeval t;
+
+	gettimeofday(&t,NULL);
+	return (unsigned long long)t.tv_sec * 1000000 + t.tv_usec;
+}
+
+/* Null sink: discards output, optionally after spinning for a while to
+   stand in for the time a USB write would take. */
+static TCstatusCode nullSink(
+  const unsigned char *data,
+  int                  len,
+  void                *arg)
+{
+	unsigned long long end;
+
+	if(*(long *)arg)
+	{
+		end = usecNow() + *(long *)arg;
+		while(usecNow() < end);
+	}
+
+	return TC_OK;
+}
+
+/* System load: keep a CPU busy, freeing and re-touching fresh memory so
+   the kernel has page faults and reclaim to deal with too. */
+static void *loadLoop(void *arg)
+{
+	char *buf;
+	int   i;
+
+	while(running)
+	{
+		if(!(buf = (char *)malloc(LOAD_BYTES))) continue;
+		for(i=0;i<LOAD_BYTES;i+=4096) buf[i] = i;
+		free(buf);
+	}
+
+	return NULL;
+}
+
+int main(int argc,char *argv[])
+{
+	int                i,f,nFrames,
+	  nStrands        = 1,
+	  pixelsPerStrand = 100,
+	  nLoad           = 0,
+	  priority        = 0,
+	  cpu             = -1;
+	long               writeTime = 0;
+	double             fps       = 100.0,
+	                   duration  = 10.0;
+	unsigned long long next,now;
+	TCpixel           *pixelBuf;
+	pthread_t         *load = NULL;
+	TCstatusCode       status;
+	TClatencyStats     lat;
+	TCsubmitStats      counts;
+
+	while((i = getopt(argc,argv,"s:p:f:t:w:l:R:C:")) != -1)
+	{
+		switch(i)
+		{
+		   case 's':
+			nStrands        = strtol(optarg,NULL,0);
+			break;
+		   case 'p':
+			pixelsPerStrand = strtol(optarg,NULL,0);
+			break;
+		   case 'f':
+			fps             = strtod(optarg,NULL);
+			break;
+		   case 't':
+			duration        = strtod(optarg,NULL);
+			break;
+		   case 'w':
+			writeTime       = strtol(optarg,NULL,0);
+			break;
+		   case 'l':
+			nLoad           = strtol(optarg,NULL,0);
+			break;
+		   case 'R':
+			priority        = strtol(optarg,NULL,0);
+			break;
+		   case 'C':
+			cpu             = strtol(optarg,NULL,0);
+			break;
+		   case '?':
+		   default:
+			(void)printf("usage: %s [-s strands] [-p pixels] "
+			  "[-f fps] [-t seconds] [-w usec]\n"
+			  "       [-l threads] [-R priority] [-C cpu]\n",
+			  argv[0]);
+			return 1;
+		}
+	}
+
+	if((fps <= 0.0) || (duration <= 0.0) || (writeTime < 0) ||
+	   (nLoad < 0))
+	{
+		TCprintError(TC_ERR_VALUE);
+		return 1;
+	}
+
+	if(NULL == (pixelBuf = (TCpixel *)malloc(
+	  nStrands * pixelsPerStrand * sizeof(TCpixel))))
+	{
+		TCprintError(TC_ERR_MALLOC);
+		return 1;
+	}
+
+	TCsetSink(nullSink,&writeTime);
+	if((status = TCopen(nStrands,pixelsPerStrand)) != TC_OK)
+	{
+		TCprintError(status);
+		if(status < TC_ERR_DIVISOR) return 1;
+	}
+	if(((status = TCsetRealtime(priority,cpu)) != TC_OK) ||
+	   ((status = TCsubmitStart(TC_SUBMIT_LATEST,0,0,NULL,NULL)) != TC_OK))
+	{
+		TCprintError(status);
+		TCclose();
+		return 1;
+	}
+
+	if(nLoad && (load = (pthread_t *)malloc(nLoad * sizeof(pthread_t))))
+	{
+		for(i=0;i<nLoad;i++)
+			(void)pthread_create(&load[i],NULL,loadLoop,NULL);
+	}
+
+	(void)printf("%d strand(s) x %d pixels, %.1f fps for %.1f s, "
+	  "%d load thread(s), %s\n",nStrands,pixelsPerStrand,fps,duration,
+	  nLoad,priority ? "real-time" : "normal scheduling");
+
+	/* Frames are submitted on an absolute schedule, so the producer's
+	   own lateness doesn't accumulate. */
+	nFrames = (int)(fps * duration + 0.5);
+	for(next=usecNow(),f=0;f<nFrames;f++)
+	{
+		for(i=nStrands*pixelsPerStrand-1;i>=0;i--)
+			pixelBuf[i] = TCrgb(f & 0xff,i & 0xff,(f + i) & 0xff);
+		(void)TCsubmit(pixelBuf);
+
+		next += (unsigned long long)(1000000.0 / fps);
+		if(next > (now = usecNow())) usleep((useconds_t)(next - now));
+	}
+
+	running = 0;
+	if(load)
+	{
+		for(i=0;i<nLoad;i++) pthread_join(load[i],NULL);
+		free(load);
+	}
+	TCgetLatency(&lat);
+	TCsubmitGetStats(&counts);
+	TCclose();
+
+	(void)printf("Frames: %lu submitted, %lu sent, %lu superseded\n",
+	  counts.submitted,counts.sent,counts.superseded);
+	(void)printf("Output thread wakeup latency (%lu samples):\n"
+	  "  min %lu uS, avg %.1f uS, max %lu uS, std dev %.1f uS\n",
+	  lat.samples,lat.usecMin,lat.usecAvg,lat.usecMax,lat.usecDev);
+	for(i=0;i<8;i++)
+	{
+		if(i < 7) (void)printf("  < %4d uS: ",16 << i);
+		else      (void)printf("  >=%4d uS: ",16 << (i - 1));
+		(void)printf("%8lu  %5.1f%%\n",lat.hist[i],lat.samples ?
+		  100.0 * (double)lat.hist[i] / (double)lat.samples : 0.0);
+	}
+
+	free(pixelBuf);
+	return 0;
+}
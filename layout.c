@@ -0,0 +1,542 @@
+/****************************************************************************
+ File        : layout.c
+
+ Description : Compiled layouts for the p9813 library.  A layout describes
+               where each pixel on each strand physically sits: which cell
+               of a rectangular image grid it shows and its x,y,z position.
+               TClayoutCompile() turns a text description of an
+               installation into a binary layout file, and TClayoutOpen()
+               (or TCopenLayout()) maps that file into memory, where its
+               remap table can be passed straight to TCrefresh().  Opening
+               a layout takes no parsing, just a range check of the tables,
+               however large the installation, so applications need not
+               rebuild remap tables at startup.
+
+               Layout files are in the byte order of the machine that
+               compiled them, so they can be used in place; a file from a
+               machine of the other byte order is rejected (recompile it).
+
+ License     : Copyright 2011 Phillip Burgess.    www.PaintYourDragon.com
+
+               This Program is free software: you can redistribute it and/or
+               modify it under the terms of the GNU General Public License as
+               published by the Free Software Foundation, either version 3 of
+               the License, or (at your option) any later version.
+
+               This Program is distributed in the hope that it will be
+               useful, but WITHOUT ANY WARRANTY; without even the implied
+               warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+               PURPOSE.  See the GNU General Public License for more details.
+
+               You should have received a copy of the GNU General Public
+               License along with this Program.  If not, see
+               <http://www.gnu.org/licenses/>.
+
+               Additional permission under GNU GPL version 3 section 7
+
+               If you modify this Program, or any covered work, by linking
+               or combining it with libftd2xx (or a modified version of that
+               library), containing parts covered by the license terms of
+               Future Technology Devices International Limited, the licensors
+               of this Program grant you additional permission to convey the
+               resulting work.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "p9813.h"
+
+#define LAYOUT_MAGIC  "TCLAYOUT"
+#define LAYOUT_ORDER  0x01020304
+#define LAYOUT_ALIGN  16
+#define LAYOUT_MAXDIM 0x4000  /* Grid width/height limit */
+
+/* File header.  Sections follow at the given offsets, each aligned to
+   LAYOUT_ALIGN bytes: the remap table (int32 per strand position), the
+   LED for each image pixel (int32 strand position, or -1) and the
+   coordinates (3 floats per strand position). */
+typedef struct {
+	char     magic[8];
+	uint32_t byteOrder;       /* LAYOUT_ORDER as written               */
+	uint32_t nStrands;
+	uint32_t pixelsPerStrand;
+	uint32_t width;           /* Image grid                            */
+	uint32_t height;
+	uint32_t imageSize;       /* Grid cells plus free-standing pixels  */
+	uint32_t remapOffset;
+	uint32_t ledOffset;
+	uint32_t coordOffset;
+	uint32_t fileSize;
+} layoutHeader;
+
+/* An open layout: the public part, followed by what's needed to unmap
+   it again. */
+typedef struct {
+	TClayout  pub;
+	void     *base;
+	size_t    size;
+} layoutMap;
+
+/* One pixel while compiling: the image pixel it shows (grid cell, or
+   LED_FREE until numbered, or TC_PIXEL_UNUSED) and its position. */
+#define LED_FREE -3
+typedef struct {
+	int   image;
+	float x,y,z;
+} led;
+
+typedef struct {
+	led *leds;
+	int  n,size;
+} strandList;
+
+static int alignUp(int n)
+{
+	return (n + LAYOUT_ALIGN - 1) & ~(LAYOUT_ALIGN - 1);
+}
+
+/* Returns nonzero if each of the n entries of a mapped table is an index
+   below 'size', or a negative marker no lower than 'least'. */
+static int tableValid(
+  const int32_t *t,
+  unsigned long  n,
+  unsigned long  size,
+  int32_t        least)
+{
+	unsigned long i;
+
+	for(i=0;i<n;i++)
+		if((t[i] < least) || ((t[i] >= 0) && ((uint32_t)t[i] >= size)))
+			return 0;
+
+	return 1;
+}
+
+/* Append a pixel to a strand, growing its list as needed. */
+static TCstatusCode addLed(
+  strandList *s,
+  int         image,
+  double      x,
+  double      y,
+  double      z)
+{
+	led *l;
+
+	if(s->n == s->size)
+	{
+		if(!(l = (led *)realloc(s->leds,
+		  (s->size ? s->size * 2 : 256) * sizeof(led))))
+			return TC_ERR_MALLOC;
+		s->leds  = l;
+		s->size  = s->size ? s->size * 2 : 256;
+	}
+	l        = &s->leds[s->n++];
+	l->image = image;
+	l->x     = (float)x;
+	l->y     = (float)y;
+	l->z     = (float)z;
+
+	return TC_OK;
+}
+
+/* Write 'len' bytes, then zero padding up to 'total'. */
+static int writePadded(
+  FILE       *fp,
+  const void *data,
+  int         len,
+  int         total)
+{
+	static const char zero[LAYOUT_ALIGN] = { 0 };
+
+	if(len && (1 != fwrite(data,len,1,fp))) return 0;
+	return (total == len) || (1 == fwrite(zero,total - len,1,fp));
+}
+
+/* Build and write the binary layout from the parsed strands. */
+static TCstatusCode writeLayout(
+  const char       *filename,
+  const strandList *strand,
+  int               nStrands,
+  int               width,
+  int               height)
+{
+	layoutHeader  h;
+	FILE         *fp;
+	int           i,s,n,p,nLeds,nFree,remapSize,ledSize,coordSize,
+	             *remap,*ledOf;
+	float        *coord;
+	char         *tmpName;
+	const led    *l;
+	TCstatusCode  status = TC_OK;
+
+	bzero(&h,sizeof(h));
+	memcpy(h.magic,LAYOUT_MAGIC,8);
+	h.byteOrder = LAYOUT_ORDER;
+	h.nStrands  = nStrands;
+	h.width     = width;
+	h.height    = height;
+	for(nFree=s=0;s<nStrands;s++)
+	{
+		if(strand[s].n > (int)h.pixelsPerStrand)
+			h.pixelsPerStrand = strand[s].n;
+		for(i=0;i<strand[s].n;i++)
+			if(strand[s].leds[i].image == LED_FREE) nFree++;
+	}
+	if(!h.pixelsPerStrand) return TC_ERR_VALUE;
+	h.imageSize = width * height + nFree;
+
+	nLeds         = nStrands * h.pixelsPerStrand;
+	remapSize     = alignUp(nLeds * sizeof(int32_t));
+	ledSize       = alignUp(h.imageSize * sizeof(int32_t));
+	coordSize     = alignUp(nLeds * 3 * sizeof(float));
+	h.remapOffset = alignUp(sizeof(h));
+	h.ledOffset   = h.remapOffset + remapSize;
+	h.coordOffset = h.ledOffset + ledSize;
+	h.fileSize    = h.coordOffset + coordSize;
+
+	if(!(remap = (int *)malloc(remapSize + ledSize + coordSize)))
+		return TC_ERR_MALLOC;
+	ledOf = (int *)((char *)remap + remapSize);
+	coord = (float *)((char *)ledOf + ledSize);
+	bzero(coord,coordSize);
+
+	/* Free-standing pixels are numbered after the grid, in strand
+	   order.  Where more than one pixel shows a grid cell, the first
+	   is listed as its LED. */
+	for(i=0;i<(int)h.imageSize;i++) ledOf[i] = -1;
+	for(n=width*height,s=0;s<nStrands;s++)
+	{
+		for(i=0;i<(int)h.pixelsPerStrand;i++)
+		{
+			p = s * h.pixelsPerStrand + i;
+			if(i >= strand[s].n)
+			{
+				remap[p] = TC_PIXEL_DISCONNECTED;
+				continue;
+			}
+			l        = &strand[s].leds[i];
+			remap[p] = (l->image == LED_FREE) ? n++ : l->image;
+			if((remap[p] >= 0) && (ledOf[remap[p]] < 0))
+				ledOf[remap[p]] = p;
+			coord[p * 3    ] = l->x;
+			coord[p * 3 + 1] = l->y;
+			coord[p * 3 + 2] = l->z;
+		}
+	}
+
+	/* Applications may have the old file mapped (see TClayoutOpen());
+	   rewriting it in place would pull the pages out from under them.
+	   Write a new file alongside and rename it over the old, so they
+	   keep the old contents until they reopen. */
+	if(!(tmpName = (char *)malloc(strlen(filename) + 5)))
+	{
+		free(remap);
+		return TC_ERR_MALLOC;
+	}
+	sprintf(tmpName,"%s.tmp",filename);
+	if((fp = fopen(tmpName,"wb")))
+	{
+		if(!writePadded(fp,&h,sizeof(h),h.remapOffset) ||
+		   !writePadded(fp,remap,nLeds * sizeof(int32_t),remapSize) ||
+		   !writePadded(fp,ledOf,h.imageSize * sizeof(int32_t),
+		     ledSize) ||
+		   !writePadded(fp,coord,coordSize,coordSize))
+			status = TC_ERR_FILE;
+		if(fclose(fp)) status = TC_ERR_FILE;
+		if((status != TC_OK) || rename(tmpName,filename))
+		{
+			(void)unlink(tmpName);
+			status = TC_ERR_FILE;
+		}
+	} else status = TC_ERR_FILE;
+
+	free(tmpName);
+	free(remap);
+	return status;
+}
+
+/****************************************************************************
+ Function    : TClayoutCompile()
+ Description : Compiles a text description of an installation into a
+               binary layout file for TClayoutOpen().  The description has
+               one command per line; anything after '#' is a comment:
+
+               grid W H [pitch]     Image grid of W x H pixels, cells
+                                    'pitch' apart (default 1.0) in x,y.
+                                    Must precede any command using grid
+                                    cells.
+               strand S             Following pixels are added to the end
+                                    of strand S (0-7, initially 0).
+               segment X Y N [DX DY]
+                                    N pixels in a line, showing grid cells
+                                    X,Y then X+DX,Y+DY and so on (default
+                                    step 1,0).
+               serpentine X Y W H [columns]
+                                    W x H block of grid cells from X,Y,
+                                    wired row by row, alternate rows
+                                    running right to left ('columns':
+                                    column by column, alternate columns
+                                    running bottom to top).
+               pixel X Y Z [GX GY]  One pixel at X,Y,Z, showing grid cell
+                                    GX,GY if given, else a free-standing
+                                    pixel numbered after the grid.
+               skip N               N pixels attached but not shown
+                                    (TC_PIXEL_UNUSED).
+
+               Pixels on the grid are positioned at their cell, at z = 0.
+ Parameters  : const char *  Description filename.
+               const char *  Layout filename to write.
+               int *         Optional; on TC_ERR_VALUE, returns the line
+                             number of the offending command (NULL if not
+                             needed).
+ Returns     : TC_OK on success, TC_ERR_VALUE on bad command or value,
+               TC_ERR_FILE on file error, TC_ERR_MALLOC on malloc()
+               failure.
+ ****************************************************************************/
+TCstatusCode TClayoutCompile(
+  const char *srcName,
+  const char *dstName,
+  int        *errorLine)
+{
+	FILE         *fp;
+	char          line[256],cmd[32],opt[32],*c;
+	strandList    strand[8];
+	int           i,j,n,x,y,w,h,dx,dy,lineNum = 0,cur = 0,nStrands = 0,
+	              width = 0,height = 0;
+	double        pitch = 1.0,px,py,pz;
+	TCstatusCode  status = TC_OK;
+
+	if(!srcName || !dstName) return TC_ERR_VALUE;
+	if(!(fp = fopen(srcName,"r"))) return TC_ERR_FILE;
+	bzero(strand,sizeof(strand));
+
+#define CELL(X,Y) (((X) >= 0) && ((X) < width) && ((Y) >= 0) && ((Y) < height))
+#define ADD(X,Y)  addLed(&strand[cur],(Y) * width + (X),(X) * pitch, \
+                    (Y) * pitch,0.0)
+
+	while((status == TC_OK) && fgets(line,sizeof(line),fp))
+	{
+		lineNum++;
+		if((c = strchr(line,'#'))) *c = 0;
+		if(sscanf(line,"%31s",cmd) < 1) continue;
+		c = line + strspn(line," \t");
+		c += strlen(cmd);
+		opt[0] = 0;
+
+		if(!strcmp(cmd,"grid"))
+		{
+			/* Must come before any pixels (nStrands counts
+			   strands with any) */
+			n = sscanf(c,"%d %d %lf",&width,&height,&pitch);
+			if((n < 2) || (width < 1) || (width > LAYOUT_MAXDIM) ||
+			   (height < 1) || (height > LAYOUT_MAXDIM) ||
+			   (pitch <= 0.0) || nStrands)
+				status = TC_ERR_VALUE;
+		} else if(!strcmp(cmd,"strand"))
+		{
+			if((sscanf(c,"%d",&n) < 1) || (n < 0) || (n > 7))
+				status = TC_ERR_VALUE;
+			else
+				cur = n;
+		} else if(!strcmp(cmd,"segment"))
+		{
+			dx = 1;
+			dy = 0;
+			n = sscanf(c,"%d %d %d %d %d",&x,&y,&w,&dx,&dy);
+			if((n < 3) || (n == 4) || (w < 1) || !CELL(x,y) ||
+			   !CELL(x + (w - 1) * dx,y + (w - 1) * dy))
+				status = TC_ERR_VALUE;
+			for(i=0;(status == TC_OK) && (i<w);i++)
+				status = ADD(x + i * dx,y + i * dy);
+		} else if(!strcmp(cmd,"serpentine"))
+		{
+			if((sscanf(c,"%d %d %d %d %31s",&x,&y,&w,&h,opt) < 4) ||
+			   (w < 1) || (h < 1) || !CELL(x,y) ||
+			   !CELL(x + w - 1,y + h - 1) ||
+			   (opt[0] && strcmp(opt,"columns")))
+				status = TC_ERR_VALUE;
+			if(opt[0])
+			{
+				for(i=0;(status == TC_OK) && (i<w*h);i++)
+				{
+					j = i % h;
+					if((i / h) & 1) j = h - 1 - j;
+					status = ADD(x + i / h,y + j);
+				}
+			} else
+			{
+				for(i=0;(status == TC_OK) && (i<w*h);i++)
+				{
+					j = i % w;
+					if((i / w) & 1) j = w - 1 - j;
+					status = ADD(x + j,y + i / w);
+				}
+			}
+		} else if(!strcmp(cmd,"pixel"))
+		{
+			n = sscanf(c,"%lf %lf %lf %d %d",&px,&py,&pz,&x,&y);
+			if((n < 3) || (n == 4) || ((n == 5) && !CELL(x,y)))
+				status = TC_ERR_VALUE;
+			else
+				status = addLed(&strand[cur],
+				  (n == 5) ? y * width + x : LED_FREE,px,py,pz);
+		} else if(!strcmp(cmd,"skip"))
+		{
+			if((sscanf(c,"%d",&w) < 1) || (w < 1))
+				status = TC_ERR_VALUE;
+			for(i=0;(status == TC_OK) && (i<w);i++)
+				status = addLed(&strand[cur],TC_PIXEL_UNUSED,
+				  0.0,0.0,0.0);
+		} else status = TC_ERR_VALUE;
+
+		if(strand[cur].n && (cur >= nStrands)) nStrands = cur + 1;
+	}
+	fclose(fp);
+
+#undef ADD
+#undef CELL
+
+	if((status == TC_ERR_VALUE) && errorLine) *errorLine = lineNum;
+	if(status == TC_OK)
+	{
+		if(!nStrands)
+		{
+			if(errorLine) *errorLine = lineNum;
+			status = TC_ERR_VALUE;
+		} else
+			status = writeLayout(dstName,strand,nStrands,
+			  width,height);
+	}
+
+	for(i=0;i<8;i++) if(strand[i].leds) free(strand[i].leds);
+	return status;
+}
+
+/****************************************************************************
+ Function    : TClayoutOpen()
+ Description : Maps a layout file from TClayoutCompile() into memory.  The
+               layout's tables are read-only and remain valid until
+               TClayoutClose().
+ Parameters  : const char *  Layout filename.
+ Returns     : Layout, or NULL on error (including if the file is not a
+               layout file, or is from a machine of the other byte order).
+ ****************************************************************************/
+TClayout *TClayoutOpen(const char *filename)
+{
+	int                 fd;
+	struct stat         st;
+	void               *base;
+	const layoutHeader *h;
+	layoutMap          *map = NULL;
+	unsigned long       nLeds;
+
+	if((fd = open(filename,O_RDONLY)) < 0) return NULL;
+	if(fstat(fd,&st) || (st.st_size < (off_t)sizeof(layoutHeader)) ||
+	   (MAP_FAILED == (base = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,
+	   fd,0))))
+	{
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+
+	/* Check that the sections fit in the file as mapped, and that
+	   every remap and LED entry is in range or a marker, so nothing
+	   read through the tables (by TCrefresh() or the application)
+	   can fault. */
+	h     = (const layoutHeader *)base;
+	nLeds = (unsigned long)h->nStrands * h->pixelsPerStrand;
+	if(!memcmp(h->magic,LAYOUT_MAGIC,8) && (h->byteOrder == LAYOUT_ORDER) &&
+	   (h->nStrands >= 1) && (h->nStrands <= 8) &&
+	   (h->pixelsPerStrand >= 1) && (h->pixelsPerStrand < 0x1000000) &&
+	   (h->width <= LAYOUT_MAXDIM) && (h->height <= LAYOUT_MAXDIM) &&
+	   (h->imageSize >= h->width * h->height) &&
+	   (h->imageSize - h->width * h->height <= nLeds) &&
+	   (h->fileSize == (uint32_t)st.st_size) &&
+	   !(h->remapOffset % LAYOUT_ALIGN) && !(h->ledOffset % LAYOUT_ALIGN) &&
+	   !(h->coordOffset % LAYOUT_ALIGN) &&
+	   (h->remapOffset >= sizeof(layoutHeader)) &&
+	   (h->remapOffset + nLeds * sizeof(int32_t) <= h->ledOffset) &&
+	   (h->ledOffset + h->imageSize * sizeof(int32_t) <= h->coordOffset) &&
+	   (h->coordOffset + nLeds * 3 * sizeof(float) <= h->fileSize) &&
+	   tableValid((const int32_t *)((char *)base + h->remapOffset),nLeds,
+	   h->imageSize,TC_PIXEL_DISCONNECTED) &&
+	   tableValid((const int32_t *)((char *)base + h->ledOffset),
+	   h->imageSize,nLeds,-1) &&
+	   (map = (layoutMap *)malloc(sizeof(layoutMap))))
+	{
+		map->base                = base;
+		map->size                = st.st_size;
+		map->pub.nStrands        = h->nStrands;
+		map->pub.pixelsPerStrand = h->pixelsPerStrand;
+		map->pub.width           = h->width;
+		map->pub.height          = h->height;
+		map->pub.imageSize       = h->imageSize;
+		map->pub.remap           = (int *)((char *)base +
+		                             h->remapOffset);
+		map->pub.led             = (const int *)((char *)base +
+		                             h->ledOffset);
+		map->pub.coords          = (const float *)((char *)base +
+		                             h->coordOffset);
+		return &map->pub;
+	}
+
+	(void)munmap(base,st.st_size);
+	return NULL;
+}
+
+/****************************************************************************
+ Function    : TCopenLayout()
+ Description : Opens a layout file and the FTDI device with that layout's
+               strand count and length; TCopen() in one step for layout-
+               driven applications.  Pass the layout's remap table to
+               TCrefresh(), with an image of imageSize pixels.
+ Parameters  : const char *   Layout filename.
+               unsigned char  Mode bits (e.g. TC_CBUS_CLOCK) to combine with
+                              the layout's strand count for TCopen(), else 0.
+               TClayout **    Returns the layout; close with TClayoutClose()
+                              after TCclose().
+ Returns     : As TCopen(), or TC_ERR_FILE if the layout could not be
+               opened.  On TC_ERR_DIVISOR or TC_ERR_BAUDRATE, which TCopen()
+               treats as warnings, the layout is returned as well.
+ ****************************************************************************/
+TCstatusCode TCopenLayout(
+  const char     *filename,
+  unsigned char   mode,
+  TClayout      **layout)
+{
+	TCstatusCode status;
+
+	if(!layout) return TC_ERR_VALUE;
+	if(!(*layout = TClayoutOpen(filename))) return TC_ERR_FILE;
+
+	status = TCopen((unsigned char)(*layout)->nStrands | mode,
+	  (*layout)->pixelsPerStrand);
+	if((status == TC_OK) || (status == TC_ERR_DIVISOR) ||
+	   (status == TC_ERR_BAUDRATE)) return status;
+
+	TClayoutClose(*layout);
+	*layout = NULL;
+	return status;
+}
+
+/****************************************************************************
+ Function    : TClayoutClose()
+ Description : Unmaps a layout from TClayoutOpen() or TCopenLayout().
+ Parameters  : TClayout *  Layout (NULL is ignored).
+ Returns     : void
+ ****************************************************************************/
+void TClayoutClose(TClayout *layout)
+{
+	layoutMap *map = (layoutMap *)layout;
+
+	if(!map) return;
+	(void)munmap(map->base,map->size);
+	free(map);
+}
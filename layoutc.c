@@ -0,0 +1,126 @@
+/****************************************************************************
+ File        : layoutc.c
+
+ Description : Layout compiler for the p9813 library.  Compiles a text
+               description of an installation -- serpentine grids, runs of
+               pixels and free-standing pixels with x,y,z coordinates, on
+               each strand -- into a binary layout file (see
+               TClayoutCompile() for the description format), then opens
+               the result and prints a summary: the TCopen() call to
+               match, image size and the extent of the pixel coordinates.
+               Applications then load the layout with TCopenLayout().
+
+               Example calling sequence:
+
+               layoutc wall.txt wall.tcl
+
+ License     : Copyright 2011 Phillip Burgess.    www.PaintYourDragon.com
+
+               This Program is free software: you can redistribute it and/or
+               modify it under the terms of the GNU General Public License as
+               published by the Free Software Foundation, either version 3 of
+               the License, or (at your option) any later version.
+
+               This Program is distributed in the hope that it will be
+               useful, but WITHOUT ANY WARRANTY; without even the implied
+               warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+               PURPOSE.  See the GNU General Public License for more details.
+
+               You should have received a copy of the GNU General Public
+               License along with this Program.  If not, see
+               <http://www.gnu.org/licenses/>.
+
+               Additional permission under GNU GPL version 3 section 7
+
+               If you modify this Program, or any covered work, by linking
+               or combining it with libftd2xx (or a modified version of that
+               library), containing parts covered by the license terms of
+               Future Technology Devices International Limited, the licensors
+               of this Program grant you additional permission to convey the
+               resulting work.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "p9813.h"
+
+static unsigned long long usecNow(void)
+{
+	struct timeval t;
+
+	gettimeofday(&t,NULL);
+	return (unsigned long long)t.tv_sec * 1000000 + t.tv_usec;
+}
+
+int main(int argc,char *argv[])
+{
+	int                i,j,line = 0,nUnused = 0,nDisconnected = 0,nShown;
+	float              lo[3],hi[3];
+	const float       *c;
+	unsigned long long t;
+	TClayout          *layout;
+	TCstatusCode       status;
+
+	if(argc != 3)
+	{
+		(void)printf("usage: %s descriptionfile layoutfile\n",argv[0]);
+		return 1;
+	}
+
+	if((status = TClayoutCompile(argv[1],argv[2],&line)) != TC_OK)
+	{
+		if(status == TC_ERR_VALUE)
+			(void)printf("%s, line %d: bad command or value\n",
+			  argv[1],line);
+		else
+			TCprintError(status);
+		return 1;
+	}
+
+	t = usecNow();
+	if(!(layout = TClayoutOpen(argv[2])))
+	{
+		TCprintError(TC_ERR_FILE);
+		return 1;
+	}
+	t = usecNow() - t;
+
+	for(i=0;i<3;i++)
+	{
+		lo[i] =  1.0e30;
+		hi[i] = -1.0e30;
+	}
+	for(i=layout->nStrands*layout->pixelsPerStrand-1;i>=0;i--)
+	{
+		if(layout->remap[i] == TC_PIXEL_DISCONNECTED)
+		{
+			nDisconnected++;
+			continue;
+		}
+		if(layout->remap[i] == TC_PIXEL_UNUSED) nUnused++;
+		for(c=&layout->coords[i * 3],j=0;j<3;j++)
+		{
+			if(c[j] < lo[j]) lo[j] = c[j];
+			if(c[j] > hi[j]) hi[j] = c[j];
+		}
+	}
+	for(nShown=i=0;i<layout->imageSize;i++)
+		if(layout->led[i] >= 0) nShown++;
+
+	(void)printf("%s: %d strand(s) x %d pixels\n",argv[2],layout->nStrands,
+	  layout->pixelsPerStrand);
+	(void)printf("  TCopen(%d,%d);\n",layout->nStrands,
+	  layout->pixelsPerStrand);
+	(void)printf("  Image: %d x %d grid + %d free-standing = %d pixels "
+	  "(%d shown)\n",layout->width,layout->height,layout->imageSize -
+	  layout->width * layout->height,layout->imageSize,nShown);
+	(void)printf("  Strand positions: %d unused, %d disconnected\n",
+	  nUnused,nDisconnected);
+	(void)printf("  Extent: x %g to %g, y %g to %g, z %g to %g\n",
+	  lo[0],hi[0],lo[1],hi[1],lo[2],hi[2]);
+	(void)printf("  Opened in %llu uS\n",t);
+
+	TClayoutClose(layout);
+	return 0;
+}
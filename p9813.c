@@ -50,13 +50,28 @@
                resulting work.
  ****************************************************************************/
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+  #define _GNU_SOURCE  /* For CPU affinity; see TCsetRealtime() */
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
 #ifdef CYGWIN
-  #include <sys/time.h>
   #define va_list void
   #include <w32api/windef.h>
   #include <w32api/winbase.h>
@@ -80,10 +95,62 @@
    the two types each place a different signal line in the last position.
    If using a full FTDI breakout, those bits can be separated with calls
    to TCsetStrandPin() in order to control the full allotment of strands
-   independently. */
+   independently.
 
-static unsigned char
-	strandBitMask[8] = {
+   Settings that the rendering loop consults on every frame -- the strand
+   pins, gamma tables and the palette encoded through them, the layer
+   stack, current limits and per-pixel correction -- are held together
+   in an immutable parameter block.  Setters build a modified
+   copy of the current block and publish it with an atomic pointer swap;
+   each frame is rendered entirely from whichever block was current when
+   it began.  A UI thread may thus change gamma or pins while another
+   thread is refreshing, with no torn frames and no locks on the output
+   path.  Replaced blocks are freed once no frame in progress could still
+   be using them (see paramsReclaim()). */
+
+/* Layers for the optional compositing stage; see TCsetLayer().  Layer 0
+   is the bottom of the stack.  nLayers is one past the highest layer
+   currently assigned, so unused upper layers cost nothing. */
+typedef struct {
+	struct {
+		TCpixel       *pixels;
+		unsigned short alpha;    /* Opacity, scaled 0-256 */
+		TCblendMode    mode;
+	} layer[TC_MAX_LAYERS];
+	int            nLayers;
+	unsigned short fader;        /* Master fader, scaled 0-256 */
+} layerStack;
+
+/* Per-pixel color correction (see TCsetCorrection()): red, green and blue
+   scale factors for each physical pixel, in 8.8 fixed-point (256 = 1.0),
+   indexed like the remap table.  Like the parameter blocks, a table is
+   never changed once published; successive blocks share one until it's
+   replaced, so each table counts the blocks referring to it and is freed
+   with the last of them.  NULL (the default) when no correction has been
+   set, so uncorrected displays pay nothing for it. */
+typedef struct {
+	int        refs;         /* Published blocks referring to it */
+	uint16_t (*k)[3];        /* Factors, allocated after header  */
+} correctionTable;
+
+typedef struct paramBlock {
+	unsigned char      strandBitMask[8],    /* Strand/clock pins        */
+	                   gamma[256][3];       /* Gamma correction tables  */
+	int                gammaSet;            /* Set once any gamma
+	                                           function is called       */
+	TCpixel            paletteColor[256];   /* See TCsetPalette()       */
+	unsigned long      paletteWord[256];
+	double             paletteCurrent[256];
+	layerStack         layers;              /* See TCsetLayer()         */
+	double             strandLimit[8],      /* See TCsetCurrentLimit(), */
+	                   globalLimit;         /* milliamps, 0.0 = none    */
+	correctionTable   *correction;          /* See TCsetCorrection()    */
+	unsigned long      version;             /* Incremented every change */
+	struct paramBlock *next;                /* Retired list linkage     */
+} paramBlock;
+
+static paramBlock
+	defaultParams = { {
 	  TC_FTDI_TX,                 /* Strand 0 data */
 	  TC_FTDI_RX,                 /* Strand 1 data */
 	  TC_FTDI_DTR | TC_FTDI_RTS,  /* Strand 2 data */
@@ -92,19 +159,401 @@ static unsigned char
 	  0,
 	  0,
 	  TC_FTDI_CTS,                /* Serial clock  */
-	};
+	}, .layers = { .fader = 256 } },
+	*volatile params = &defaultParams, /* Current block             */
+	*retired        = NULL;   /* Replaced blocks awaiting release */
+static volatile int
+	paramReaders    = 0;      /* Frames being rendered            */
+static pthread_mutex_t
+	paramLock       = PTHREAD_MUTEX_INITIALIZER; /* Among setters */
 
 static unsigned char
 	bytesPerPixel   = 64,   /* Software bitbang clock by default */
 	*pixelOutBuffer = NULL,
-	rgbGamma[256][3];
+	*latchData      = NULL; /* Latch, at end of pixelOutBuffer   */
+static int
+	latchSize       = 0;
+static unsigned long
+	latchVersion    = 0;    /* Parameters latch was rendered with */
 static double
 	*pixelCurrent   = NULL;
+static uint32_t
+	*recordWords    = NULL; /* Output words of frame being encoded,
+	                           while flight recording */
 static FT_HANDLE
 	ftdiHandle      = NULL;
 static unsigned int
 	nStrands        = 0,
 	pixelsPerStrand = 0;
+static unsigned char
+	openStrands     = 0;    /* Strand parameter given to TCopen() */
+
+static int
+	mpsse           = 0,    /* Set if using MPSSE (SPI) output       */
+	rtPriority      = 0,    /* Output thread SCHED_FIFO priority     */
+	rtCpu           = -1;   /* Output thread CPU, -1 = any           */
+static unsigned long
+	mpsseClock      = 6000000;  /* SPI clock rate in MPSSE mode, Hz  */
+
+/* Output sink; if set, replaces the FTDI device.  See TCsetSink(). */
+static TCsinkFunc
+	sinkFunc        = NULL;
+static void
+	*sinkArg        = NULL;
+
+/* Device recovery (see TCsetRecovery()).  While the device is lost, the
+   recovery thread owns ftdiHandle; the thread issuing frames owns
+   everything else, including the counts, so they need no lock. */
+#define DEVICE_OK    0  /* Writing normally                    */
+#define DEVICE_LOST  1  /* Recovery thread is reopening it     */
+#define DEVICE_FOUND 2  /* Reopened; next write issues a latch */
+
+static int
+	recoverOn       = 0,
+	recoverJoin     = 0;    /* Set if recoverThread awaits joining */
+static volatile int
+	deviceState     = DEVICE_OK,
+	recoverStop     = 0;
+static pthread_t
+	recoverThread;
+static char
+	deviceSerial[16];       /* Empty if device has none */
+static unsigned long
+	outages         = 0,
+	recoveries      = 0,
+	framesDropped   = 0;
+static unsigned long long
+	outageStart     = 0,
+	usecOutageLast  = 0,
+	usecOutageTotal = 0;
+
+/* MPSSE output buffer, for the command stream wrapped around pixel data.
+   Grown as needed; the blank frame issued by TCopen() sizes it for one
+   frame, so only larger batches ever reallocate. */
+static unsigned char
+	*mpsseBuffer    = NULL;
+static size_t
+	mpsseSize       = 0;
+
+/* Current time in microseconds. */
+static unsigned long long usecNow(void)
+{
+	struct timeval t;
+
+	gettimeofday(&t,NULL);
+	return (unsigned long long)t.tv_sec * 1000000 + t.tv_usec;
+}
+
+/* Tracing.  Phase boundaries in opening and output are marked with
+   TRACE_BEGIN()/TRACE_END() (spans) and TRACE_MARK() (instants).  Built
+   with -DTC_USDT on a system with <sys/sdt.h>, each is also a static
+   probe (provider p9813, e.g. "write__begin") for DTrace, bpftrace,
+   perf or SystemTap; these are single no-op instructions until a tool
+   attaches.  Independently, TCtraceStart() records them in memory for
+   TCtraceStop() to write out as a Chrome trace; when not tracing, each
+   costs one pointer test.  Recording takes no lock: each event claims a
+   slot with an atomic increment, and writers in progress are counted so
+   the buffer is never freed under them. */
+#ifdef TC_USDT
+  #include <sys/sdt.h>
+  #define TC_PROBE(NAME,ARG) DTRACE_PROBE1(p9813,NAME,ARG)
+#else
+  #define TC_PROBE(NAME,ARG)
+#endif
+
+typedef struct {
+	unsigned long long usec;
+	const char        *name;
+	long               arg;
+	unsigned long      thread;
+	char               phase;  /* 'B'egin, 'E'nd or 'i'nstant */
+} traceEvent;
+
+static traceEvent
+	*volatile traceBuf = NULL;
+static volatile unsigned long
+	traceCount      = 0;    /* Events recorded; next slot mod size */
+static unsigned long
+	traceSize       = 0;
+static volatile int
+	traceWriters    = 0;
+
+static void traceRecord(
+  char        phase,
+  const char *name,
+  long        arg)
+{
+	traceEvent *buf,*e;
+
+	__sync_add_and_fetch(&traceWriters,1);
+	if((buf = __sync_val_compare_and_swap(&traceBuf,NULL,NULL)))
+	{
+		e         = &buf[__sync_fetch_and_add(&traceCount,1) %
+		              traceSize];
+		e->usec   = usecNow();
+		e->name   = name;
+		e->arg    = arg;
+		e->thread = (unsigned long)pthread_self();
+		e->phase  = phase;
+	}
+	__sync_sub_and_fetch(&traceWriters,1);
+}
+
+#define TRACE_BEGIN(NAME,ARG) do { TC_PROBE(NAME##__begin,ARG); \
+	if(traceBuf) traceRecord('B',#NAME,(long)(ARG)); } while(0)
+#define TRACE_END(NAME,ARG)   do { TC_PROBE(NAME##__end,ARG); \
+	if(traceBuf) traceRecord('E',#NAME,(long)(ARG)); } while(0)
+#define TRACE_MARK(NAME,ARG)  do { TC_PROBE(NAME,ARG); \
+	if(traceBuf) traceRecord('i',#NAME,(long)(ARG)); } while(0)
+
+static void encodePalette(paramBlock *);
+static TCstatusCode openStart(unsigned char,int);
+static void recordFrame(void);
+
+/* Snapshot of the current parameters, for rendering one frame; never
+   blocks.  The block must be treated as read-only, and given up with
+   paramsRelease() when the frame is done.  The reader is counted BEFORE
+   the pointer is fetched, so a setter that swaps in a new block and then
+   sees no readers knows that nobody can be holding the old one.  (The
+   __sync builtins are full memory barriers; the pointer is fetched with
+   one too, so the block's contents are seen as they were published.) */
+static paramBlock *paramsAcquire(void)
+{
+	(void)__sync_add_and_fetch(&paramReaders,1);
+	return __sync_val_compare_and_swap(&params,NULL,NULL);
+}
+
+/* Frees replaced parameter blocks (and any correction table no longer
+   referred to) if no frame is being rendered.  Blocks still possibly in
+   use stay on the list for the next attempt.  Call with paramLock held:
+   no block can then be retired meanwhile, so a frame that starts after
+   the reader count is checked can only get the current block. */
+static void paramsReclaim(void)
+{
+	paramBlock *pb;
+
+	if(__sync_add_and_fetch(&paramReaders,0)) return;
+	while((pb = retired))
+	{
+		retired = pb->next;
+		if(pb->correction && !--pb->correction->refs)
+			free(pb->correction);
+		free(pb);
+	}
+}
+
+/* Ends a frame begun with paramsAcquire().  The last reader out frees
+   whatever was retired while frames were in progress, so blocks don't
+   pile up under an output thread that is rendering almost constantly.
+   If a setter holds the lock, this is left to it or the next frame; the
+   output path never waits on a setter. */
+static void paramsRelease(void)
+{
+	if(!__sync_sub_and_fetch(&paramReaders,1) &&
+	   !pthread_mutex_trylock(&paramLock))
+	{
+		paramsReclaim();
+		pthread_mutex_unlock(&paramLock);
+	}
+}
+
+/* Starts a parameter change: returns a private copy of the current block
+   for the caller to modify and then publish with paramsCommit().  Setters
+   are serialized among themselves, never with rendering.  Returns NULL
+   (with nothing left locked) on malloc() failure. */
+static paramBlock *paramsBegin(void)
+{
+	paramBlock *pb;
+
+	pthread_mutex_lock(&paramLock);
+	if(!(pb = (paramBlock *)malloc(sizeof(paramBlock))))
+	{
+		pthread_mutex_unlock(&paramLock);
+		return NULL;
+	}
+	memcpy(pb,(paramBlock *)params,sizeof(paramBlock));
+
+	return pb;
+}
+
+/* Publishes a block from paramsBegin(), which applies from the next frame
+   rendered, and retires the block it replaces. */
+static void paramsCommit(paramBlock *pb)
+{
+	paramBlock *old;
+
+	/* Only setters change the pointer, and they hold paramLock, so
+	   the swap always succeeds. */
+	pb->version++;
+	pb->next = NULL;
+	if(pb->correction) pb->correction->refs++;
+	old      = params;
+	if(rtPriority) (void)mlock(pb,sizeof(paramBlock));
+	(void)__sync_val_compare_and_swap(&params,old,pb);
+	if(old != &defaultParams)
+	{
+		old->next = retired;
+		retired   = old;
+	}
+	paramsReclaim();
+	pthread_mutex_unlock(&paramLock);
+}
+
+/* Renders the latch (see TCopen()) for the given parameters: idle data
+   bits, plus clock ticks if the clock is bitbanged. */
+static void renderLatch(const paramBlock *pb)
+{
+	int i;
+
+	bzero(latchData,latchSize);
+	if(64 == bytesPerPixel)
+	{
+		for(i=1;i<latchSize;i+=2)
+			latchData[i] = pb->strandBitMask[7];
+	}
+	latchVersion = pb->version;
+}
+
+/* Issues bytes to the FTDI device (or the output sink, if one is set)
+   exactly as given. */
+static TCstatusCode rawWrite(
+  unsigned char *buf,
+  int            len)
+{
+	DWORD out;
+
+	if(sinkFunc) return (*sinkFunc)(buf,len,sinkArg);
+
+	return ((FT_OK == FT_Write(ftdiHandle,buf,len,&out)) &&
+	        (len == out)) ? TC_OK : TC_ERR_WRITE;
+}
+
+/* MPSSE command to clock bytes out MSB first, changing data on the
+   falling edge (P9813 samples on the rising edge), without reading.
+   Followed by a 16-bit little-endian length (minus one) and the data,
+   up to 64K bytes per command. */
+#define MPSSE_WRITE_BYTES 0x11
+#define MPSSE_MAX_BYTES   65536
+
+/* Size of MPSSE command stream for len bytes of data. */
+#define MPSSE_LEN(len) \
+	((len) + 3 * (((len) + MPSSE_MAX_BYTES - 1) / MPSSE_MAX_BYTES))
+
+/* Issues pixel data (one or more frames, with latches) to the device.
+   In bitbang modes this is the data as-is; in MPSSE mode the data is
+   wrapped in SPI write commands. */
+static TCstatusCode wireWrite(
+  unsigned char *buf,
+  int            len)
+{
+	unsigned char *p;
+	int            n;
+	size_t         need;
+
+	if(!mpsse) return rawWrite(buf,len);
+
+	if((need = MPSSE_LEN(len)) > mpsseSize)
+	{
+		if(!(p = (unsigned char *)realloc(mpsseBuffer,need)))
+			return TC_ERR_MALLOC;
+		mpsseBuffer = p;
+		mpsseSize   = need;
+	}
+	for(p=mpsseBuffer;len>0;len-=n,buf+=n,p+=n)
+	{
+		n    = (len > MPSSE_MAX_BYTES) ? MPSSE_MAX_BYTES : len;
+		p[0] = MPSSE_WRITE_BYTES;
+		p[1] = (n - 1) & 0xff;
+		p[2] = (n - 1) >> 8;
+		memcpy(p += 3,buf,n);
+	}
+
+	return rawWrite(mpsseBuffer,p - mpsseBuffer);
+}
+
+/* MPSSE clock divisor command for the current mpsseClock.  With the
+   divide-by-5 prescaler off, the H-series chips clock at 60 MHz /
+   ((1 + divisor) * 2), so 30 MHz maximum. */
+static void mpsseDivisor(unsigned char *cmd)
+{
+	unsigned long d = (mpsseClock > 0) ?
+	  (30000000 + mpsseClock - 1) / mpsseClock : 1;
+
+	if(d < 1)      d = 1;
+	if(d > 65536)  d = 65536;
+	cmd[0] = 0x86;
+	cmd[1] = (d - 1) & 0xff;
+	cmd[2] = (d - 1) >> 8;
+}
+
+/* Configures the MPSSE engine for SPI output once the device is in MPSSE
+   mode.  This is a command stream rather than driver calls, so it also
+   appears in the output of a sink. */
+static TCstatusCode mpsseSetup(void)
+{
+	unsigned char cmd[] = {
+	  0x8a,             /* Disable clock divide-by-5 (60 MHz base) */
+	  0x97,             /* Disable adaptive clocking                */
+	  0x8d,             /* Disable three-phase clocking             */
+	  0x80,0x00,0x03,   /* ADBUS: SK and DO outputs, both low       */
+	  0x85,             /* Disable loopback                         */
+	  0x86,0x00,0x00 }; /* Clock divisor (filled in below)          */
+
+	mpsseDivisor(&cmd[sizeof(cmd) - 3]);
+
+	return rawWrite(cmd,sizeof(cmd));
+}
+
+/* Puts the newly-opened device (ftdiHandle) in the output mode for the
+   current configuration.  Used by TCopen() and again by device recovery,
+   so a reopened device is set up exactly as the original was.  Returns
+   TC_ERR_DIVISOR or TC_ERR_BAUDRATE as warnings; other errors are fatal
+   and leave the device to be closed by the caller. */
+static TCstatusCode deviceSetup(void)
+{
+	TCstatusCode status = TC_ERR_MODE;
+
+	/* MPSSE mode: reset the engine (bit mode 0) before
+	   selecting MPSSE (mode 2), per FTDI AN_135; the chip
+	   needs a moment before it accepts commands. */
+	if(mpsse)
+	{
+		(void)FT_ResetDevice(ftdiHandle);
+		(void)FT_SetUSBParameters(ftdiHandle,65536,65536);
+		(void)FT_SetLatencyTimer(ftdiHandle,1);
+		if((FT_OK == FT_SetBitMode(ftdiHandle,0,0)) &&
+		   (FT_OK == FT_SetBitMode(ftdiHandle,0,2)))
+		{
+			usleep(50000);
+			(void)FT_Purge(ftdiHandle,FT_PURGE_RX | FT_PURGE_TX);
+			status = mpsseSetup();
+		}
+	}
+	/* Currently hogs all pins as outputs,
+	   whether they're used by strands or not. */
+	else if(FT_OK == FT_SetBitMode(ftdiHandle,255,1))
+	{
+		TRACE_MARK(device_mode,1);
+		status = TC_OK; /* Tentative success */
+
+		/* Try to set baud rate & divisor to non-default
+		   values.  3090000 seems to be the absolute max
+		   baud rate; even +1 more, and it fails.  Failure
+		   of either of these steps returns a warning but
+		   does not abort; program can continue with
+		   default baud rate setting.  FTDI docs suggest
+		   max of 3000000; this may be pushing it. */
+		if(FT_OK != FT_SetDivisor(ftdiHandle,1))
+			status = TC_ERR_DIVISOR;
+		if(FT_OK != FT_SetBaudRate(ftdiHandle,3090000))
+			status = TC_ERR_BAUDRATE;
+
+		/* Clear any lingering data in queue. */
+		(void)FT_Purge(ftdiHandle,FT_PURGE_RX | FT_PURGE_TX);
+	}
+
+	return status;
+}
 
 /* This internal function handles the actual FTDI init and memory alloc
    for the library, with graceful cleanup in all error cases.  Keeps
@@ -118,11 +567,22 @@ static TCstatusCode openAlloc(
 	/* Function works from a presumed error condition progressing
 	   toward success.  This makes the cleanup cases easier. */
 	TCstatusCode status = TC_ERR_MALLOC;
+	FT_DEVICE    type;
+	DWORD        id;
+	char         description[64];
 
 	/* Size of pixelOutBuffer depends whether the serial clock is
 	   provided by one of the CBUS pins or must be bit-banged via
-	   software.  If using 8 strands, MUST use CBUS clock. */
-	if(s >= TC_CBUS_CLOCK)
+	   software.  If using 8 strands, MUST use CBUS clock.  MPSSE
+	   mode is a single strand with a hardware clock, and pixels are
+	   plain 32-bit words rather than turned sideways. */
+	mpsse = 0;
+	if(s & TC_MPSSE)
+	{
+		bytesPerPixel = 4;
+		mpsse         = 1;
+		s             = 1;
+	} else if(s >= TC_CBUS_CLOCK)
 	{
 		bytesPerPixel = 32;
 		if(s > TC_CBUS_CLOCK) s -= TC_CBUS_CLOCK;
@@ -143,37 +603,29 @@ static TCstatusCode openAlloc(
 		/* Alloc successful.  Next phase... */
 		status = TC_ERR_OPEN;
 
+		if(sinkFunc)
+		{
+			/* Output goes to the sink instead of a device;
+			   nothing to set up, save for MPSSE commands. */
+			if(!mpsse || (TC_OK == (status = mpsseSetup())))
+				return TC_OK;
+		}
 		/* Currently rigged for a single FTDI device,
 		   and always index 0.  Might address this in
-		   a future update if it's an issue. */
-		if(FT_OK == FT_Open(0,&ftdiHandle))
+		   a future update if it's an issue.  The serial
+		   number is noted so recovery can find the same
+		   device again. */
+		else if(FT_OK == FT_Open(0,&ftdiHandle))
 		{
-			status = TC_ERR_MODE;
-			/* Currently hogs all pins as outputs,
-			   whether they're used by strands or not. */
-			if(FT_OK == FT_SetBitMode(ftdiHandle,255,1))
-			{
-				status = TC_OK; /* Tentative success */
-
-				/* Try to set baud rate & divisor to non-
-				   default values.  3090000 seems to be the
-				   absolute max baud rate; even +1 more, and
-				   it fails.  Failure of either of these
-				   steps returns a warning but does not
-				   abort; program can continue with default
-				   baud rate setting.  FTDI docs suggest max
-				   of 3000000; this may be pushing it. */
-				if(FT_OK != FT_SetDivisor(ftdiHandle,1))
-					status = TC_ERR_DIVISOR;
-				if(FT_OK != FT_SetBaudRate(ftdiHandle,3090000))
-					status = TC_ERR_BAUDRATE;
-
-				/* Clear any lingering data in queue. */
-				(void)FT_Purge(ftdiHandle,
-				  FT_PURGE_RX | FT_PURGE_TX);
-
-				return status; /* Success */
-			}
+			TRACE_MARK(device_open,0);
+			bzero(deviceSerial,sizeof(deviceSerial));
+			if(FT_OK != FT_GetDeviceInfo(ftdiHandle,&type,&id,
+			  deviceSerial,description,NULL)) deviceSerial[0] = 0;
+
+			status = deviceSetup();
+			if((TC_OK == status) || (TC_ERR_DIVISOR == status) ||
+			   (TC_ERR_BAUDRATE == status)) return status;
+
 			/* Else fatal error of some sort.
 			   Clean up any interim results. */
 			FT_Close(ftdiHandle);
@@ -200,6 +652,9 @@ static TCstatusCode openAlloc(
                               further explanation.  It's okay to use fewer
                               than 8 strands with the CBUS clock, if the
                               value passed here is OR'd with TC_CBUS_CLOCK.
+                              Alternately, TC_MPSSE (optionally OR'd with 1)
+                              selects single-strand hardware SPI output on
+                              FT232H-type adapters; see TCsetMpsseClock().
                int            Number of LED pixels per strand.  If strands
                               of different lengths are used, pass the
                               length of the longest strand.
@@ -209,35 +664,48 @@ TCstatusCode TCopen(
   unsigned char s,
   int           p)
 {
-	DWORD        out;  /* Return status from FT_Write */
-	int          i,latchOffset,latchLen;
 	TCstatusCode status;
 
-	if((s < 1) || (s > 16) || (p < 1)) return TC_ERR_VALUE;
+	if((p < 1) ||
+	   ((s & TC_MPSSE) ? ((s & ~TC_MPSSE) > 1) : ((s < 1) || (s > 16))))
+		return TC_ERR_VALUE;
+
+	TRACE_BEGIN(open,p);
+	if(TC_OK != (status = openStart(s,p))) TRACE_MARK(error,status);
+	TRACE_END(open,status);
+
+	return status;
+}
+
+/* Body of TCopen(), following parameter validation: opens the device and
+   issues the initial latch and blank frame. */
+static TCstatusCode openStart(
+  unsigned char s,
+  int           p)
+{
+	TCstatusCode status;
 
 	if(TC_OK != (status = openAlloc(s,p))) return status;
 
-	nStrands        = (s > TC_CBUS_CLOCK) ? (s - TC_CBUS_CLOCK) : s;
+	if(mpsse) nStrands = 1;
+	else      nStrands = (s > TC_CBUS_CLOCK) ? (s - TC_CBUS_CLOCK) : s;
 	pixelsPerStrand = p;
+	openStrands     = s;
 
 	/* Issue latch sequence (sans LED data) before any other LED data
 	   is written.  The latch is then subsequently written following
 	   each frame of animation.  This is somewhat contrary to what the
 	   datasheet says, but in practice syncs more reliably.  Latch only
 	   needs to be "rendered" once at the end of pixelOutBuffer and
-	   never changes after that, unless the clock pin is changed. */
-	latchOffset = bytesPerPixel * p;
-	latchLen    = bytesPerPixel * ((p + 63) / 64);
-	bzero(&pixelOutBuffer[latchOffset],latchLen);
-	if(64 == bytesPerPixel)
-	{
-		/* If software-bitbanging the clock, add those bits. */
-		for(i=1;i<latchLen;i+=2)
-			pixelOutBuffer[latchOffset + i] = strandBitMask[7];
-	}
-	if((FT_OK != FT_Write(ftdiHandle,&pixelOutBuffer[latchOffset],
-	  latchLen,&out)) || (latchLen != out))
-		return TC_ERR_WRITE;
+	   never changes after that, unless the clock pin is changed (in
+	   which case renderFrame() redoes it). */
+	latchData = &pixelOutBuffer[bytesPerPixel * p];
+	latchSize = bytesPerPixel * ((p + 63) / 64);
+	renderLatch(paramsAcquire());
+	paramsRelease();
+	if(TC_OK != (status = wireWrite(latchData,latchSize)))
+		return status;
+	TRACE_MARK(latch,0);
 
 	/* Issue initial blank image to LEDs ASAP. */
 	if(TC_OK != (status = TCrefresh(NULL,NULL,NULL))) return status;
@@ -272,19 +740,25 @@ TCstatusCode TCopen(
                        proportional to RGB values, but perceptually seen as
                        "too bright" in the middle.  2.4 = library default
                        and a reasonable starting point.
- Returns     : TC_OK on success, TC_ERR_VALUE if invalid parameter received.
+ Returns     : TC_OK on success, TC_ERR_VALUE if invalid parameter received,
+               TC_ERR_MALLOC on malloc() failure.
  ****************************************************************************/
 TCstatusCode TCsetGammaSimple(double g)
 {
 	unsigned short i;
+	paramBlock    *pb;
 
 	if(g <= 0.0) return TC_ERR_VALUE;
+	if(!(pb = paramsBegin())) return TC_ERR_MALLOC;
 
 	for(i=0;i<256;i++)
 	{
-		rgbGamma[i][0] = rgbGamma[i][1] = rgbGamma[i][2] =
+		pb->gamma[i][0] = pb->gamma[i][1] = pb->gamma[i][2] =
 		  (unsigned char)(255.0 * pow((double)i / 255.0,g) + 0.5);
 	}
+	encodePalette(pb);
+	pb->gammaSet = 1;
+	paramsCommit(pb);
 
 	return TC_OK;
 }
@@ -305,7 +779,8 @@ TCstatusCode TCsetGammaSimple(double g)
                               component.  Behavior is the same as the
                               parameter passed to TCsetGammaSimple().
                (Parameters repeat for green and blue, 9 values total.)
- Returns     : TC_OK on success, TC_ERR_VALUE if invalid parameter received.
+ Returns     : TC_OK on success, TC_ERR_VALUE if invalid parameter received,
+               TC_ERR_MALLOC on malloc() failure.
  ****************************************************************************/
 TCstatusCode TCsetGamma(
   unsigned char rMin,
@@ -320,9 +795,11 @@ TCstatusCode TCsetGamma(
 {
 	unsigned short i;
 	double         rRange,gRange,bRange,d;
+	paramBlock    *pb;
 
 	if((rGamma <= 0.0) || (gGamma <= 0.0) || (bGamma <= 0.0))
 		return TC_ERR_VALUE;
+	if(!(pb = paramsBegin())) return TC_ERR_MALLOC;
 
 	rRange = (double)(rMax - rMin);
 	gRange = (double)(gMax - gMin);
@@ -331,13 +808,16 @@ TCstatusCode TCsetGamma(
 	for(i=0;i<256;i++)
 	{
 		d = (double)i / 255.0;
-		rgbGamma[i][0] = rMin +
+		pb->gamma[i][0] = rMin +
 		  (unsigned char)floor(rRange * pow(d,rGamma) + 0.5);
-		rgbGamma[i][1] = gMin +
+		pb->gamma[i][1] = gMin +
 		  (unsigned char)floor(gRange * pow(d,gGamma) + 0.5);
-		rgbGamma[i][2] = bMin +
+		pb->gamma[i][2] = bMin +
 		  (unsigned char)floor(bRange * pow(d,bGamma) + 0.5);
 	}
+	encodePalette(pb);
+	pb->gammaSet = 1;
+	paramsCommit(pb);
 
 	return TC_OK;
 }
@@ -347,16 +827,23 @@ TCstatusCode TCsetGamma(
  Description : Disables gamma correction for subsequent TCrefresh() calls.
                Some programs may wish to provide their own color-correction
                models, or may have need for uncorrected "raw" color values
-               (such as when calibrating current consumption).
+               (such as when calibrating current consumption).  In the
+               unlikely event of malloc() failure, gamma is unchanged.
  Parameters  : None (void).
  Returns     : Nothing (void).
  ****************************************************************************/
 void TCdisableGamma(void)
 {
 	unsigned short i;
+	paramBlock    *pb;
+
+	if(!(pb = paramsBegin())) return;
 
 	for(i=0;i<256;i++)
-		rgbGamma[i][0] = rgbGamma[i][1] = rgbGamma[i][2] = i;
+		pb->gamma[i][0] = pb->gamma[i][1] = pb->gamma[i][2] = i;
+	encodePalette(pb);
+	pb->gammaSet = 1;
+	paramsCommit(pb);
 }
 
 /****************************************************************************
@@ -386,233 +873,3136 @@ TCstatusCode TCinitStats(TCstats *stats)
 	return TC_OK;
 }
 
-#define EST_CURRENT(R,G,B)                                                \
-	/* Base current...                 */                             \
-	((double)CAL_CURRENT_OFF / (double)CAL_N_PIXELS) +                \
-	/* Plus RGB current...             */                             \
-	((((double)R*(double)CAL_CURRENT_R/(double)CAL_N_PIXELS) +        \
-	  ((double)G*(double)CAL_CURRENT_G/(double)CAL_N_PIXELS) +        \
-	  ((double)B*(double)CAL_CURRENT_B/(double)CAL_N_PIXELS))/255.0 * \
-	/* ...times combinational factors. */                             \
-	(1.0-((double)R*(double)G/(255.0*255.0)*(1.0-CAL_COMBO_RG))) *    \
-	(1.0-((double)G*(double)B/(255.0*255.0)*(1.0-CAL_COMBO_GB))) *    \
-	(1.0-((double)R*(double)B/(255.0*255.0)*(1.0-CAL_COMBO_RB))))
+/* Frame sources.  TCrefresh() and its variants each describe where their
+   pixel data comes from, and the common rendering loop pulls from that
+   source as it encodes, so no intermediate copy of the image is made. */
+typedef enum {
+	SOURCE_BLANK = 0,  /* All pixels off             */
+	SOURCE_PIXELS,     /* Single TCpixel array       */
+	SOURCE_LAYERS,     /* Composite of layer buffers */
+	SOURCE_BLEND,      /* Mix of two arrays          */
+	SOURCE_BLEND_GAMMA,/* Mix after gamma correction */
+	SOURCE_INDEXED,    /* 8-bit indices into palette */
+	SOURCE_FORMAT,     /* Other pixel formats        */
+	SOURCE_DIRTY       /* TCpixel array, with spans changed since
+	                      the last frame (TCrefreshDirty()) */
+} sourceType;
+
+typedef struct {
+	sourceType     type;
+	const TCpixel *pixels;
+	const TCpixel *pixels2;  /* Second array for blends    */
+	unsigned short alpha;    /* Blend weight of pixels2, 0-256 */
+	const unsigned char *index; /* Palette indices   */
+	const unsigned char *plane[3]; /* Foreign formats; interleaved
+	                                  formats use plane[0] only */
+	int            stride;   /* Bytes between pixels in plane(s) */
+	TCformat       format;
+	const TCspan  *spans;    /* SOURCE_DIRTY changes             */
+	int            nSpans;
+} frameSource;
+
+/* Blend two packed pixels: a + (b - a) * alpha / 256.  Red and blue are
+   processed together in one 32-bit operation and green in another, the
+   0x00ff00ff mask leaving enough headroom between the channels that they
+   can't carry into one another.  Two multiplies per pixel, not three. */
+static inline TCpixel lerpPixel(
+  TCpixel        a,
+  TCpixel        b,
+  unsigned short alpha) /* 0-256 */
+{
+	unsigned long inv = 256 - alpha;
+
+	return ((((a & 0xff00ff) * inv + (b & 0xff00ff) * alpha) >> 8) &
+	        0xff00ff) |
+	       ((((a & 0x00ff00) * inv + (b & 0x00ff00) * alpha) >> 8) &
+	        0x00ff00);
+}
+
+/* Channel product scaled back to 0-255, rounded (exact for x*y/255). */
+#define MUL255(x,y) \
+	((((x) * (y) + 128) + ((((x) * (y) + 128)) >> 8)) >> 8)
+
+/* Combine pixel 'i' of all active layers into a single TCpixel.  This is
+   called from within the rendering loop, so each layer buffer is read
+   exactly once per frame, in the same pass that encodes the output. */
+static TCpixel compositePixel(
+  const layerStack *ls,
+  int               i)
+{
+	TCpixel       acc = 0,c,blend;
+	unsigned long r,g,b;
+	int           n;
+
+	for(n=0;n<ls->nLayers;n++)
+	{
+		if(!ls->layer[n].pixels || !ls->layer[n].alpha) continue;
+		c = ls->layer[n].pixels[i];
+		switch(ls->layer[n].mode)
+		{
+		   case TC_BLEND_ADD:
+			r = ((acc >> 16) & 0xff) + ((c >> 16) & 0xff);
+			g = ((acc >>  8) & 0xff) + ((c >>  8) & 0xff);
+			b = ( acc        & 0xff) + ( c        & 0xff);
+			blend = ((r > 255) ? 0xff0000 : (r << 16)) |
+			        ((g > 255) ? 0x00ff00 : (g <<  8)) |
+			        ((b > 255) ? 0x0000ff :  b       );
+			break;
+		   case TC_BLEND_MULTIPLY:
+			r = MUL255((acc >> 16) & 0xff,(c >> 16) & 0xff);
+			g = MUL255((acc >>  8) & 0xff,(c >>  8) & 0xff);
+			b = MUL255( acc        & 0xff, c        & 0xff);
+			blend = (r << 16) | (g << 8) | b;
+			break;
+		   case TC_BLEND_MAX:
+			blend = (((acc & 0xff0000) > (c & 0xff0000)) ?
+			          (acc & 0xff0000) : (c & 0xff0000)) |
+			        (((acc & 0x00ff00) > (c & 0x00ff00)) ?
+			          (acc & 0x00ff00) : (c & 0x00ff00)) |
+			        (((acc & 0x0000ff) > (c & 0x0000ff)) ?
+			          (acc & 0x0000ff) : (c & 0x0000ff));
+			break;
+		   case TC_BLEND_NORMAL:
+		   default:
+			blend = c;
+			break;
+		}
+		acc = (ls->layer[n].alpha == 256) ? (blend & 0xffffff) :
+		  lerpPixel(acc,blend,ls->layer[n].alpha);
+	}
+
+	return (ls->fader == 256) ? acc : lerpPixel(0,acc,ls->fader);
+}
+
+/* Fetch pixel 'i' of a foreign-format image as a TCpixel.  Called from
+   within the rendering loop, so conversion costs no separate pass and
+   no intermediate buffer.  Alpha channels, if present, are ignored. */
+static inline TCpixel formatPixel(
+  const frameSource *src,
+  int                i)
+{
+	const unsigned char *p;
+	unsigned long        v;
+
+	i *= src->stride;
+	if(TC_FORMAT_PLANAR == src->format)
+	{
+		return ((TCpixel)src->plane[0][i] << 16) |
+		       ((TCpixel)src->plane[1][i] <<  8) |
+		                 src->plane[2][i];
+	}
+
+	p = &src->plane[0][i];
+	switch(src->format)
+	{
+	   case TC_FORMAT_BGR24:
+	   case TC_FORMAT_BGRA32:
+		return ((TCpixel)p[2] << 16) | ((TCpixel)p[1] << 8) | p[0];
+	   case TC_FORMAT_RGB565:
+		/* Little-endian 5/6/5 bits, expanded to 8/8/8 by
+		   replicating high bits into the low bits, so full
+		   intensity maps to 255 rather than 248 or 252. */
+		v = p[0] | ((unsigned long)p[1] << 8);
+		return (((v & 0xf800) << 8) | ((v & 0xe000) << 3)) |
+		       (((v & 0x07e0) << 5) | ((v & 0x0600) >> 1)) |
+		       (((v & 0x001f) << 3) | ((v & 0x001c) >> 2));
+	   default: /* TC_FORMAT_RGB24, TC_FORMAT_RGBA32 */
+		return ((TCpixel)p[0] << 16) | ((TCpixel)p[1] << 8) | p[2];
+	}
+}
 
 /****************************************************************************
- Function    : TCrefresh()
- Description : Updates LED display; pushes data out "on the wire" via the
-               FTDI adapter.
- Parameters  : TCPixel *  Image data, as a one-dimensional array.  If NULL,
-                          entire image is set to "off" state.
-               int *      Optional remapping table, assigns each pixel in
-                          each strand to a position in the TCpixel array
-                          passed as the first marameter.  If NULL, each
-                          element of the TCpixel array is assumed to
-                          correspond sequentially to each pixel in each
-                          strand, and gaps in strands are not handled.
-               TCstats *  Optional pointer to structure for receiving
-                          performance statistics.  Pass NULL if this
-                          information is not needed.
- Returns     : TC_OK on success, TC_ERR_WRITE on I/O error.
+ Function    : TCsetLayer()
+ Description : Assigns a pixel buffer to one layer of the optional
+               compositing stage used by TCrefreshLayers().  Layers are
+               stacked from 0 (bottom) upward; each is blended onto the
+               result of the layers beneath it.  The library keeps a
+               pointer to the buffer (it is not copied), so the
+               application may keep drawing into it between refreshes.
+               As with gamma, this applies only to subsequent refreshes,
+               and may be called while another thread is refreshing.
+ Parameters  : int            Layer number, 0 to TC_MAX_LAYERS-1.
+               TCpixel *      Pixel data for layer, same size and layout
+                              as would be passed to TCrefresh().  NULL
+                              removes the layer from the stack.
+               unsigned char  Layer opacity, 0 (transparent) to 255
+                              (opaque).
+               TCblendMode    How layer combines with those beneath it:
+                              TC_BLEND_NORMAL, TC_BLEND_ADD,
+                              TC_BLEND_MULTIPLY or TC_BLEND_MAX.
+ Returns     : TC_OK on success, TC_ERR_VALUE if invalid parameter received,
+               TC_ERR_MALLOC on malloc() failure.
  ****************************************************************************/
-TCstatusCode TCrefresh(
-  TCpixel *pixelInBuffer,
-  int     *remap,
-  TCstats *stats)
+TCstatusCode TCsetLayer(
+  int           n,
+  TCpixel      *pixels,
+  unsigned char opacity,
+  TCblendMode   mode)
 {
-	DWORD          out;
-	int            i,s,p,len,absPixel,mappedPixel;
-	unsigned char  r,g,b,strand,*addr;
-	unsigned long  rgb,time1;
-	struct timeval t;
-	TCstatusCode   status;
+	paramBlock *pb;
+	layerStack *ls;
+	int         top;
 
-	/* PHASE 1: Convert data from pixelInBuffer to pixelOutBuffer ----- */
+	if((n < 0) || (n >= TC_MAX_LAYERS) ||
+	   (mode < TC_BLEND_NORMAL) || (mode > TC_BLEND_MAX))
+		return TC_ERR_VALUE;
+	if(!(pb = paramsBegin())) return TC_ERR_MALLOC;
 
-	/* Clear output buffer, leaving latch intact at end.  For software-
-	   bitbanged clock signal, clock ticks are added now rather than in
-	   subsequent loop because the strand/pixel remapping tables could
-	   leave gaps in the sequence -- it isn't guaranteed to have touched
-	   every pixel.  This is normal and not a bad thing. */
-	len = pixelsPerStrand * bytesPerPixel;
-	bzero(pixelOutBuffer,len);
-	if(bytesPerPixel == 64)
-		for(i=1;i<len;i+=2) pixelOutBuffer[i] = strandBitMask[7];
+	ls                  = &pb->layers;
+	ls->layer[n].pixels = pixels;
+	ls->layer[n].alpha  = opacity + (opacity >> 7); /* 0-255 to 0-256 */
+	ls->layer[n].mode   = mode;
 
-	/* The structure of the pixelOutBuffer[] array is described in the
-	   Hack-a-Day article referenced in the README.  Picture it like one
-	   long player piano roll, where each key on the piano corresponds
-	   to one GPIO bit.  Thus data (including the clock signal) must be
-	   "turned sideways" in this array, through a series of bitwise
-	   operations. */
-	for(absPixel=s=0;s<nStrands;s++)
-	{
-	  strand = strandBitMask[s];
-	  for(p=0;p<pixelsPerStrand;p++,absPixel++)
-	  {
-	    mappedPixel = remap ? remap[absPixel] : absPixel;
-
-	    /* Get RGB value and current use for this pixel */
-	    if((NULL == pixelInBuffer) || (mappedPixel < 0))
-	    {
-	      rgb                    = 0xff000000;
-	      pixelCurrent[absPixel] =
-	        (mappedPixel == TC_PIXEL_DISCONNECTED) ? 0.0 :
-	        ((double)CAL_CURRENT_OFF / (double)CAL_N_PIXELS);
-	    } else
-	    {
-	      /* Separate components, run through gamma tables. */
-	      r = rgbGamma[(pixelInBuffer[mappedPixel] >> 16) & 0xff][0];
-	      g = rgbGamma[(pixelInBuffer[mappedPixel] >>  8) & 0xff][1];
-	      b = rgbGamma[ pixelInBuffer[mappedPixel]        & 0xff][2];
-
-	      /* And reassemble into P9813 32-bit format. */
-	      rgb = (b << 16) | (g << 8) | r | /* 24-bit color +  */
-	        (~(((b & 0xc0) << 22) |        /* checksum as per */
-	           ((g & 0xc0) << 20) |        /* LED datasheet   */
-	           ((r & 0xc0) << 18)) & 0xff000000);
-
-	      pixelCurrent[absPixel] = EST_CURRENT(r,g,b);
-	    }
-
-	    /* Turn pixel "sideways" into output buffer. */
-	    addr = &pixelOutBuffer[p * bytesPerPixel]; /* Base addr */
-	    if(bytesPerPixel == 64)
-	    {
-	      for(;rgb;rgb<<=1)
-	      {
-	        if(rgb & 0x80000000)
-	        {
-	          addr[0] |= strand;
-	          addr[1] |= strand;
-	        }
-	        addr += 2;
-	      }
-	    } else
-	    {
-	      for(;rgb;rgb<<=1)
-	      {
-	        if(rgb & 0x80000000) *addr |= strand;
-	        addr++;
-	      }
-	    }
-	  }
-	}
+	/* Recalculate top of stack */
+	for(top=TC_MAX_LAYERS;(top > 0) && !ls->layer[top-1].pixels;top--);
+	ls->nLayers = top;
+	paramsCommit(pb);
 
-	/* PHASE 2: Issue serial data. ------------------------------------ */
+	return TC_OK;
+}
 
-	/* Total number of bytes to output; includes latch data at end. */
-	len = bytesPerPixel * (pixelsPerStrand + ((pixelsPerStrand+63)/64));
+/****************************************************************************
+ Function    : TCsetFader()
+ Description : Sets the master fader applied to the composited result of
+               all layers in subsequent TCrefreshLayers() calls.
+ Parameters  : unsigned char  Fader level, 0 (black) to 255 (full).
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCsetFader(unsigned char level)
+{
+	paramBlock *pb;
 
-	/* Get current time (in microseconds) both before and after
-	   write operation.  This is to isolate I/O-bound statistics
-	   from overall timing data (which includes frame rendering
-	   time, etc.). */
-	gettimeofday(&t,NULL);
-	time1 = (t.tv_sec * 1000000) + t.tv_usec;
+	if(!(pb = paramsBegin())) return;
+	pb->layers.fader = level + (level >> 7);
+	paramsCommit(pb);
+}
 
-	/* Function does not immediately return on write error.  Some
-	   of the subsequent statistics may still be valid for reference
-	   use, even if not issued to the chip (e.g. estimating the
-	   total current use of specific LED patterns). */
-	status = ((FT_OK == FT_Write(ftdiHandle,pixelOutBuffer,len,&out)) &&
-	          (len == out)) ? TC_OK : TC_ERR_WRITE;
+/* Current model coefficients, each folded to a single constant so that
+   EST_CURRENT() is multiply-add only (no division) and vectorizes well
+   in TCestimateCurrent(). */
+#define EST_K_OFF ((double)CAL_CURRENT_OFF / (double)CAL_N_PIXELS)
+#define EST_K_R   ((double)CAL_CURRENT_R / ((double)CAL_N_PIXELS * 255.0))
+#define EST_K_G   ((double)CAL_CURRENT_G / ((double)CAL_N_PIXELS * 255.0))
+#define EST_K_B   ((double)CAL_CURRENT_B / ((double)CAL_N_PIXELS * 255.0))
+#define EST_K_RG  ((1.0 - CAL_COMBO_RG) / (255.0 * 255.0))
+#define EST_K_GB  ((1.0 - CAL_COMBO_GB) / (255.0 * 255.0))
+#define EST_K_RB  ((1.0 - CAL_COMBO_RB) / (255.0 * 255.0))
 
-	/* PHASE 3: (Optionally) generate statistics ---------------------- */
+#define EST_CURRENT(R,G,B)                                                \
+	/* Base current...                 */                             \
+	(EST_K_OFF +                                                      \
+	/* Plus RGB current...             */                             \
+	((double)(R) * EST_K_R + (double)(G) * EST_K_G +                  \
+	 (double)(B) * EST_K_B) *                                         \
+	/* ...times combinational factors. */                             \
+	(1.0 - (double)(R) * (double)(G) * EST_K_RG) *                    \
+	(1.0 - (double)(G) * (double)(B) * EST_K_GB) *                    \
+	(1.0 - (double)(R) * (double)(B) * EST_K_RB))
 
-	if(stats)
-	{
-		double        sum;
-		int           i;
-		unsigned long time2;
+/* Gamma-corrected components to P9813 32-bit format: flag bits and
+   inverted high bits of each component (as per LED datasheet), then
+   24-bit color in blue, green, red order. */
+#define P9813_WORD(R,G,B)                                                 \
+	(((unsigned long)(B) << 16) | ((unsigned long)(G) << 8) | (R) |   \
+	 (~((((unsigned long)(B) & 0xc0) << 22) |                         \
+	    (((unsigned long)(G) & 0xc0) << 20) |                         \
+	    (((unsigned long)(R) & 0xc0) << 18)) & 0xff000000))
 
-		gettimeofday(&t,NULL);
-		time2 = (t.tv_sec * 1000000) + t.tv_usec;
+/****************************************************************************
+ Function    : TCestimateCurrent()
+ Description : Estimates the current draw of an image using the same gamma
+               tables and calibration model as TCrefresh(), but without
+               encoding or issuing anything; TCopen() isn't required.
+               This is the basis for offline power planning (see the
+               "simulate" program).  If TCopen() hasn't been called, set
+               gamma first, else the library default (2.4) is used.
+ Parameters  : const TCpixel *  Image data, one element per physically
+                                present pixel (no remapping is applied).
+               int              Number of pixels.
+               float *          Optional destination for the estimate of
+                                each individual pixel, in milliamps.
+ Returns     : Total estimated current for all pixels, in milliamps.
+ ****************************************************************************/
+double TCestimateCurrent(
+  const TCpixel *pixels,
+  int            n,
+  float         *maPixel)
+{
+	double      r[256],g[256],b[256],ma[256],sum[4] = { 0.0,0.0,0.0,0.0 };
+	int         i,j,chunk;
+	paramBlock *pb = paramsAcquire();
 
-		/* Parallel output bits are included in I/O calculations. */
-		stats->bits       = nStrands * len;
-		if(bytesPerPixel == 64) stats->bits /= 2;
-		stats->bitsTotal += stats->bits;
+	if(!pb->gammaSet)
+	{
+		paramsRelease();
+		(void)TCsetGammaSimple(DEFAULT_GAMMA);
+		pb = paramsAcquire();
+	}
 
-		/* Get I/O elapsed time and compute throughput for this
-		   single frame. */
-		if((stats->usecIo = (time2 - time1)) > 0)
-		{
-			stats->bps = (unsigned long)(
-			  ((double)stats->bits * 1000000.0) /
-			   (double)stats->usecIo);
-			stats->usecIoTotal += stats->usecIo;
-		} else
+	/* Gamma lookups (which don't vectorize) and the current model
+	   arithmetic (which does) are done in separate passes over small
+	   chunks that stay in cache between them.  The total is summed
+	   into four independent partial sums for the same reason. */
+	for(i=0;i<n;i+=chunk,pixels+=chunk)
+	{
+		chunk = (n - i > 256) ? 256 : (n - i);
+		for(j=0;j<chunk;j++)
 		{
-			stats->bps = 0;  /* Probably I/O error */
+			r[j] = (double)pb->gamma[(pixels[j] >> 16) & 0xff][0];
+			g[j] = (double)pb->gamma[(pixels[j] >>  8) & 0xff][1];
+			b[j] = (double)pb->gamma[ pixels[j]        & 0xff][2];
 		}
-
-		/* Compute average throughput from total bits output and
-		   cumulative I/O time.  Avoid divide-by-zero first: */
-		if(stats->usecIoTotal)
+		for(j=0;j<chunk;j++) ma[j] = EST_CURRENT(r[j],g[j],b[j]);
+		if(maPixel)
 		{
-			stats->bpsAvg = (unsigned long)(
-			  ((double)stats->bitsTotal * 1000000.0) /
-			   (double)stats->usecIoTotal);
-		} else
+			for(j=0;j<chunk;j++) maPixel[j] = (float)ma[j];
+			maPixel += chunk;
+		}
+		for(j=0;j<(chunk & ~3);j+=4)
 		{
-			stats->bpsAvg = stats->bps;
+			sum[0] += ma[j];
+			sum[1] += ma[j + 1];
+			sum[2] += ma[j + 2];
+			sum[3] += ma[j + 3];
 		}
+		for(;j<chunk;j++) sum[0] += ma[j];
+	}
+	paramsRelease();
 
-		/* Some figures cannot be calculated until multiple frames
-		   have been rendered and output. */
-		if(stats->frames)
-		{
-			/* The 'reserved' element of the stats structure
-			   is actually the saved value of 'time2' from the
-			   prior invocation of this function; used to
-			   determine the total processing time for frame. */
-			stats->usecFrame = time2 - stats->reserved;
-			if(stats->usecFrame)
-			{
-			  stats->fps = 1000000.0 / (double)stats->usecFrame;
-			  stats->usecFrameTotal += stats->usecFrame;
-			} else
-			{
-			  stats->fps = 0.0;  /* Probably I/O error */
-			}
+	return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+}
 
-			if(stats->usecFrameTotal)
-			{
-				stats->fpsAvg = (double)stats->frames *
-				  1000000.0 / (double)stats->usecFrameTotal;
-			}
+/****************************************************************************
+ Function    : TCwireBytes()
+ Description : Returns the number of bytes issued to the FTDI device for
+               each frame (including latch) for a given configuration, as
+               would be passed to TCopen().  TCopen() isn't required.
+ Parameters  : unsigned char  Number of strands, optionally plus
+                              TC_CBUS_CLOCK, or TC_MPSSE, as for TCopen().
+               int            Number of pixels in longest strand.
+ Returns     : Bytes per frame, or 0 if invalid parameter received.
+ ****************************************************************************/
+unsigned long TCwireBytes(
+  unsigned char s,
+  int           p)
+{
+	unsigned long bpp = (s >= TC_CBUS_CLOCK) ? 32 : 64;
 
-			/* Milliamp-hour calculations need to work from the
-			   PRIOR frame, so don't calculate the mA value of
-			   the new frame yet!  Use the old one... */
-			stats->mah = stats->ma * ((double)stats->usecFrame) /
-			  (1000000.0 * 60.0 * 60.0);
-			stats->mahTotal += stats->mah;
-
-			/* Average current is back-calculated from total
-			   mAH and total time, NOT simply total current
-			   and total frames.  This gives an average-per-
-			   unit-of-time (generally constant by the laws
-			   of physics) rather than an average-per-frame
-			   (variable by CPU power and frame complexity). */
-			stats->maAvg = stats->mahTotal *
-			  (1000000.0 * 60.0 * 60.0) /
-			  (double)stats->usecFrameTotal;
-		}
+	if(p < 1) return 0;
 
-		/* With mAH calculations done, the mA estimate can now be
-		   updated for the new frame. */
-		len = nStrands * pixelsPerStrand;
-		for(sum=0.0,i=0;i<len;i++) sum += pixelCurrent[i];
-		stats->ma = sum;
-		if(stats->ma > stats->maMax) stats->maMax = stats->ma;
+	if(s & TC_MPSSE)  /* 4 bytes/pixel plus command overhead */
+		return ((s & ~TC_MPSSE) > 1) ? 0 :
+		  MPSSE_LEN(4 * (unsigned long)(p + ((p + 63) / 64)));
 
-		stats->reserved = time2;  /* Save for next time */
-		stats->frames++;
-	}
+	if((s < 1) || (s > 16)) return 0;
 
-	return status;
+	return bpp * (unsigned long)(p + ((p + 63) / 64));
+}
+
+/* Palette for TCrefreshIndexed(), in the parameter block.  The
+   application's colors are kept so the encoded form can be rebuilt
+   whenever gamma changes: every palette entry is run through the gamma
+   table, encoded as a P9813 word and its current estimated, so the
+   rendering loop needn't do any of this per pixel.  Called on a new
+   block when the palette or gamma changes: 256 entries, regardless of
+   display size. */
+static void encodePalette(paramBlock *pb)
+{
+	int           i;
+	unsigned char r,g,b;
+
+	for(i=0;i<256;i++)
+	{
+		r = pb->gamma[(pb->paletteColor[i] >> 16) & 0xff][0];
+		g = pb->gamma[(pb->paletteColor[i] >>  8) & 0xff][1];
+		b = pb->gamma[ pb->paletteColor[i]        & 0xff][2];
+		pb->paletteWord[i]    = P9813_WORD(r,g,b);
+		pb->paletteCurrent[i] = EST_CURRENT(r,g,b);
+	}
+}
+
+/****************************************************************************
+ Function    : TCsetPalette()
+ Description : Sets the color palette used by TCrefreshIndexed().  Colors
+               are gamma-corrected and encoded once here rather than once
+               per pixel per frame, so changing the palette (e.g. for
+               palette-cycling animation) is cheap, as is every refresh.
+               The palette is re-encoded automatically if gamma changes.
+ Parameters  : const TCpixel *  Palette colors.
+               int              Number of colors, 1 to 256.  Any remaining
+                                entries are set to black.
+ Returns     : TC_OK on success, TC_ERR_VALUE if invalid parameter received,
+               TC_ERR_MALLOC on malloc() failure.
+ ****************************************************************************/
+TCstatusCode TCsetPalette(
+  const TCpixel *palette,
+  int            n)
+{
+	paramBlock *pb;
+
+	if(!palette || (n < 1) || (n > 256)) return TC_ERR_VALUE;
+	if(!(pb = paramsBegin())) return TC_ERR_MALLOC;
+
+	memcpy(pb->paletteColor,palette,n * sizeof(TCpixel));
+	bzero(&pb->paletteColor[n],(256 - n) * sizeof(TCpixel));
+	encodePalette(pb);
+	paramsCommit(pb);
+
+	return TC_OK;
+}
+
+/* Apply 8.8 correction factor K to color component V (0-255). */
+#define CORRECT(V,K) \
+	{ unsigned int v_ = ((V) * (K) + 128) >> 8; \
+	  (V) = (v_ > 255) ? 255 : v_; }
+
+/****************************************************************************
+ Function    : TCsetCorrection()
+ Description : Sets color correction factors for a run of pixels, e.g. to
+               match the white balance and brightness of pixels from
+               different batches.  Each color component of each pixel is
+               multiplied by its factor before gamma correction.  Pixel
+               numbers are physical positions, as for the remap table
+               (i.e. strand number * pixels per strand + position on
+               strand), so correction follows the pixels themselves
+               regardless of remapping.  Must be called after TCopen().
+ Parameters  : int     First pixel.
+               int     Number of pixels.
+               double  Red factor, 0.0 to 255.0 (1.0 = unchanged).
+               double  Green factor.
+               double  Blue factor.
+ Returns     : TC_OK on success, TC_ERR_VALUE if invalid parameter received,
+               TC_ERR_MALLOC on malloc() failure.
+ ****************************************************************************/
+TCstatusCode TCsetCorrection(
+  int    first,
+  int    count,
+  double r,
+  double g,
+  double b)
+{
+	int              i,n = nStrands * pixelsPerStrand;
+	uint16_t         k[3];
+	correctionTable *t;
+	paramBlock      *pb;
+
+	if(!pixelOutBuffer || (first < 0) || (count < 1) ||
+	   (first + count > n) || (r < 0.0) || (g < 0.0) || (b < 0.0) ||
+	   (r >= 256.0) || (g >= 256.0) || (b >= 256.0))
+		return TC_ERR_VALUE;
+
+	/* A new table every time, header and factors in one allocation:
+	   the current one may be in use by a frame being rendered. */
+	if(!(t = (correctionTable *)malloc(sizeof(correctionTable) +
+	  n * sizeof(t->k[0])))) return TC_ERR_MALLOC;
+	if(!(pb = paramsBegin()))
+	{
+		free(t);
+		return TC_ERR_MALLOC;
+	}
+	t->refs = 0;
+	t->k    = (uint16_t (*)[3])&t[1];
+
+	/* Start from the current factors, or all 1.0 on first use. */
+	if(pb->correction)
+	{
+		memcpy(t->k,pb->correction->k,n * sizeof(t->k[0]));
+	} else
+	{
+		for(i=0;i<n;i++) t->k[i][0] = t->k[i][1] = t->k[i][2] = 256;
+	}
+
+	k[0] = (uint16_t)(r * 256.0 + 0.5);
+	k[1] = (uint16_t)(g * 256.0 + 0.5);
+	k[2] = (uint16_t)(b * 256.0 + 0.5);
+	for(i=first;i<first+count;i++) memcpy(t->k[i],k,sizeof(k));
+	pb->correction = t;
+	paramsCommit(pb);
+
+	return TC_OK;
+}
+
+/****************************************************************************
+ Function    : TCclearCorrection()
+ Description : Removes all color correction set by TCsetCorrection().
+ Parameters  : None (void).
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCclearCorrection(void)
+{
+	paramBlock *pb;
+
+	if(!(pb = paramsBegin())) return;
+	pb->correction = NULL;
+	paramsCommit(pb);
+}
+
+/* Incremental encoding (TCrefreshDirty()).  If pixelOutBuffer still
+   holds the last frame of the same image, encoded the same way, only
+   pixels in the changed spans need encoding again; these record what
+   the buffer holds. */
+static const TCpixel
+	*encodedPixels  = NULL;
+static const int
+	*encodedRemap;
+static const unsigned char
+	*encodedBuffer;
+static unsigned long
+	encodedVersion;
+
+/* Returns nonzero if image pixel i is in one of the (ascending) spans. */
+static int inSpans(
+  const TCspan *span,
+  int           n,
+  int           i)
+{
+	int lo = 0,hi = n - 1,mid;
+
+	while(lo <= hi)
+	{
+		mid = (lo + hi) / 2;
+		if(i < span[mid].start)                    hi = mid - 1;
+		else if(i >= span[mid].start + span[mid].n) lo = mid + 1;
+		else                                        return 1;
+	}
+
+	return 0;
+}
+
+/* Encodes one strand from the given source into pixelOutBuffer, using
+   the given parameters and gamma table (normally the parameters' own,
+   but the current limiter may substitute a scaled-down copy).  The
+   strand's bits in the buffer must be clear beforehand, unless
+   'incremental' is set, in which case only pixels in the source's
+   changed spans are encoded (over the last frame's bits) and the rest
+   are left as they are.  Returns the strand's estimated current; 'base'
+   receives the portion of that which is due to pixels merely being
+   present (the "off" current), which no amount of dimming can reduce. */
+static double renderStrand(
+  const frameSource   *src,
+  int                 *remap,
+  int                  s,
+  paramBlock          *pb,
+  unsigned char      (*gamma)[3],
+  double              *baseMa,
+  int                  incremental)
+{
+	int            i,p,absPixel,mappedPixel;
+	unsigned char  r,g,b,strand,*addr;
+	unsigned long  rgb;
+	TCpixel        c;
+	double         sum = 0.0,base = 0.0;
+	uint16_t     (*correction)[3] = pb->correction ?
+	                 pb->correction->k : NULL;
+
+	/* The structure of the pixelOutBuffer[] array is described in the
+	   Hack-a-Day article referenced in the README.  Picture it like one
+	   long player piano roll, where each key on the piano corresponds
+	   to one GPIO bit.  Thus data (including the clock signal) must be
+	   "turned sideways" in this array, through a series of bitwise
+	   operations. */
+	strand   = pb->strandBitMask[s];
+	absPixel = s * pixelsPerStrand;
+	for(p=0;p<pixelsPerStrand;p++,absPixel++)
+	{
+		mappedPixel = remap ? remap[absPixel] : absPixel;
+
+		if(incremental && !inSpans(src->spans,src->nSpans,mappedPixel))
+		{
+			/* Unchanged; last frame's encoding and estimate
+			   stand */
+			if(mappedPixel != TC_PIXEL_DISCONNECTED)
+				base += (double)CAL_CURRENT_OFF /
+				  (double)CAL_N_PIXELS;
+			sum += pixelCurrent[absPixel];
+			continue;
+		}
+
+		/* Get RGB value and current use for this pixel */
+		if((SOURCE_BLANK == src->type) || (mappedPixel < 0))
+		{
+			rgb                    = 0xff000000;
+			if(mappedPixel == TC_PIXEL_DISCONNECTED)
+			{
+				pixelCurrent[absPixel] = 0.0;
+			} else
+			{
+				pixelCurrent[absPixel] =
+				  (double)CAL_CURRENT_OFF /
+				  (double)CAL_N_PIXELS;
+				base                  += pixelCurrent[absPixel];
+			}
+		} else if((SOURCE_INDEXED == src->type) &&
+		  (gamma == pb->gamma) && !correction)
+		{
+			/* Palette entries were gamma-corrected, encoded and
+			   current-estimated ahead of time by
+			   encodePalette(). */
+			c                      = src->index[mappedPixel];
+			rgb                    = pb->paletteWord[c];
+			pixelCurrent[absPixel] = pb->paletteCurrent[c];
+			base += (double)CAL_CURRENT_OFF / (double)CAL_N_PIXELS;
+		} else
+		{
+			switch(src->type)
+			{
+			   case SOURCE_LAYERS:
+				c = compositePixel(&pb->layers,mappedPixel);
+				break;
+			   case SOURCE_BLEND:
+				c = lerpPixel(src->pixels[mappedPixel],
+				  src->pixels2[mappedPixel],src->alpha);
+				break;
+			   case SOURCE_FORMAT:
+				c = formatPixel(src,mappedPixel);
+				break;
+			   case SOURCE_INDEXED: /* Current-limited/corrected */
+				c = pb->paletteColor[src->index[mappedPixel]];
+				break;
+			   default:
+				c = src->pixels[mappedPixel];
+				break;
+			}
+
+			/* Separate components, apply any per-pixel correction,
+			   run through gamma tables. */
+			r = (c >> 16) & 0xff;
+			g = (c >>  8) & 0xff;
+			b =  c        & 0xff;
+			if(correction)
+			{
+				CORRECT(r,correction[absPixel][0]);
+				CORRECT(g,correction[absPixel][1]);
+				CORRECT(b,correction[absPixel][2]);
+			}
+			r = gamma[r][0];
+			g = gamma[g][1];
+			b = gamma[b][2];
+
+			if(SOURCE_BLEND_GAMMA == src->type)
+			{
+				/* Mix in linear light (post-gamma) rather than
+				   in the source's perceptual space; fades
+				   between dissimilar colors don't dip in
+				   brightness mid-way. */
+				unsigned short a = src->alpha,inv = 256 - a;
+				unsigned char  r2,g2,b2;
+				c  = src->pixels2[mappedPixel];
+				r2 = (c >> 16) & 0xff;
+				g2 = (c >>  8) & 0xff;
+				b2 =  c        & 0xff;
+				if(correction)
+				{
+					CORRECT(r2,correction[absPixel][0]);
+					CORRECT(g2,correction[absPixel][1]);
+					CORRECT(b2,correction[absPixel][2]);
+				}
+				r = (r * inv + gamma[r2][0] * a) >> 8;
+				g = (g * inv + gamma[g2][1] * a) >> 8;
+				b = (b * inv + gamma[b2][2] * a) >> 8;
+			}
+
+			/* And reassemble into P9813 32-bit format. */
+			rgb = P9813_WORD(r,g,b);
+
+			pixelCurrent[absPixel] = EST_CURRENT(r,g,b);
+			base += (double)CAL_CURRENT_OFF / (double)CAL_N_PIXELS;
+		}
+		sum += pixelCurrent[absPixel];
+		if(recordWords) recordWords[absPixel] = rgb;
+
+		/* Turn pixel "sideways" into output buffer. */
+		addr = &pixelOutBuffer[p * bytesPerPixel]; /* Base addr */
+		if(incremental && (bytesPerPixel > 4))
+			for(i=0;i<bytesPerPixel;i++) addr[i] &= ~strand;
+		if(bytesPerPixel == 4)
+		{
+			/* MPSSE: one strand, so no turning sideways; just the
+			   word, most significant byte first. */
+			addr[0] = rgb >> 24;
+			addr[1] = rgb >> 16;
+			addr[2] = rgb >>  8;
+			addr[3] = rgb;
+		} else if(bytesPerPixel == 64)
+		{
+			for(;rgb;rgb<<=1)
+			{
+				if(rgb & 0x80000000)
+				{
+					addr[0] |= strand;
+					addr[1] |= strand;
+				}
+				addr += 2;
+			}
+		} else
+		{
+			for(;rgb;rgb<<=1)
+			{
+				if(rgb & 0x80000000) *addr |= strand;
+				addr++;
+			}
+		}
+	}
+
+	*baseMa = base;
+	return sum;
+}
+
+/* Current limiting.  Budgets (in the parameter block) are in milliamps,
+   0.0 = no limit.  The estimated draw of each strand is known as soon
+   as it's encoded; if over budget, just that strand is re-encoded
+   through a copy of the gamma table scaled down to fit (256 entries to
+   rebuild, versus however many pixels), so the limiter never makes a
+   second pass over the whole image. */
+static double
+	strandCurrent[8],     /* Estimated draw of each strand this frame */
+	strandPrior[8];       /* Undimmed draw last frame, for planning   */
+static unsigned char
+	limitGamma[256][3];
+static int
+	frameLimited     = 0; /* Set if any strand was scaled this frame */
+
+/* Gamma table of the given parameters scaled by k (0.0-1.0) into
+   limitGamma.  Scaling is applied after gamma, where values are
+   proportional to PWM duty cycle (and hence current). */
+static void scaleGamma(
+  const paramBlock *pb,
+  double            k)
+{
+	int i,c;
+
+	for(i=0;i<256;i++)
+		for(c=0;c<3;c++)
+			limitGamma[i][c] =
+			  (unsigned char)((double)pb->gamma[i][c] * k);
+}
+
+/****************************************************************************
+ Function    : TCsetCurrentLimit()
+ Description : Sets a current budget for one strand or for the display as
+               a whole.  Before each frame is issued, the library estimates
+               its draw (using the same model as the statistics), and any
+               strand exceeding its budget is dimmed just enough to fit.
+               Intended to keep bright flashes from tripping power supplies
+               or overloading wiring -- but as with all of the current
+               figures, these are estimates and should be padded with a
+               healthy safety margin.  Applies to subsequent refreshes.
+ Parameters  : int     Strand number (0-7), or TC_ALL_STRANDS for a limit
+                       on the total of all strands.  Strand and total limits
+                       may be used together.
+               double  Budget in milliamps, or 0.0 for no limit (default).
+ Returns     : TC_OK on success, TC_ERR_VALUE if invalid parameter received,
+               TC_ERR_MALLOC on malloc() failure.
+ ****************************************************************************/
+TCstatusCode TCsetCurrentLimit(
+  int    strand,
+  double ma)
+{
+	paramBlock *pb;
+
+	if((strand < TC_ALL_STRANDS) || (strand > 7) || (ma < 0.0))
+		return TC_ERR_VALUE;
+	if(!(pb = paramsBegin())) return TC_ERR_MALLOC;
+
+	if(TC_ALL_STRANDS == strand) pb->globalLimit         = ma;
+	else                         pb->strandLimit[strand] = ma;
+	paramsCommit(pb);
+
+	return TC_OK;
+}
+
+/* Converts one frame from the given source into pixelOutBuffer.  This is
+   the common first phase of TCrefresh() and its variants.  The whole
+   frame is rendered from one snapshot of the parameters. */
+static void renderFrame(
+  const frameSource *src,
+  int               *remap)
+{
+	int         i,s,len,tries,incremental;
+	double      ma,base,budget,remaining,predicted,weight,k,scale,demand[8];
+	paramBlock *pb;
+
+	TRACE_BEGIN(encode,pixelsPerStrand);
+	pb = paramsAcquire();
+
+	/* Clock pin changed since the latch was rendered? */
+	if(pb->version != latchVersion) renderLatch(pb);
+
+	/* Can the last frame's encoding be reused?  Not if anything about
+	   how it was encoded has changed, nor if it was dimmed by the
+	   current limiter, nor while recording (which needs every word). */
+	incremental = (SOURCE_DIRTY == src->type) &&
+	  (src->pixels == encodedPixels) && (remap == encodedRemap) &&
+	  (pixelOutBuffer == encodedBuffer) &&
+	  (pb->version == encodedVersion) && !frameLimited && !recordWords;
+
+	/* Clear output buffer, leaving latch intact at end.  For software-
+	   bitbanged clock signal, clock ticks are added now rather than in
+	   subsequent loop because the strand/pixel remapping tables could
+	   leave gaps in the sequence -- it isn't guaranteed to have touched
+	   every pixel.  This is normal and not a bad thing. */
+	len = pixelsPerStrand * bytesPerPixel;
+	if(!incremental)
+	{
+		bzero(pixelOutBuffer,len);
+		if(bytesPerPixel == 64)
+			for(i=1;i<len;i+=2)
+				pixelOutBuffer[i] = pb->strandBitMask[7];
+	}
+
+	remaining    = pb->globalLimit;
+	frameLimited = 0;
+	for(s=0;s<nStrands;s++)
+	{
+		ma = renderStrand(src,remap,s,pb,pb->gamma,&base,incremental);
+
+		/* Work out this strand's budget: its own limit, and/or its
+		   share of what's left of the global limit.  Strands not yet
+		   encoded are predicted to draw what they did last frame;
+		   this strand may use whatever they won't, but is always
+		   allowed at least its proportional share of what's left. */
+		budget = pb->strandLimit[s];
+		if(pb->globalLimit > 0.0)
+		{
+			for(predicted=0.0,i=s+1;i<nStrands;i++)
+				predicted += strandPrior[i];
+			weight = predicted + strandPrior[s];
+			if(weight > 0.0)
+			{
+				k = remaining * strandPrior[s] / weight;
+				if(remaining - predicted > k)
+					k = remaining - predicted;
+			} else
+			{
+				/* No history (first frame); equal shares */
+				k = remaining / (double)(nStrands - s);
+			}
+			if(k < 0.0) k = 0.0;
+			if((budget <= 0.0) || (k < budget)) budget = k;
+		}
+		demand[s] = ma;
+
+		/* Over budget?  Clear this strand's bits and re-encode it at
+		   reduced brightness.  Color current isn't quite linear in
+		   brightness (see calibration.h), so the first estimate may
+		   land a hair over; refine if needed, though this seldom
+		   takes more than one try. */
+		for(scale=1.0,tries=0;
+		  (budget > 0.0) && (ma > budget) && (tries < 3);tries++)
+		{
+			scale *= (ma > base) ? ((budget - base) / (ma - base)) :
+			  0.0;
+			if(scale < 0.0) scale = 0.0;
+			scaleGamma(pb,scale);
+			for(i=0;i<len;i++)
+				pixelOutBuffer[i] &= ~pb->strandBitMask[s];
+			ma = renderStrand(src,remap,s,pb,limitGamma,&base,0);
+			frameLimited = 1;
+		}
+
+		strandCurrent[s] = ma;
+		remaining       -= ma;
+	}
+	memcpy(strandPrior,demand,sizeof(strandPrior));
+
+	encodedPixels     = ((SOURCE_PIXELS == src->type) ||
+	  (SOURCE_DIRTY == src->type)) ? src->pixels : NULL;
+	encodedRemap      = remap;
+	encodedBuffer     = pixelOutBuffer;
+	encodedVersion    = pb->version;
+	paramsRelease();
+	if(recordWords) recordFrame();
+	TRACE_END(encode,frameLimited);
+}
+
+/* Updates statistics for one frame of len bytes (including latch), given
+   its I/O time, the time at which it finished (uS), and the estimated
+   draw of each strand.  This is the common third phase of TCrefresh()
+   and its variants. */
+static void frameStats(
+  TCstats       *stats,
+  int            len,
+  unsigned long  usecIo,
+  unsigned long  time2,
+  const double  *maStrand,
+  int            limited)
+{
+	double sum;
+	int    i;
+
+	/* Parallel output bits are included in I/O calculations.  Each
+	   byte carries one bit per strand (or half that with the software
+	   clock), except in MPSSE mode where it's eight bits of one. */
+	stats->bits       = nStrands * len * 32 / bytesPerPixel;
+	stats->bitsTotal += stats->bits;
+
+	/* Get I/O elapsed time and compute throughput for this
+	   single frame. */
+	if((stats->usecIo = usecIo) > 0)
+	{
+		stats->bps = (unsigned long)(
+		  ((double)stats->bits * 1000000.0) /
+		   (double)stats->usecIo);
+		stats->usecIoTotal += stats->usecIo;
+	} else
+	{
+		stats->bps = 0;  /* Probably I/O error */
+	}
+
+	/* Compute average throughput from total bits output and
+	   cumulative I/O time.  Avoid divide-by-zero first: */
+	if(stats->usecIoTotal)
+	{
+		stats->bpsAvg = (unsigned long)(
+		  ((double)stats->bitsTotal * 1000000.0) /
+		   (double)stats->usecIoTotal);
+	} else
+	{
+		stats->bpsAvg = stats->bps;
+	}
+
+	/* Some figures cannot be calculated until multiple frames
+	   have been rendered and output. */
+	if(stats->frames)
+	{
+		/* The 'reserved' element of the stats structure
+		   is actually the saved value of 'time2' from the
+		   prior invocation of this function; used to
+		   determine the total processing time for frame. */
+		stats->usecFrame = time2 - stats->reserved;
+		if(stats->usecFrame)
+		{
+		  stats->fps = 1000000.0 / (double)stats->usecFrame;
+		  stats->usecFrameTotal += stats->usecFrame;
+		} else
+		{
+		  stats->fps = 0.0;  /* Probably I/O error */
+		}
+
+		if(stats->usecFrameTotal)
+		{
+			stats->fpsAvg = (double)stats->frames *
+			  1000000.0 / (double)stats->usecFrameTotal;
+		}
+
+		/* Milliamp-hour calculations need to work from the
+		   PRIOR frame, so don't calculate the mA value of
+		   the new frame yet!  Use the old one... */
+		stats->mah = stats->ma * ((double)stats->usecFrame) /
+		  (1000000.0 * 60.0 * 60.0);
+		stats->mahTotal += stats->mah;
+
+		/* Average current is back-calculated from total
+		   mAH and total time, NOT simply total current
+		   and total frames.  This gives an average-per-
+		   unit-of-time (generally constant by the laws
+		   of physics) rather than an average-per-frame
+		   (variable by CPU power and frame complexity). */
+		if(stats->usecFrameTotal)
+		{
+			stats->maAvg = stats->mahTotal *
+			  (1000000.0 * 60.0 * 60.0) /
+			  (double)stats->usecFrameTotal;
+		}
+	}
+
+	/* With mAH calculations done, the mA estimate can now be
+	   updated for the new frame. */
+	for(sum=0.0,i=0;i<nStrands;i++)
+	{
+		stats->maStrand[i] = maStrand[i];
+		if(maStrand[i] > stats->maStrandMax[i])
+			stats->maStrandMax[i] = maStrand[i];
+		sum += maStrand[i];
+	}
+	stats->ma = sum;
+	if(stats->ma > stats->maMax) stats->maMax = stats->ma;
+	if(limited) stats->framesLimited++;
+
+	/* Device recovery, if any, as of this frame */
+	stats->outages         = outages;
+	stats->recoveries      = recoveries;
+	stats->framesDropped   = framesDropped;
+	stats->usecOutage      = __sync_fetch_and_add(&deviceState,0) ?
+	  (unsigned long)(usecNow() - outageStart) :
+	  (unsigned long)usecOutageLast;
+	stats->usecOutageTotal = (unsigned long)usecOutageTotal;
+
+	stats->reserved = time2;  /* Save for next time */
+	stats->frames++;
+}
+
+/* Shared-memory statistics (see TCpublishStats()).  The page has one
+   writer, whichever thread is issuing frames, and is updated in place
+   under a sequence lock: 'seq' is made odd, the fields written, then
+   'seq' made even again, so readers in other processes can tell when
+   they've seen a partial update and retry.  Nothing here blocks or makes
+   a system call; when not publishing, it's one pointer test per frame. */
+static TCstatsPage
+	*statsPage = NULL;
+static char
+	statsName[64];
+
+static void pageBegin(void)
+{
+	statsPage->seq++;
+	__sync_synchronize();
+}
+
+static void pageEnd(void)
+{
+	statsPage->usecUpdated = usecNow();
+	__sync_synchronize();
+	statsPage->seq++;
+}
+
+/* Adds one frame to the published statistics. */
+static void publishFrame(
+  int           len,
+  unsigned long usecIo,
+  unsigned long time2,
+  TCstatusCode  status)
+{
+	pageBegin();
+	statsPage->nStrands        = nStrands;
+	statsPage->pixelsPerStrand = pixelsPerStrand;
+	frameStats(&statsPage->stats,len,usecIo,time2,strandCurrent,
+	  frameLimited);
+	if(status != TC_OK) statsPage->writeErrors++;
+	pageEnd();
+}
+
+/* Device recovery thread: closes the lost device, then keeps trying to
+   reopen it -- the same one, by serial number -- and restore its mode,
+   until it succeeds or TCclose() calls it off.  Leaves the device to the
+   thread issuing frames with DEVICE_FOUND; that thread resends the latch
+   before its next frame. */
+static void *recoverLoop(void *arg)
+{
+	DWORD        n;
+	TCstatusCode status;
+	int          i;
+
+	(void)FT_Close(ftdiHandle);
+	ftdiHandle = NULL;
+
+	while(!__sync_fetch_and_add(&recoverStop,0))
+	{
+		/* A replugged device takes a moment to enumerate anyway */
+		for(i=0;(i<10) && !__sync_fetch_and_add(&recoverStop,0);i++)
+			usleep(25000);
+		if(__sync_fetch_and_add(&recoverStop,0)) break;
+
+		(void)FT_CreateDeviceInfoList(&n);  /* Re-enumerate */
+		if(FT_OK != (deviceSerial[0] ?
+		  FT_OpenEx(deviceSerial,FT_OPEN_BY_SERIAL_NUMBER,&ftdiHandle) :
+		  FT_Open(0,&ftdiHandle)))
+		{
+			ftdiHandle = NULL;
+			continue;
+		}
+		TRACE_MARK(device_open,1);
+		status = deviceSetup();
+		if((TC_OK == status) || (TC_ERR_DIVISOR == status) ||
+		   (TC_ERR_BAUDRATE == status))
+		{
+			(void)__sync_val_compare_and_swap(&deviceState,
+			  DEVICE_LOST,DEVICE_FOUND);
+			break;
+		}
+		(void)FT_Close(ftdiHandle);
+		ftdiHandle = NULL;
+	}
+
+	return NULL;
+}
+
+/* Stops the recovery thread, if any. */
+static void recoverEnd(void)
+{
+	if(recoverJoin)
+	{
+		(void)__sync_lock_test_and_set(&recoverStop,1);
+		pthread_join(recoverThread,NULL);
+		recoverJoin = 0;
+		recoverStop = 0;
+	}
+	deviceState = DEVICE_OK;
+}
+
+/* Issues frame data to the device, or discards it while the device is
+   being recovered.  On a write error, hands the device to the recovery
+   thread if recovery is enabled (in which case the frame counts as
+   discarded, not failed).  Never blocks on recovery. */
+static TCstatusCode deviceWrite(
+  unsigned char *buf,
+  int            len,
+  int            frames)  /* Number of frames in buf */
+{
+	TCstatusCode status;
+	int          state = __sync_fetch_and_add(&deviceState,0);
+
+	if(state != DEVICE_OK)
+	{
+		if(state == DEVICE_LOST)
+		{
+			framesDropped += frames;
+			return TC_OK;
+		}
+
+		/* Reopened: the outage is over.  Begin with a latch, as
+		   TCopen() does, so the first frame lines up. */
+		recoveries++;
+		usecOutageLast   = usecNow() - outageStart;
+		usecOutageTotal += usecOutageLast;
+		(void)__sync_val_compare_and_swap(&deviceState,DEVICE_FOUND,
+		  DEVICE_OK);
+		if(TC_OK == (status = wireWrite(latchData,latchSize)))
+			TRACE_MARK(latch,0);
+		else
+			buf = NULL;  /* Lost again */
+	}
+
+	if(buf) status = wireWrite(buf,len);
+	if((TC_ERR_WRITE != status) || !recoverOn || sinkFunc) return status;
+
+	/* The previous recovery thread has finished, if there was one */
+	if(recoverJoin) pthread_join(recoverThread,NULL);
+	recoverJoin = 0;
+	outages++;
+	outageStart = usecNow();
+	(void)__sync_lock_test_and_set(&deviceState,DEVICE_LOST);
+	if(pthread_create(&recoverThread,NULL,recoverLoop,NULL))
+	{
+		/* Can't recover; report the error */
+		(void)__sync_lock_test_and_set(&deviceState,DEVICE_OK);
+		return status;
+	}
+	recoverJoin    = 1;
+	framesDropped += frames;
+
+	return TC_OK;
+}
+
+/* Issues the contents of pixelOutBuffer to the FTDI device and updates
+   statistics.  This is the common second and third phase of TCrefresh()
+   and its variants. */
+static TCstatusCode sendFrame(TCstats *stats)
+{
+	int            len;
+	unsigned long  time1;
+	TCstatusCode   status;
+
+	/* PHASE 2: Issue serial data. ------------------------------------ */
+
+	/* Total number of bytes to output; includes latch data at end. */
+	len = bytesPerPixel * (pixelsPerStrand + ((pixelsPerStrand+63)/64));
+
+	/* Get current time (in microseconds) both before and after
+	   write operation.  This is to isolate I/O-bound statistics
+	   from overall timing data (which includes frame rendering
+	   time, etc.). */
+	time1 = (unsigned long)usecNow();
+
+	/* Function does not immediately return on write error.  Some
+	   of the subsequent statistics may still be valid for reference
+	   use, even if not issued to the chip (e.g. estimating the
+	   total current use of specific LED patterns). */
+	TRACE_BEGIN(write,len);
+	status = deviceWrite(pixelOutBuffer,len,1);
+	TRACE_END(write,status);
+	if(status == TC_OK) TRACE_MARK(latch,pixelsPerStrand);
+	else                TRACE_MARK(error,status);
+
+	/* PHASE 3: (Optionally) generate statistics ---------------------- */
+
+	if(stats || statsPage)
+	{
+		unsigned long time2 = (unsigned long)usecNow();
+
+		if(stats) frameStats(stats,len,time2 - time1,time2,
+		  strandCurrent,frameLimited);
+		if(statsPage) publishFrame(len,time2 - time1,time2,status);
+	}
+
+	return status;
+}
+
+/****************************************************************************
+ Function    : TCrefresh()
+ Description : Updates LED display; pushes data out "on the wire" via the
+               FTDI adapter.
+ Parameters  : TCPixel *  Image data, as a one-dimensional array.  If NULL,
+                          entire image is set to "off" state.
+               int *      Optional remapping table, assigns each pixel in
+                          each strand to a position in the TCpixel array
+                          passed as the first marameter.  If NULL, each
+                          element of the TCpixel array is assumed to
+                          correspond sequentially to each pixel in each
+                          strand, and gaps in strands are not handled.
+               TCstats *  Optional pointer to structure for receiving
+                          performance statistics.  Pass NULL if this
+                          information is not needed.
+ Returns     : TC_OK on success, TC_ERR_WRITE on I/O error.
+ ****************************************************************************/
+TCstatusCode TCrefresh(
+  TCpixel *pixelInBuffer,
+  int     *remap,
+  TCstats *stats)
+{
+	frameSource src;
+
+	src.type   = pixelInBuffer ? SOURCE_PIXELS : SOURCE_BLANK;
+	src.pixels = pixelInBuffer;
+	renderFrame(&src,remap);
+
+	return sendFrame(stats);
+}
+
+/****************************************************************************
+ Function    : TCrefreshDirty()
+ Description : Same as TCrefresh(), but told which parts of the image have
+               changed since the last frame, so that only those pixels are
+               encoded; the rest of the last frame's encoding is reused.
+               The spans are normally those reported by an effect graph
+               (see TCgraphOutput()) for its output node.  The frame is
+               still sent in full.  Encoding starts over whole whenever
+               the last frame wasn't this same array with the same remap
+               table, or gamma, pins, color correction or the current
+               limiter's effect changed, so it's always safe; spans that
+               omit a change, though, leave stale pixels on display.
+ Parameters  : const TCpixel *  Image, as with TCrefresh().  Must be the
+                                same array each frame.
+               const TCspan *   Spans of image pixels (indices into the
+                                array above, as in the remap table)
+                                changed since the previous frame, in
+                                ascending order and not overlapping.  NULL
+                                if none.
+               int              Number of spans.
+               int *            Optional remapping table, as with
+                                TCrefresh().
+               TCstats *        Optional statistics structure.
+ Returns     : TC_OK on success, TC_ERR_VALUE if invalid parameter received,
+               TC_ERR_WRITE on I/O error.
+ ****************************************************************************/
+TCstatusCode TCrefreshDirty(
+  const TCpixel *pixelInBuffer,
+  const TCspan  *spans,
+  int            nSpans,
+  int           *remap,
+  TCstats       *stats)
+{
+	frameSource src;
+	int         i;
+
+	if(!pixelInBuffer || (nSpans < 0) || (nSpans && !spans))
+		return TC_ERR_VALUE;
+	for(i=0;i<nSpans;i++)
+	{
+		if((spans[i].start < 0) || (spans[i].n < 0) || (i &&
+		   (spans[i].start < spans[i - 1].start + spans[i - 1].n)))
+			return TC_ERR_VALUE;
+	}
+
+	src.type   = SOURCE_DIRTY;
+	src.pixels = pixelInBuffer;
+	src.spans  = spans;
+	src.nSpans = nSpans;
+	renderFrame(&src,remap);
+
+	return sendFrame(stats);
+}
+
+/****************************************************************************
+ Function    : TCrefreshLayers()
+ Description : Same as TCrefresh(), but the image is the composite of all
+               layers previously assigned with TCsetLayer(), scaled by the
+               master fader.  Blending takes place inside the encoding
+               loop; there is no separate compositing pass over the image.
+ Parameters  : int *      Optional remapping table, as with TCrefresh();
+                          applies equally to all layers.
+               TCstats *  Optional pointer to statistics structure.
+ Returns     : TC_OK on success, TC_ERR_WRITE on I/O error.
+ ****************************************************************************/
+TCstatusCode TCrefreshLayers(
+  int     *remap,
+  TCstats *stats)
+{
+	frameSource src;
+
+	src.type   = SOURCE_LAYERS;
+	src.pixels = NULL;
+	renderFrame(&src,remap);
+
+	return sendFrame(stats);
+}
+
+/****************************************************************************
+ Function    : TCrefreshIndexed()
+ Description : Same as TCrefresh(), but image data is one byte per pixel,
+               each an index into the palette set with TCsetPalette().
+               A quarter the memory of TCpixel data, and each pixel is
+               encoded with a single table lookup.
+ Parameters  : unsigned char *  Palette index for each pixel.  If NULL,
+                                entire image is set to "off" state.
+               int *            Optional remapping table, as TCrefresh().
+               TCstats *        Optional pointer to statistics structure.
+ Returns     : TC_OK on success, TC_ERR_WRITE on I/O error.
+ ****************************************************************************/
+TCstatusCode TCrefreshIndexed(
+  unsigned char *index,
+  int           *remap,
+  TCstats       *stats)
+{
+	frameSource src;
+
+	src.type  = index ? SOURCE_INDEXED : SOURCE_BLANK;
+	src.index = index;
+	renderFrame(&src,remap);
+
+	return sendFrame(stats);
+}
+
+/****************************************************************************
+ Function    : TCrefreshFormat()
+ Description : Same as TCrefresh(), but accepts image data in one of
+               several common formats produced by video decoders, image
+               libraries and GPU readbacks, so it needn't be repacked into
+               TCpixels first.  Conversion takes place inside the
+               encoding loop.
+ Parameters  : const void *  Image data.  For TC_FORMAT_PLANAR, this is
+                             instead the address of an array of three
+                             pointers, to the red, green and blue planes
+                             (one byte per pixel each).  If NULL, entire
+                             image is set to "off" state.
+               TCformat      Format of image data; see header.
+               int           Distance in bytes from one pixel to the next
+                             (within each plane, for planar data), or 0
+                             if pixels are tightly packed.
+               int *         Optional remapping table, as TCrefresh().
+                             Indices are in pixels, not bytes.
+               TCstats *     Optional pointer to statistics structure.
+ Returns     : TC_OK on success, TC_ERR_VALUE if invalid parameter
+               received, TC_ERR_WRITE on I/O error.
+ ****************************************************************************/
+TCstatusCode TCrefreshFormat(
+  const void *data,
+  TCformat    format,
+  int         stride,
+  int        *remap,
+  TCstats    *stats)
+{
+	static const int packedSize[] = { 3, 3, 4, 4, 2, 1 };
+	frameSource      src;
+
+	if((format < TC_FORMAT_RGB24) || (format > TC_FORMAT_PLANAR) ||
+	   (stride < 0)) return TC_ERR_VALUE;
+
+	src.type   = data ? SOURCE_FORMAT : SOURCE_BLANK;
+	src.format = format;
+	src.stride = stride ? stride : packedSize[format];
+	if(TC_FORMAT_PLANAR == format)
+	{
+		if(data)
+		{
+			memcpy(src.plane,data,sizeof(src.plane));
+			if(!src.plane[0] || !src.plane[1] || !src.plane[2])
+				return TC_ERR_VALUE;
+		}
+	} else
+	{
+		src.plane[0] = (const unsigned char *)data;
+	}
+	renderFrame(&src,remap);
+
+	return sendFrame(stats);
+}
+
+/* Bitbang output rate in bytes/sec at the baud rate set in openAlloc().
+   Measured, not derived: about 240,000 pixels/sec with 8 strands and the
+   CBUS clock (32 bytes per 8 pixels).  Used only to size the padding in
+   TCrefreshBatch(), where a close figure is good enough.  MPSSE output
+   runs at the SPI clock rate, one bit per clock. */
+#define WIRE_BYTES_PER_SEC 960000.0
+
+/* TCrefreshBatch() buffer, grown as needed and freed by TCclose().  Holds
+   the per-strand current estimate and limiter flag of each frame (for
+   statistics), followed by the encoded frames themselves. */
+static unsigned char
+	*batchBuffer    = NULL;
+static size_t
+	batchSize       = 0;
+
+/****************************************************************************
+ Function    : TCrefreshBatch()
+ Description : Same as TCrefresh(), but for several consecutive frames at
+               once.  All frames are encoded (each with its latch) into
+               one contiguous buffer and issued with a single write, so
+               the per-call driver and USB overhead that dominates with
+               short strands is paid once per batch rather than once per
+               frame.  The bitbang data rate is fixed, so frames can be
+               evenly spaced in time by padding each with idle (latch)
+               bits up to a requested frame rate; the call then takes
+               about count/fps seconds, most of it spent in the write.
+ Parameters  : TCpixel ** Array of pointers to image data for each frame,
+                          as would be passed to TCrefresh().  NULL entries
+                          are "off" frames.
+               int        Number of frames.
+               double     Frame rate in frames/second, or 0.0 for no
+                          padding (frames go out as fast as the device
+                          permits).  Rates the device can't achieve are
+                          treated as 0.0.
+               int *      Optional remapping table, as with TCrefresh();
+                          applies to all frames.
+               TCstats *  Optional statistics structure; updated once per
+                          frame, as if each had been a TCrefresh() call
+                          evenly spaced across the time of the write.
+ Returns     : TC_OK on success, TC_ERR_VALUE if invalid parameter received,
+               TC_ERR_MALLOC if the batch buffer could not be allocated,
+               TC_ERR_WRITE on I/O error.
+ ****************************************************************************/
+TCstatusCode TCrefreshBatch(
+  TCpixel **frames,
+  int       count,
+  double    fps,
+  int      *remap,
+  TCstats  *stats)
+{
+	frameSource    src;
+	unsigned char *saveBuffer,*limited,*dest,*p;
+	double        *ma;
+	size_t         need;
+	int            f,i,n,dataLen,frameLen,latchLen,padLen,len;
+	unsigned long  time1,time2;
+	TCstatusCode   status;
+
+	if(!pixelOutBuffer || !frames || (count < 1) || (fps < 0.0))
+		return TC_ERR_VALUE;
+
+	dataLen  = bytesPerPixel * pixelsPerStrand;
+	latchLen = bytesPerPixel * ((pixelsPerStrand + 63) / 64);
+	frameLen = dataLen + latchLen;
+
+	/* Padding extends each frame's latch with further idle bits.
+	   With the software clock, padding is kept to whole clock cycles
+	   (byte pairs). */
+	padLen = (fps > 0.0) ? (int)((mpsse ? (double)mpsseClock / 8.0 :
+	  WIRE_BYTES_PER_SEC) / fps) - frameLen : 0;
+	if(padLen < 0)           padLen  = 0;
+	if(bytesPerPixel == 64)  padLen &= ~1;
+
+	need = count * (8 * sizeof(double) + 1 + frameLen + padLen);
+	if(need > batchSize)
+	{
+		if(!(p = (unsigned char *)realloc(batchBuffer,need)))
+			return TC_ERR_MALLOC;
+		batchBuffer = p;
+		batchSize   = need;
+	}
+	ma      = (double *)batchBuffer;
+	limited = (unsigned char *)&ma[count * 8];
+	dest    = &limited[count];
+
+	/* Each frame is rendered directly into its place in the batch
+	   buffer by temporarily pointing pixelOutBuffer there; the latch
+	   is then copied from the end of the real buffer, repeating it
+	   as needed to fill any padding. */
+	saveBuffer = pixelOutBuffer;
+	for(f=0,p=dest;f<count;f++)
+	{
+		src.type       = frames[f] ? SOURCE_PIXELS : SOURCE_BLANK;
+		src.pixels     = frames[f];
+		pixelOutBuffer = p;
+		renderFrame(&src,remap);
+		for(p+=dataLen,i=latchLen+padLen;i>0;p+=n,i-=n)
+		{
+			n = (i < latchLen) ? i : latchLen;
+			memcpy(p,&saveBuffer[dataLen],n);
+		}
+		memcpy(&ma[f * 8],strandCurrent,8 * sizeof(double));
+		limited[f] = frameLimited;
+	}
+	pixelOutBuffer = saveBuffer;
+
+	time1  = (unsigned long)usecNow();
+	len    = p - dest;
+	TRACE_BEGIN(write,len);
+	status = deviceWrite(dest,len,count);
+	TRACE_END(write,status);
+	if(status == TC_OK) TRACE_MARK(latch,count);
+	else                TRACE_MARK(error,status);
+
+	if(stats || statsPage)
+	{
+		time2 = (unsigned long)usecNow();
+		for(f=0;f<count;f++)
+		{
+			if(stats) frameStats(stats,dataLen + latchLen,
+			  (time2 - time1) / count,
+			  time1 + (time2 - time1) * (f + 1) / count,
+			  &ma[f * 8],limited[f]);
+			if(statsPage) publishFrame(dataLen + latchLen,
+			  (time2 - time1) / count,
+			  time1 + (time2 - time1) * (f + 1) / count,status);
+		}
+	}
+
+	return status;
+}
+
+/* Real-time output.  Library output threads (interpolation and the frame
+   mailbox) can be given SCHED_FIFO priority and pinned to a CPU, with the
+   memory they touch per frame locked into RAM beforehand so they never
+   take a page fault; nothing on their path allocates memory.  Their
+   wakeup latency -- from when a frame was due (or submitted to an idle
+   mailbox) to when the thread actually ran -- is measured regardless,
+   so the effect can be seen (see the "jitter" program). */
+static TClatencyStats
+	latency;
+static double
+	latencySum,
+	latencySumSq;
+static pthread_mutex_t
+	latencyLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Records one wakeup latency sample, in microseconds.  Histogram buckets
+   double in width from 16 uS, the last catching 1 mS and up. */
+static void latencySample(unsigned long usec)
+{
+	int b;
+
+	for(b=0;(b<7) && (usec >= (16UL << b));b++);
+
+	pthread_mutex_lock(&latencyLock);
+	if(!latency.samples || (usec < latency.usecMin))
+		latency.usecMin = usec;
+	if(usec > latency.usecMax) latency.usecMax = usec;
+	latency.samples++;
+	latency.hist[b]++;
+	latencySum   += (double)usec;
+	latencySumSq += (double)usec * (double)usec;
+	pthread_mutex_unlock(&latencyLock);
+}
+
+/* Pre-faults the stack of a real-time thread, so its deepest excursion
+   doesn't fault later.  Called first thing in each output thread. */
+static void rtThreadInit(void)
+{
+	volatile unsigned char stack[32768];
+	size_t                 i;
+
+	if(!rtPriority) return;
+	for(i=0;i<sizeof(stack);i+=1024) stack[i] = 0;
+}
+
+/* Locks the output path's memory into RAM (mlock() also faults it in):
+   the encode buffers, current-limiter gamma table, current parameter
+   block (later blocks are locked as they're published) and MPSSE buffer,
+   plus any buffer specific to the thread being started. */
+static TCstatusCode rtLockMemory(
+  void   *extra,
+  size_t  extraLen)
+{
+	size_t len = nStrands * pixelsPerStrand * sizeof(double) +
+	  (pixelsPerStrand + ((pixelsPerStrand + 63) / 64)) * bytesPerPixel;
+
+	if(mlock(pixelCurrent,len) ||
+	   mlock(limitGamma,sizeof(limitGamma)) ||
+	   mlock(paramsAcquire(),sizeof(paramBlock)) ||
+	   (mpsseBuffer && mlock(mpsseBuffer,mpsseSize)) ||
+	   (extra && mlock(extra,extraLen)))
+	{
+		paramsRelease();
+		return TC_ERR_REALTIME;
+	}
+	paramsRelease();
+
+	return TC_OK;
+}
+
+/* Starts a library output thread, with real-time scheduling, CPU affinity
+   and memory locking as set by TCsetRealtime().  The given buffer is
+   locked too, if any. */
+static TCstatusCode startThread(
+  pthread_t *thread,
+  void     *(*func)(void *),
+  void      *buf,
+  size_t     bufLen)
+{
+	pthread_attr_t     attr;
+	struct sched_param sp;
+	TCstatusCode       status = TC_OK;
+
+	bzero(&latency,sizeof(latency));
+	latencySum = latencySumSq = 0.0;
+
+	if(!rtPriority && (rtCpu < 0))
+		return pthread_create(thread,NULL,func,NULL) ?
+		  TC_ERR_MALLOC : TC_OK;
+
+	if(rtPriority && (TC_OK != (status = rtLockMemory(buf,bufLen))))
+		return status;
+
+	pthread_attr_init(&attr);
+	if(rtPriority)
+	{
+		(void)pthread_attr_setinheritsched(&attr,
+		  PTHREAD_EXPLICIT_SCHED);
+		(void)pthread_attr_setschedpolicy(&attr,SCHED_FIFO);
+		sp.sched_priority = rtPriority;
+		(void)pthread_attr_setschedparam(&attr,&sp);
+	}
+#ifdef __linux__
+	if(rtCpu >= 0)
+	{
+		cpu_set_t cpus;
+
+		CPU_ZERO(&cpus);
+		CPU_SET(rtCpu,&cpus);
+		(void)pthread_attr_setaffinity_np(&attr,sizeof(cpus),&cpus);
+	}
+#endif
+	/* Failure here is most often lack of privilege for SCHED_FIFO. */
+	if(pthread_create(thread,&attr,func,NULL)) status = TC_ERR_REALTIME;
+	pthread_attr_destroy(&attr);
+
+	return status;
+}
+
+/****************************************************************************
+ Function    : TCsetRealtime()
+ Description : Configures real-time output for library output threads
+               (frame interpolation and the frame mailbox) started after
+               this call: SCHED_FIFO scheduling at the given priority, an
+               optional CPU to run on, and the memory used in encoding and
+               output locked into RAM.  Applications that need steady
+               frame timing on a busy system should use this along with
+               TCsubmit(), so that the real-time thread does all output.
+               Normally requires root privileges (or CAP_SYS_NICE and a
+               sufficient RLIMIT_MEMLOCK); without them, starting the
+               thread fails with TC_ERR_REALTIME.
+ Parameters  : int  SCHED_FIFO priority, 1 (lowest) to 99, or 0 for normal
+                    scheduling (the default).
+               int  CPU number for output threads, or -1 for any (default).
+                    CPU affinity is supported on Linux only, and ignored
+                    elsewhere.
+ Returns     : TC_OK on success, TC_ERR_VALUE if invalid parameter received.
+ ****************************************************************************/
+TCstatusCode TCsetRealtime(
+  int priority,
+  int cpu)
+{
+	if((priority < 0) || (priority > sched_get_priority_max(SCHED_FIFO)) ||
+	   (cpu < -1) || (cpu >= sysconf(_SC_NPROCESSORS_CONF)))
+		return TC_ERR_VALUE;
+
+	rtPriority = priority;
+	rtCpu      = cpu;
+
+	return TC_OK;
+}
+
+/****************************************************************************
+ Function    : TCgetLatency()
+ Description : Returns wakeup latency statistics for the current (or most
+               recent) library output thread: the delay from when a frame
+               was due to be output -- its scheduled time with frame
+               interpolation, or its submission to an idle mailbox -- to
+               when the thread got to run.  The spread of these figures
+               is the timing jitter the scheduler adds.  Statistics are
+               reset when an output thread is started.
+ Parameters  : TClatencyStats *  Destination structure.
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCgetLatency(TClatencyStats *stats)
+{
+	double mean,var;
+
+	pthread_mutex_lock(&latencyLock);
+	*stats = latency;
+	if(latency.samples)
+	{
+		mean = latencySum / (double)latency.samples;
+		var  = latencySumSq / (double)latency.samples - mean * mean;
+		stats->usecAvg = mean;
+		stats->usecDev = (var > 0.0) ? sqrt(var) : 0.0;
+	}
+	pthread_mutex_unlock(&latencyLock);
+}
+
+/* Output-side frame interpolation.  The application hands over
+   keyframes at whatever rate it renders them (TCkeyframe()), and a
+   library thread refreshes the display at its own, generally higher,
+   rate, blending between the two most recent keyframes.  Three buffers
+   rotate: the older and newer keyframes being blended, and a spare that
+   the next keyframe is copied into.  The mutex is held only to swap
+   buffer roles and while the output thread encodes (never while it
+   writes to the device), so neither side waits on USB. */
+static pthread_t
+	interpThread;
+static pthread_mutex_t
+	interpLock = PTHREAD_MUTEX_INITIALIZER;
+static TCpixel
+	*keyBuf[3]  = { NULL, NULL, NULL };
+static int
+	keyOld,keyNew,keySpare,
+	keyCount    = 0,     /* Keyframes received so far (caps at 2) */
+	keyPixels   = 0,
+	interpGamma = 0,
+	*interpRemap;
+static volatile int
+	interpRunning = 0,
+	mbRunning     = 0;  /* Frame mailbox, below; one output thread
+	                       at a time */
+static unsigned long long
+	keyTimeOld,keyTimeNew,
+	interpPeriod;        /* Output interval in uS, 0 = max speed */
+static TCstats
+	*interpStats;
+
+static void *interpLoop(void *arg)
+{
+	frameSource        src;
+	unsigned long long now,next,span;
+
+	rtThreadInit();
+	for(next=usecNow();interpRunning;)
+	{
+		pthread_mutex_lock(&interpLock);
+		now = usecNow();
+		if(keyCount < 2)
+		{
+			/* Nothing to blend yet; show latest (or blank). */
+			src.type   = keyCount ? SOURCE_PIXELS : SOURCE_BLANK;
+			src.pixels = keyBuf[keyNew];
+		} else
+		{
+			/* Playback runs one keyframe interval behind the
+			   producer: the blend travels from the older to the
+			   newer keyframe over the same time that separated
+			   their arrival, arriving at the newer one just as
+			   the next is expected. */
+			src.type    = interpGamma ?
+			  SOURCE_BLEND_GAMMA : SOURCE_BLEND;
+			src.pixels  = keyBuf[keyOld];
+			src.pixels2 = keyBuf[keyNew];
+			span        = keyTimeNew - keyTimeOld;
+			src.alpha   = ((now - keyTimeNew) >= span) ? 256 :
+			  (unsigned short)((now - keyTimeNew) * 256 / span);
+		}
+		renderFrame(&src,interpRemap);
+		pthread_mutex_unlock(&interpLock);
+
+		(void)sendFrame(interpStats);
+
+		/* Schedule next output.  If the device can't keep up
+		   with the requested rate, don't try to catch up. */
+		if(interpPeriod)
+		{
+			next += interpPeriod;
+			now   = usecNow();
+			if(next > now)
+			{
+				usleep((useconds_t)(next - now));
+				now = usecNow();
+				latencySample((now > next) ?
+				  (unsigned long)(now - next) : 0);
+			} else
+			{
+				next = now;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/****************************************************************************
+ Function    : TCinterpStart()
+ Description : Starts frame interpolation.  A library thread takes over
+               refreshing the display at a fixed rate (or as fast as the
+               device allows), blending between the two most recent
+               keyframes passed to TCkeyframe().  Motion is smoothed at
+               the cost of one keyframe interval of added latency.  The
+               application must not call TCrefresh() or its variants
+               while interpolation is running.
+ Parameters  : double     Output frame rate in frames/second, or 0.0 to
+                          refresh as fast as the device permits.
+               int        Number of elements in each keyframe's TCpixel
+                          array, or 0 for one per pixel on all strands.
+               int *      Optional remapping table, as with TCrefresh().
+                          Must remain valid until TCinterpStop().
+               TCstats *  Optional statistics structure, updated from the
+                          output thread.  Must remain valid until
+                          TCinterpStop().
+               int        If nonzero, blend in linear light (after gamma
+                          correction) rather than between source colors.
+ Returns     : TC_OK on success, else various error codes from header.
+ ****************************************************************************/
+TCstatusCode TCinterpStart(
+  double   fps,
+  int      nPixels,
+  int     *remap,
+  TCstats *stats,
+  int      gammaAware)
+{
+	int i;
+
+	if(!pixelOutBuffer || interpRunning || mbRunning || (fps < 0.0) ||
+	   (nPixels < 0)) return TC_ERR_VALUE;
+
+	if(!nPixels) nPixels = nStrands * pixelsPerStrand;
+	if(!(keyBuf[0] = (TCpixel *)malloc(3 * nPixels * sizeof(TCpixel))))
+		return TC_ERR_MALLOC;
+	for(i=1;i<3;i++) keyBuf[i] = &keyBuf[0][i * nPixels];
+
+	keyOld       = 0;
+	keyNew       = 1;
+	keySpare     = 2;
+	keyCount     = 0;
+	keyPixels    = nPixels;
+	interpGamma  = gammaAware;
+	interpRemap  = remap;
+	interpStats  = stats;
+	interpPeriod = (fps > 0.0) ?
+	  (unsigned long long)(1000000.0 / fps + 0.5) : 0;
+
+	interpRunning = 1;
+	if(TC_OK != (i = startThread(&interpThread,interpLoop,keyBuf[0],
+	  3 * nPixels * sizeof(TCpixel))))
+	{
+		interpRunning = 0;
+		free(keyBuf[0]);
+		keyBuf[0] = NULL;
+		return i;
+	}
+
+	return TC_OK;
+}
+
+/****************************************************************************
+ Function    : TCkeyframe()
+ Description : Submits a new keyframe to the interpolator.  The pixel data
+               is copied and timestamped; the application may reuse its
+               array immediately.
+ Parameters  : TCpixel *  Image data, same size as given to TCinterpStart().
+ Returns     : TC_OK on success, TC_ERR_VALUE if interpolation not running.
+ ****************************************************************************/
+TCstatusCode TCkeyframe(TCpixel *pixels)
+{
+	int i;
+
+	if(!interpRunning || !pixels) return TC_ERR_VALUE;
+
+	/* The spare buffer is never touched by the output thread,
+	   so the copy needn't hold the lock. */
+	memcpy(keyBuf[keySpare],pixels,keyPixels * sizeof(TCpixel));
+
+	pthread_mutex_lock(&interpLock);
+	i          = keyOld;
+	keyOld     = keyNew;
+	keyNew     = keySpare;
+	keySpare   = i;
+	keyTimeOld = keyTimeNew;
+	keyTimeNew = usecNow();
+	if(keyCount < 2) keyCount++;
+	pthread_mutex_unlock(&interpLock);
+
+	return TC_OK;
+}
+
+/****************************************************************************
+ Function    : TCinterpStop()
+ Description : Stops frame interpolation and the associated output thread.
+               The display is left showing the last frame output.
+ Parameters  : None (void).
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCinterpStop(void)
+{
+	if(!interpRunning) return;
+
+	interpRunning = 0;
+	pthread_join(interpThread,NULL);
+	free(keyBuf[0]);
+	keyBuf[0] = NULL;
+}
+
+/* Frame mailbox.  TCsubmit() hands frames to a library output thread and
+   returns without waiting on the device.  Frames are copied into a small
+   pool of buffers: up to 'depth' waiting in the queue, plus one being
+   filled by the producer and one being encoded by the output thread, so
+   a lone producer always finds a free buffer.  The lock is held only to
+   move buffers between those roles, never while copying, encoding or
+   writing to the device.  Producers may also fill a pool buffer directly
+   (TCframeAcquire() and TCframeSubmit()), saving the copy.  Buffers start
+   on cache line boundaries, or the pool on a huge page boundary if it's
+   big enough to use them, and are touched when allocated so the first
+   frames don't take page faults. */
+#define FRAME_ALIGN     64                 /* Cache line               */
+#define FRAME_HUGE_PAGE (2 * 1024 * 1024)
+#define FRAME_STRIDE(n) \
+	(((n) + FRAME_ALIGN / sizeof(TCpixel) - 1) & \
+	 ~(FRAME_ALIGN / sizeof(TCpixel) - 1))
+
+static pthread_t
+	mbThread;
+static pthread_mutex_t
+	mbLock      = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t
+	mbReady     = PTHREAD_COND_INITIALIZER, /* Frame queued, or stopping */
+	mbSpace     = PTHREAD_COND_INITIALIZER; /* Buffer or queue slot free */
+static TCpixel
+	*mbBuf      = NULL;  /* All buffers, in one allocation          */
+static unsigned long long
+	*mbTime;             /* Submission time of each buffer          */
+static int
+	*mbQueue,            /* Queued buffer numbers, oldest at mbHead */
+	*mbFree,             /* Stack of unused buffer numbers          */
+	*mbLent,             /* Buffer taken by a producer, not queued  */
+	mbHead,
+	mbCount,             /* Number of frames queued                 */
+	mbDepth,
+	mbNFree,
+	mbPixels,
+	mbStride,            /* TCpixels from one buffer to the next    */
+	*mbRemap;
+static TCsubmitPolicy
+	mbPolicy;
+static TCstats
+	*mbStats;
+static TCsubmitStats
+	mbCounts;
+static double
+	mbWireSum;           /* Total of submit-to-sent times, uS       */
+
+static void *mailboxLoop(void *arg)
+{
+	frameSource        src;
+	int                b,idle;
+	unsigned long long submitted,usec;
+
+	rtThreadInit();
+	pthread_mutex_lock(&mbLock);
+	for(;;)
+	{
+		for(idle=0;!mbCount && mbRunning;idle=1)
+			pthread_cond_wait(&mbReady,&mbLock);
+		if(!mbCount) break;  /* Stopped, and queue is drained */
+
+		b         = mbQueue[mbHead];
+		submitted = mbTime[b];
+		if(idle) latencySample((unsigned long)(usecNow() - submitted));
+		mbHead    = (mbHead + 1) % mbDepth;
+		mbCount--;
+		pthread_cond_broadcast(&mbSpace);
+		pthread_mutex_unlock(&mbLock);
+
+		src.type   = SOURCE_PIXELS;
+		src.pixels = &mbBuf[b * mbStride];
+		renderFrame(&src,mbRemap);
+
+		/* Buffer is free once encoded; don't hold it over I/O. */
+		pthread_mutex_lock(&mbLock);
+		mbFree[mbNFree++] = b;
+		pthread_cond_broadcast(&mbSpace);
+		pthread_mutex_unlock(&mbLock);
+
+		(void)sendFrame(mbStats);
+		usec = usecNow() - submitted;
+
+		pthread_mutex_lock(&mbLock);
+		mbCounts.sent++;
+		mbWireSum += (double)usec;
+		if(usec > mbCounts.usecWireMax) mbCounts.usecWireMax = usec;
+		if(statsPage)
+		{
+			pageBegin();
+			statsPage->mailbox          = mbCounts;
+			statsPage->mailbox.usecWire =
+			  (unsigned long)(mbWireSum / mbCounts.sent + 0.5);
+			pageEnd();
+		}
+	}
+	pthread_mutex_unlock(&mbLock);
+
+	return NULL;
+}
+
+/****************************************************************************
+ Function    : TCsubmitStart()
+ Description : Starts the frame mailbox.  A library thread takes over
+               output, issuing frames passed to TCsubmit() as fast as the
+               device accepts them, so the application never waits on USB
+               I/O.  When frames arrive faster than they can be sent, the
+               policy decides what gives: TC_SUBMIT_LATEST keeps only the
+               newest unsent frame (so what's displayed is always as fresh
+               as possible), TC_SUBMIT_BLOCK queues frames and makes
+               TCsubmit() wait when the queue is full (every frame is
+               shown), and TC_SUBMIT_DROP_OLDEST queues frames and
+               discards the oldest when full.  The application must not
+               call TCrefresh() or its variants while the mailbox is
+               running, nor use frame interpolation.
+ Parameters  : TCsubmitPolicy  Policy for a full mailbox, as above.
+               int             Queue depth, 1 to 64 frames (ignored with
+                               TC_SUBMIT_LATEST, which holds one).
+               int             Number of elements in each frame's TCpixel
+                               array, or 0 for one per pixel on all strands.
+               int *           Optional remapping table, as with
+                               TCrefresh().  Must remain valid until
+                               TCsubmitStop().
+               TCstats *       Optional statistics structure, updated from
+                               the output thread.  Must remain valid until
+                               TCsubmitStop().
+ Returns     : TC_OK on success, else various error codes from header.
+ ****************************************************************************/
+TCstatusCode TCsubmitStart(
+  TCsubmitPolicy policy,
+  int            depth,
+  int            nPixels,
+  int           *remap,
+  TCstats       *stats)
+{
+	int          i,nBufs;
+	size_t       size,align;
+	TCstatusCode status;
+
+	if(!pixelOutBuffer || mbRunning || interpRunning || (nPixels < 0) ||
+	   (policy < TC_SUBMIT_LATEST) || (policy > TC_SUBMIT_DROP_OLDEST))
+		return TC_ERR_VALUE;
+	if(TC_SUBMIT_LATEST == policy) depth = 1;
+	else if((depth < 1) || (depth > 64)) return TC_ERR_VALUE;
+
+	if(!nPixels) nPixels = nStrands * pixelsPerStrand;
+	nBufs    = depth + 2;
+	mbStride = FRAME_STRIDE(nPixels);
+	size     = nBufs * (mbStride * sizeof(TCpixel) +
+	  sizeof(unsigned long long)) + (depth + 2 * nBufs) * sizeof(int);
+	align    = (size >= FRAME_HUGE_PAGE) ? FRAME_HUGE_PAGE : FRAME_ALIGN;
+	if(posix_memalign((void **)&mbBuf,align,size))
+	{
+		mbBuf = NULL;
+		return TC_ERR_MALLOC;
+	}
+#ifdef MADV_HUGEPAGE
+	if(align == FRAME_HUGE_PAGE)
+		(void)madvise(mbBuf,size & ~(FRAME_HUGE_PAGE - 1),
+		  MADV_HUGEPAGE);
+#endif
+	bzero(mbBuf,size);  /* Fault it all in now */
+	mbTime  = (unsigned long long *)&mbBuf[nBufs * mbStride];
+	mbQueue = (int *)&mbTime[nBufs];
+	mbFree  = &mbQueue[depth];
+	mbLent  = &mbFree[nBufs];
+	for(i=0;i<nBufs;i++) mbFree[i] = i;
+
+	mbNFree  = nBufs;
+	mbHead   = 0;
+	mbCount  = 0;
+	mbDepth  = depth;
+	mbPixels = nPixels;
+	mbPolicy = policy;
+	mbRemap  = remap;
+	mbStats  = stats;
+	bzero(&mbCounts,sizeof(mbCounts));
+	mbWireSum = 0.0;
+
+	mbRunning = 1;
+	if(TC_OK != (status = startThread(&mbThread,mailboxLoop,mbBuf,size)))
+	{
+		mbRunning = 0;
+		free(mbBuf);
+		mbBuf = NULL;
+		return status;
+	}
+
+	return TC_OK;
+}
+
+/* Takes a free buffer from the pool, waiting if there is none.  Only
+   concurrent producers (or one holding several acquired frames) can find
+   none, and then only until the output thread finishes encoding.
+   Returns the buffer number, or -1 if the mailbox stopped. */
+static int frameTake(void)
+{
+	int b = -1;
+
+	pthread_mutex_lock(&mbLock);
+	while(!mbNFree && mbRunning) pthread_cond_wait(&mbSpace,&mbLock);
+	if(mbRunning) mbLent[b = mbFree[--mbNFree]] = 1;
+	pthread_mutex_unlock(&mbLock);
+
+	return b;
+}
+
+/* Queues a filled buffer for output, making room per the policy if
+   needed.  A buffer not currently taken (e.g. submitted twice) is
+   refused rather than corrupting the queue. */
+static TCstatusCode frameQueue(int b)
+{
+	pthread_mutex_lock(&mbLock);
+	if(!mbLent[b])
+	{
+		pthread_mutex_unlock(&mbLock);
+		return TC_ERR_VALUE;
+	}
+	mbLent[b] = 0;
+	mbCounts.submitted++;
+	if(TC_SUBMIT_BLOCK == mbPolicy)
+	{
+		while((mbCount == mbDepth) && mbRunning)
+			pthread_cond_wait(&mbSpace,&mbLock);
+	} else if(mbCount == mbDepth)
+	{
+		mbFree[mbNFree++] = mbQueue[mbHead];
+		mbHead            = (mbHead + 1) % mbDepth;
+		mbCount--;
+		if(TC_SUBMIT_LATEST == mbPolicy) mbCounts.superseded++;
+		else                             mbCounts.dropped++;
+	}
+	if(mbCount == mbDepth)
+	{
+		/* Stopped while waiting; frame goes nowhere. */
+		mbFree[mbNFree++] = b;
+		mbCounts.dropped++;
+		pthread_mutex_unlock(&mbLock);
+		return TC_ERR_VALUE;
+	}
+	mbTime[b] = usecNow();
+	mbQueue[(mbHead + mbCount++) % mbDepth] = b;
+	TRACE_MARK(submit,mbCount);
+	pthread_cond_signal(&mbReady);
+	pthread_mutex_unlock(&mbLock);
+
+	return TC_OK;
+}
+
+/****************************************************************************
+ Function    : TCsubmit()
+ Description : Passes a frame to the mailbox for output.  The pixel data
+               is copied; the application may reuse its array immediately.
+               Returns without waiting for the frame to be sent, except
+               with TC_SUBMIT_BLOCK when the queue is full.  To avoid the
+               copy, see TCframeAcquire().
+ Parameters  : const TCpixel *  Image data, same size as given to
+                                TCsubmitStart().
+ Returns     : TC_OK on success, TC_ERR_VALUE if mailbox not running.
+ ****************************************************************************/
+TCstatusCode TCsubmit(const TCpixel *pixels)
+{
+	int b;
+
+	if(!mbRunning || !pixels || ((b = frameTake()) < 0))
+		return TC_ERR_VALUE;
+
+	memcpy(&mbBuf[b * mbStride],pixels,mbPixels * sizeof(TCpixel));
+
+	return frameQueue(b);
+}
+
+/****************************************************************************
+ Function    : TCframeAcquire()
+ Description : Lends the application a frame buffer from the mailbox's
+               pool, to draw the next frame into directly and then pass to
+               TCframeSubmit(), with no copy.  Buffers are aligned to a
+               cache line (64 bytes) at least, already paged in, and hold
+               the number of TCpixels given to TCsubmitStart(); contents
+               are whatever was last drawn in that buffer, not necessarily
+               the previous frame.  Normally there's a free buffer at once;
+               waits if other producers (or earlier unsubmitted acquires)
+               hold them all until the output thread frees one.
+ Parameters  : None (void).
+ Returns     : Frame buffer, or NULL if mailbox not running.
+ ****************************************************************************/
+TCpixel *TCframeAcquire(void)
+{
+	int b;
+
+	if(!mbRunning || ((b = frameTake()) < 0)) return NULL;
+
+	return &mbBuf[b * mbStride];
+}
+
+/****************************************************************************
+ Function    : TCframeSubmit()
+ Description : Passes a frame buffer from TCframeAcquire() to the mailbox
+               for output, as TCsubmit() does but without copying.  The
+               buffer belongs to the library from here on; the application
+               must not touch it again, and acquires another for the next
+               frame.  A buffer must be submitted before TCsubmitStop(),
+               which invalidates any still held.
+ Parameters  : TCpixel *  Buffer from TCframeAcquire().
+ Returns     : TC_OK on success, TC_ERR_VALUE if mailbox not running or
+               not a mailbox buffer.
+ ****************************************************************************/
+TCstatusCode TCframeSubmit(TCpixel *frame)
+{
+	size_t i;
+
+	if(!mbRunning || !frame || (frame < mbBuf)) return TC_ERR_VALUE;
+	i = frame - mbBuf;
+	if((i % mbStride) || (i / mbStride >= (size_t)(mbDepth + 2)))
+		return TC_ERR_VALUE;
+
+	return frameQueue((int)(i / mbStride));
+}
+
+/****************************************************************************
+ Function    : TCsubmitGetStats()
+ Description : Returns counts of frames submitted to, sent by, and
+               discarded by the mailbox since TCsubmitStart(), and the
+               time frames take from TCsubmit() to being sent.
+ Parameters  : TCsubmitStats *  Destination structure.
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCsubmitGetStats(TCsubmitStats *counts)
+{
+	pthread_mutex_lock(&mbLock);
+	*counts = mbCounts;
+	if(counts->sent)
+		counts->usecWire =
+		  (unsigned long)(mbWireSum / counts->sent + 0.5);
+	pthread_mutex_unlock(&mbLock);
+}
+
+/****************************************************************************
+ Function    : TCsubmitStop()
+ Description : Stops the mailbox and its output thread.  Frames still
+               queued are sent first, so the display is left showing the
+               last frame submitted (or, with TC_SUBMIT_LATEST, the most
+               recent one).  Must not be called while another thread is
+               in TCsubmit().
+ Parameters  : None (void).
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCsubmitStop(void)
+{
+	if(!mbRunning) return;
+
+	pthread_mutex_lock(&mbLock);
+	mbRunning = 0;
+	pthread_cond_broadcast(&mbReady);
+	pthread_cond_broadcast(&mbSpace);
+	pthread_mutex_unlock(&mbLock);
+	pthread_join(mbThread,NULL);
+	free(mbBuf);
+	mbBuf = NULL;
+}
+
+/* Flight recorder.  Keeps the last stretch of output -- each frame's
+   32-bit words exactly as encoded, in strand order -- in a ring of memory
+   allocated (and touched) up front, so a glitch in a show can be looked
+   at afterward.  Frames are stored as the pixels that changed from the
+   prior frame, or whole when that's smaller, with a whole frame at least
+   once a second so there's always a starting point not far behind the
+   oldest frame kept.  The encoder keeps its own copy of each frame's
+   words as it goes; comparing that with the last frame and appending the
+   difference is the cost per frame, one pass over the words with nothing
+   allocated.  The ring is written out as a show file on request.  Only
+   the output thread records, so a dump never holds it up: if a dump has
+   the ring, that frame goes unrecorded and the next one is kept whole. */
+#define RECORD_KEY_USEC 1000000  /* Whole frame at least this often */
+#define RECORD_BYTES    (16 * 1024 * 1024)
+
+typedef struct {
+	unsigned long long usec;   /* When the frame was encoded   */
+	uint32_t           type,   /* 'K' (whole frame) or 'D'     */
+	                   count;  /* Words, or index/word pairs   */
+} recordHead;
+
+static pthread_mutex_t
+	recordLock      = PTHREAD_MUTEX_INITIALIZER;
+static unsigned char
+	*recordRing     = NULL;
+static size_t
+	recordCap       = 0,
+	recordFirst     = 0,    /* Offset of oldest record      */
+	recordUsed      = 0;
+static uint32_t
+	*recordMem      = NULL, /* Frame and staging buffers    */
+	*recordPrev     = NULL, /* Prior frame's words          */
+	*recordDelta    = NULL; /* Staging for a delta record   */
+static int
+	recordPixels    = 0,
+	recordKey       = 1,    /* Set if next must be whole    */
+	recordPipe[2]   = { -1,-1 };
+static unsigned long long
+	recordWindow    = 0,    /* uS of output to dump         */
+	recordLastKey   = 0;
+static pthread_t
+	recordThread;
+static char
+	recordFile[256];        /* Dump filename for signals    */
+static struct sigaction
+	recordOldAction;
+static int
+	recordSignal    = 0;
+
+/* Copy into and out of the ring, wrapping around its end. */
+static void ringPut(
+  size_t      off,
+  const void *src,
+  size_t      len)
+{
+	size_t n = recordCap - off;
+
+	if(n >= len)
+	{
+		memcpy(&recordRing[off],src,len);
+	} else
+	{
+		memcpy(&recordRing[off],src,n);
+		memcpy(recordRing,(const unsigned char *)src + n,len - n);
+	}
+}
+
+static void ringGet(
+  size_t  off,
+  void   *dst,
+  size_t  len)
+{
+	size_t n = recordCap - off;
+
+	if(n >= len)
+	{
+		memcpy(dst,&recordRing[off],len);
+	} else
+	{
+		memcpy(dst,&recordRing[off],n);
+		memcpy((unsigned char *)dst + n,recordRing,len - n);
+	}
+}
+
+/* Size of a record, given its header. */
+static size_t recordSize(const recordHead *h)
+{
+	return sizeof(recordHead) + h->count * (('K' == h->type) ? 4 : 8);
+}
+
+/* Appends the frame just encoded (recordWords) to the ring.  Called by
+   renderFrame() while recording. */
+static void recordFrame(void)
+{
+	recordHead     h;
+	uint32_t      *cur = recordWords;
+	const void    *data;
+	size_t         len,off;
+	int            i,n = -1;
+
+	if(pthread_mutex_trylock(&recordLock))
+	{
+		recordKey = 1;  /* Being dumped; skip, and restart whole */
+		return;
+	}
+
+	h.usec = usecNow();
+	if(!recordKey && (h.usec - recordLastKey < RECORD_KEY_USEC))
+	{
+		/* Delta list, unless it would be the larger */
+		for(n=i=0;i<recordPixels;i++)
+		{
+			if(cur[i] != recordPrev[i])
+			{
+				if(++n > recordPixels / 2) break;
+				recordDelta[n * 2 - 2] = i;
+				recordDelta[n * 2 - 1] = cur[i];
+			}
+		}
+		if(i < recordPixels) n = -1;
+	}
+	if(n < 0)
+	{
+		h.type        = 'K';
+		h.count       = recordPixels;
+		data          = cur;
+		recordLastKey = h.usec;
+		recordKey     = 0;
+	} else
+	{
+		h.type        = 'D';
+		h.count       = n;
+		data          = recordDelta;
+	}
+	len = recordSize(&h);
+
+	/* Make room, oldest records first */
+	while(recordUsed + len > recordCap)
+	{
+		recordHead old;
+
+		ringGet(recordFirst,&old,sizeof(old));
+		recordFirst  = (recordFirst + recordSize(&old)) % recordCap;
+		recordUsed  -= recordSize(&old);
+	}
+	off = (recordFirst + recordUsed) % recordCap;
+	ringPut(off,&h,sizeof(h));
+	ringPut((off + sizeof(h)) % recordCap,data,len - sizeof(h));
+	recordUsed += len;
+	pthread_mutex_unlock(&recordLock);
+
+	/* This frame is now the prior one; the next is encoded into the
+	   old prior frame's space. */
+	recordWords = recordPrev;
+	recordPrev  = cur;
+}
+
+/* Writes the ring to a show file.  Call with recordLock held. */
+static TCstatusCode recordWrite(const char *filename)
+{
+	recordHead          h;
+	TCshow             *show;
+	uint32_t           *words,pair[2],w;
+	TCpixel            *pixels;
+	size_t              off,done,start;
+	unsigned long long  newest = 0,first = 0;
+	int                 i,written = 0;
+	TCstatusCode        status = TC_OK;
+
+	if(!recordUsed) return TC_ERR_VALUE;
+
+	/* Newest frame, then the last whole frame at or before the start
+	   of the window (or failing that, the first one kept). */
+	for(off=recordFirst,done=0;done<recordUsed;done+=recordSize(&h))
+	{
+		ringGet(off,&h,sizeof(h));
+		newest = h.usec;
+		off    = (off + recordSize(&h)) % recordCap;
+	}
+	start = recordCap;
+	for(off=recordFirst,done=0;done<recordUsed;done+=recordSize(&h))
+	{
+		ringGet(off,&h,sizeof(h));
+		if(('K' == h.type) && ((start == recordCap) ||
+		   (h.usec + recordWindow <= newest))) start = off;
+		off = (off + recordSize(&h)) % recordCap;
+	}
+	if(start == recordCap) return TC_ERR_VALUE;
+
+	if(!(words = (uint32_t *)malloc(recordPixels *
+	  (sizeof(uint32_t) + sizeof(TCpixel))))) return TC_ERR_MALLOC;
+	pixels = (TCpixel *)&words[recordPixels];
+	if(!(show = TCshowCreateOutput(filename,openStrands,recordPixels)))
+	{
+		free(words);
+		return TC_ERR_FILE;
+	}
+
+	/* Rebuild each frame from the starting point, writing those in the
+	   window.  Words go back to (post-gamma) colors; played back with
+	   gamma disabled, the same words are issued. */
+	done = (start + recordCap - recordFirst) % recordCap;
+	for(off=start;(done<recordUsed) && (TC_OK == status);)
+	{
+		ringGet(off,&h,sizeof(h));
+		off = (off + sizeof(h)) % recordCap;
+		if('K' == h.type)
+		{
+			ringGet(off,words,h.count * 4);
+		} else
+		{
+			for(i=0;i<h.count;i++)
+			{
+				ringGet((off + i * 8) % recordCap,pair,8);
+				words[pair[0]] = pair[1];
+			}
+		}
+		off   = (off + recordSize(&h) - sizeof(h)) % recordCap;
+		done += recordSize(&h);
+
+		if(h.usec + recordWindow < newest) continue;
+		if(!written++) first = h.usec;
+		for(i=0;i<recordPixels;i++)
+		{
+			w         = words[i];
+			pixels[i] = TCrgb(w & 0xff,(w >> 8) & 0xff,
+			  (w >> 16) & 0xff);
+		}
+		status = TCshowWrite(show,pixels,h.usec - first);
+	}
+
+	if((TC_OK != TCshowClose(show)) && (TC_OK == status))
+		status = TC_ERR_FILE;
+	free(words);
+
+	return status;
+}
+
+/* Dumps for a signal: the handler just writes a byte to a pipe, and this
+   thread, waiting on the other end, does the work. */
+static void recordHandler(int sig)
+{
+	char c = 0;
+
+	(void)write(recordPipe[1],&c,1);
+}
+
+static void *recordSignalLoop(void *arg)
+{
+	char       c,name[256];
+	time_t     t;
+	struct tm  tm;
+
+	while(read(recordPipe[0],&c,1) == 1)
+	{
+		/* Filename may carry strftime() fields, so each dump can
+		   have its own */
+		t = time(NULL);
+		if(!strftime(name,sizeof(name),recordFile,localtime_r(&t,&tm)))
+			continue;
+		(void)TCrecordDump(name);
+	}
+
+	return NULL;
+}
+
+/****************************************************************************
+ Function    : TCrecordStart()
+ Description : Starts the flight recorder: keeps a record of the frames
+               issued over the last so many seconds, for writing to a show
+               file with TCrecordDump() (or on a signal, with
+               TCrecordSignal()).  Frames are recorded as issued to the
+               strands -- after remapping, gamma, correction and current
+               limiting -- from every output path.  Memory is allocated
+               here and not thereafter.  Stopped by TCrecordStop() or
+               TCclose().
+ Parameters  : double         Seconds of output to keep.
+               unsigned long  Bytes of memory for the record, or 0 for the
+                              default (16 MB).  Changing frames take more
+                              room than static ones; if the space runs out
+                              first, less than the full time is kept.
+ Returns     : TC_OK on success, TC_ERR_VALUE if not open, output threads
+               (frame interpolation or the mailbox) are running, invalid
+               parameter or too little memory for two whole frames,
+               TC_ERR_MALLOC on malloc() failure.
+ ****************************************************************************/
+TCstatusCode TCrecordStart(
+  double        seconds,
+  unsigned long bytes)
+{
+	int n;
+
+	if(!pixelOutBuffer || interpRunning || mbRunning || (seconds <= 0.0))
+		return TC_ERR_VALUE;
+	TCrecordStop();
+
+	n = nStrands * pixelsPerStrand;
+	if(!bytes) bytes = RECORD_BYTES;
+	if(bytes < 2 * (sizeof(recordHead) + n * 4)) return TC_ERR_VALUE;
+
+	/* Two frames, plus a delta of up to half a frame's pixels at two
+	   words each */
+	if(!(recordMem = (uint32_t *)malloc(n * 3 * sizeof(uint32_t))))
+		return TC_ERR_MALLOC;
+	if(!(recordRing = (unsigned char *)malloc(bytes)))
+	{
+		free(recordMem);
+		recordMem = NULL;
+		return TC_ERR_MALLOC;
+	}
+	/* Touch it all now, rather than fault pages in while recording */
+	bzero(recordRing,bytes);
+	bzero(recordMem,n * 3 * sizeof(uint32_t));
+	recordPrev    = recordMem;
+	recordDelta   = &recordMem[n * 2];
+	recordCap     = bytes;
+	recordFirst   = 0;
+	recordUsed    = 0;
+	recordPixels  = n;
+	recordKey     = 1;
+	recordWindow  = (unsigned long long)(seconds * 1000000.0);
+	recordWords   = &recordMem[n];  /* Encoder writes here */
+
+	return TC_OK;
+}
+
+/****************************************************************************
+ Function    : TCrecordDump()
+ Description : Writes the flight recorder's contents -- the frames issued
+               over the time given to TCrecordStart(), with their times --
+               to a show file (see TCshowCreateOutput()).  Recording
+               continues; output is not held up while the file is written
+               (a frame issued meanwhile goes unrecorded).  May be called
+               from any thread.
+ Parameters  : const char *  Filename.
+ Returns     : TC_OK on success, TC_ERR_VALUE if not recording or nothing
+               recorded yet, TC_ERR_FILE on file error, TC_ERR_MALLOC on
+               malloc() failure.
+ ****************************************************************************/
+TCstatusCode TCrecordDump(const char *filename)
+{
+	TCstatusCode status = TC_ERR_VALUE;
+
+	pthread_mutex_lock(&recordLock);
+	if(recordRing && filename) status = recordWrite(filename);
+	pthread_mutex_unlock(&recordLock);
+
+	return status;
+}
+
+/****************************************************************************
+ Function    : TCrecordSignal()
+ Description : Has the flight recorder dump (see TCrecordDump()) whenever
+               the process receives the given signal, e.g. SIGUSR1, so a
+               glitch can be captured with "kill -USR1" without the
+               application's involvement.  The dump is done by a thread of
+               its own, not in the signal handler.  Lasts until
+               TCrecordStop(), which restores the signal's prior handling.
+ Parameters  : int           Signal number.
+               const char *  Filename for dumps.  May include strftime()
+                             fields (e.g. "flight-%H%M%S.tcs"), so each dump
+                             can have a file of its own.
+ Returns     : TC_OK on success, TC_ERR_VALUE if not recording, already
+               set, or invalid parameter, TC_ERR_MALLOC if the thread
+               could not be started.
+ ****************************************************************************/
+TCstatusCode TCrecordSignal(
+  int         sig,
+  const char *filename)
+{
+	struct sigaction sa;
+
+	if(!recordRing || recordSignal || (sig < 1) || !filename ||
+	   (strlen(filename) >= sizeof(recordFile))) return TC_ERR_VALUE;
+
+	strcpy(recordFile,filename);
+	if(pipe(recordPipe)) return TC_ERR_MALLOC;
+	if(pthread_create(&recordThread,NULL,recordSignalLoop,NULL))
+	{
+		close(recordPipe[0]);
+		close(recordPipe[1]);
+		recordPipe[0] = recordPipe[1] = -1;
+		return TC_ERR_MALLOC;
+	}
+
+	bzero(&sa,sizeof(sa));
+	sa.sa_handler = recordHandler;
+	sa.sa_flags   = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	(void)sigaction(sig,&sa,&recordOldAction);
+	recordSignal = sig;
+
+	return TC_OK;
+}
+
+/****************************************************************************
+ Function    : TCrecordStop()
+ Description : Stops the flight recorder and frees its memory.  Anything
+               not dumped is lost.  Not to be called while output threads
+               are running; TCclose() stops those first and calls this
+               itself.
+ Parameters  : None (void).
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCrecordStop(void)
+{
+	if(interpRunning || mbRunning) return;
+
+	if(recordSignal)
+	{
+		(void)sigaction(recordSignal,&recordOldAction,NULL);
+		recordSignal = 0;
+		close(recordPipe[1]);  /* Ends the thread's read */
+		pthread_join(recordThread,NULL);
+		close(recordPipe[0]);
+		recordPipe[0] = recordPipe[1] = -1;
+	}
+
+	pthread_mutex_lock(&recordLock);
+	recordWords = NULL;
+	if(recordRing)
+	{
+		free(recordRing);
+		free(recordMem);
+		recordRing = NULL;
+		recordMem  = recordPrev = recordDelta = NULL;
+	}
+	recordCap  = recordUsed = 0;
+	pthread_mutex_unlock(&recordLock);
+}
+
+/* Synchronized playback.  Displays driven by separate processes, on one
+   machine or several, are kept in step by a shared frame timeline: frame
+   N is presented (its latch completes) at epoch + N * period on the
+   leader's clock.  Each follower estimates the leader's clock from
+   NTP-style exchanges over UDP (request stamped t1 locally, received t2
+   and answered t3 by the leader, reply received t4): the offset sample
+   is ((t2 - t1) + (t3 - t4)) / 2, good to within half the difference
+   between the two network paths.  Samples taking much longer than the
+   quickest are discarded, and the rest steer an offset-and-drift
+   estimate of the leader's clock (a simple phase/frequency loop), so
+   one late packet doesn't jerk the timeline.  TCrefreshAt() then starts
+   each write early by the recent write duration, so the latch lands on
+   time.  Clocks are monotonic where available, immune to NTP steps. */
+#define SYNC_MAGIC     0x54435359  /* 'TCSY'                              */
+#define SYNC_REQUEST   1
+#define SYNC_REPLY     2
+#define SYNC_WORDS     7           /* 64-bit words per packet             */
+#define SYNC_FAST      8           /* Exchanges at the fast rate at start */
+#define SYNC_SPIN      200         /* Spin, not sleep, this close (uS)    */
+/* First word of a packet: magic number and type */
+#define SYNC_HEAD(T)   (((unsigned long long)SYNC_MAGIC << 32) | (T))
+
+static pthread_t
+	syncThread;
+static pthread_mutex_t
+	syncLock       = PTHREAD_MUTEX_INITIALIZER;
+static volatile int
+	syncRunning    = 0;
+static int
+	syncSocket     = -1;
+static struct sockaddr_in
+	syncPeer;
+static double
+	syncEpoch,           /* Leader time of frame 0, uS            */
+	syncPeriod,          /* uS per frame                          */
+	syncOffset,          /* Leader minus local clock at syncRef   */
+	syncSkew,            /* Drift of leader relative to local     */
+	syncRef,             /* Local time of the offset estimate     */
+	syncMinDelay,        /* Quickest round trip seen              */
+	syncErrSq,           /* Smoothed squared clock error          */
+	syncPresentSum,      /* Total |presentation error|, uS        */
+	writeUsec      = 0;  /* Recent write duration, for TCrefreshAt() */
+static TCsyncStats
+	syncStats;
+
+/* Monotonic time in microseconds, for scheduling; not comparable across
+   machines (the sync offset takes care of that). */
+static double usecMono(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return (double)t.tv_sec * 1000000.0 + (double)t.tv_nsec / 1000.0;
+#else
+	return (double)usecNow();
+#endif
+}
+
+/* Sleeps until the given usecMono() time. */
+static void syncSleep(double until)
+{
+#if defined(CLOCK_MONOTONIC) && defined(TIMER_ABSTIME)
+	struct timespec t;
+
+	t.tv_sec  = (time_t)(until / 1000000.0);
+	t.tv_nsec = (long)((until - (double)t.tv_sec * 1000000.0) * 1000.0);
+	if(t.tv_nsec < 0) t.tv_nsec = 0;
+	while(clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&t,NULL) == EINTR);
+#else
+	double now = usecMono();
+
+	if(until > now) usleep((useconds_t)(until - now));
+#endif
+}
+
+/* Packet fields are 64-bit big-endian words, so mixed machines agree. */
+static void syncPut(
+  unsigned char      *p,
+  unsigned long long  v)
+{
+	int i;
+
+	for(i=7;i>=0;i--,v>>=8) p[i] = (unsigned char)v;
+}
+
+static unsigned long long syncGet(const unsigned char *p)
+{
+	unsigned long long v = 0;
+	int                i;
+
+	for(i=0;i<8;i++) v = (v << 8) | p[i];
+	return v;
+}
+
+/* Local time corresponding to a time on the leader's clock.  Caller
+   holds syncLock. */
+static double syncToLocal(double leader)
+{
+	return (leader - syncOffset + syncSkew * syncRef) / (1.0 + syncSkew);
+}
+
+/* Leader: answers clock requests with its receive and transmit times and
+   the timeline.  Stateless, so any number of followers can ask. */
+static void *syncLeaderLoop(void *arg)
+{
+	unsigned char      pkt[SYNC_WORDS * 8];
+	struct sockaddr_in from;
+	socklen_t          fromLen;
+	double             t2;
+
+	while(syncRunning)
+	{
+		fromLen = sizeof(from);
+		if((recvfrom(syncSocket,pkt,sizeof(pkt),0,
+		   (struct sockaddr *)&from,&fromLen) != sizeof(pkt)) ||
+		   (syncGet(pkt) != SYNC_HEAD(SYNC_REQUEST))) continue;
+		t2 = usecMono();
+
+		syncPut(&pkt[0],SYNC_HEAD(SYNC_REPLY));
+		syncPut(&pkt[24],(unsigned long long)(t2 * 1000.0));
+		syncPut(&pkt[40],(unsigned long long)(syncEpoch * 1000.0));
+		syncPut(&pkt[48],(unsigned long long)(syncPeriod * 1000.0));
+		syncPut(&pkt[32],(unsigned long long)(usecMono() * 1000.0));
+		(void)sendto(syncSocket,pkt,sizeof(pkt),0,
+		  (struct sockaddr *)&from,fromLen);
+
+		pthread_mutex_lock(&syncLock);
+		syncStats.samples++;
+		pthread_mutex_unlock(&syncLock);
+	}
+
+	return NULL;
+}
+
+/* Folds one clock sample into the estimate. */
+static void syncSample(
+  double offset,  /* Sampled leader-minus-local offset */
+  double delay,   /* Round trip, less leader's turnaround */
+  double t)       /* Local time of sample */
+{
+	double predicted,err;
+
+	pthread_mutex_lock(&syncLock);
+	syncStats.usecDelay = delay;
+	if(!syncStats.locked)
+	{
+		syncOffset   = offset;
+		syncSkew     = 0.0;
+		syncRef      = t;
+		syncMinDelay = delay;
+		syncErrSq    = 0.0;
+		syncStats.locked = 1;
+	} else
+	{
+		/* Quickest delay seen, let rise slowly in case routes change */
+		if(delay < syncMinDelay) syncMinDelay = delay;
+		else syncMinDelay += (delay - syncMinDelay) / 1024.0;
+
+		if(delay > 2.0 * syncMinDelay + 200.0)
+		{
+			syncStats.rejected++;
+			pthread_mutex_unlock(&syncLock);
+			return;
+		}
+
+		predicted = syncOffset + syncSkew * (t - syncRef);
+		err       = offset - predicted;
+		if(t > syncRef) syncSkew += err / (t - syncRef) / 32.0;
+		if(syncSkew >  0.0005) syncSkew =  0.0005;  /* +/- 500 ppm */
+		if(syncSkew < -0.0005) syncSkew = -0.0005;
+		syncOffset = predicted + err / 4.0;
+		syncRef    = t;
+		syncErrSq += (err * err - syncErrSq) / 16.0;
+	}
+	syncStats.samples++;
+	syncStats.usecOffset = syncOffset;
+	syncStats.ppmDrift   = syncSkew * 1000000.0;
+	syncStats.usecJitter = sqrt(syncErrSq);
+	pthread_mutex_unlock(&syncLock);
+}
+
+/* Follower: exchanges times with the leader, quickly at first to lock
+   on, then ten times a second. */
+static void *syncFollowLoop(void *arg)
+{
+	unsigned char      pkt[SYNC_WORDS * 8];
+	unsigned long long seq = 0;
+	double             t1,t2,t3,t4,next;
+	int                n = 0;
+
+	for(next=usecMono();syncRunning;)
+	{
+		bzero(pkt,sizeof(pkt));
+		syncPut(&pkt[0],SYNC_HEAD(SYNC_REQUEST));
+		syncPut(&pkt[8],++seq);
+		t1 = usecMono();
+		syncPut(&pkt[16],(unsigned long long)(t1 * 1000.0));
+		if(sendto(syncSocket,pkt,sizeof(pkt),0,
+		   (struct sockaddr *)&syncPeer,sizeof(syncPeer)) ==
+		   sizeof(pkt))
+		{
+			/* Wait for the matching reply (socket times out). */
+			while(syncRunning &&
+			  (recv(syncSocket,pkt,sizeof(pkt),0) == sizeof(pkt)))
+			{
+				t4 = usecMono();
+				if((syncGet(pkt) != SYNC_HEAD(SYNC_REPLY)) ||
+				   (syncGet(&pkt[8]) != seq)) continue;
+				t2 = (double)syncGet(&pkt[24]) / 1000.0;
+				t3 = (double)syncGet(&pkt[32]) / 1000.0;
+				pthread_mutex_lock(&syncLock);
+				syncEpoch  = (double)syncGet(&pkt[40]) / 1000.0;
+				syncPeriod = (double)syncGet(&pkt[48]) / 1000.0;
+				pthread_mutex_unlock(&syncLock);
+				syncSample(((t2 - t1) + (t3 - t4)) / 2.0,
+				  (t4 - t1) - (t3 - t2),t4);
+				n++;
+				break;
+			}
+		}
+
+		next += (n < SYNC_FAST) ? 20000.0 : 100000.0;
+		if((t4 = usecMono()) < next) usleep((useconds_t)(next - t4));
+		else next = t4;
+	}
+
+	return NULL;
+}
+
+/* Opens the UDP socket, with a receive timeout so threads notice when
+   they're stopped. */
+static TCstatusCode syncOpen(int port)
+{
+	struct sockaddr_in addr;
+	struct timeval     tv;
+
+	if((syncSocket = socket(AF_INET,SOCK_DGRAM,0)) < 0) return TC_ERR_OPEN;
+	tv.tv_sec  = 0;
+	tv.tv_usec = 200000;
+	bzero(&addr,sizeof(addr));
+	addr.sin_family      = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port        = htons(port);
+	if(setsockopt(syncSocket,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv)) ||
+	   bind(syncSocket,(struct sockaddr *)&addr,sizeof(addr)))
+	{
+		close(syncSocket);
+		syncSocket = -1;
+		return TC_ERR_OPEN;
+	}
+
+	return TC_OK;
+}
+
+static TCstatusCode syncStart(void *(*func)(void *))
+{
+	syncRunning = 1;
+	if(pthread_create(&syncThread,NULL,func,NULL))
+	{
+		syncRunning = 0;
+		close(syncSocket);
+		syncSocket = -1;
+		return TC_ERR_MALLOC;
+	}
+
+	return TC_OK;
+}
+
+/****************************************************************************
+ Function    : TCsyncLeader()
+ Description : Makes this process the sync leader: sets the frame timeline
+               (frame 0 is now; frames follow at the given rate) and
+               serves its clock to followers (see TCsyncFollow()).  The
+               leader presents frames with TCrefreshAt() just as the
+               followers do.  TCopen() is not required.
+ Parameters  : int     UDP port to serve on.
+               double  Frame rate of the timeline.
+ Returns     : TC_OK on success, TC_ERR_VALUE if invalid parameter or sync
+               already running, TC_ERR_OPEN if the port could not be
+               opened, TC_ERR_MALLOC if the thread could not be started.
+ ****************************************************************************/
+TCstatusCode TCsyncLeader(
+  int    port,
+  double fps)
+{
+	TCstatusCode status;
+
+	if(syncRunning || (port < 1) || (port > 65535) || (fps <= 0.0))
+		return TC_ERR_VALUE;
+	if(TC_OK != (status = syncOpen(port))) return status;
+
+	bzero(&syncStats,sizeof(syncStats));
+	syncStats.leader = 1;
+	syncStats.locked = 1;
+	syncEpoch        = usecMono();
+	syncPeriod       = 1000000.0 / fps;
+	syncOffset       = 0.0;
+	syncSkew         = 0.0;
+	syncRef          = 0.0;
+	syncPresentSum   = 0.0;
+
+	return syncStart(syncLeaderLoop);
+}
+
+/****************************************************************************
+ Function    : TCsyncFollow()
+ Description : Makes this process a sync follower, tracking the clock and
+               frame timeline of the leader at the given address.  Frame
+               numbers (TCsyncFrame()) are available once locked on, after
+               the first exchange; the clock estimate settles over the
+               next second or so.  TCopen() is not required.
+ Parameters  : const char *  Leader's host name or IPv4 address.
+               int           Leader's UDP port.
+ Returns     : TC_OK on success, TC_ERR_VALUE if invalid parameter or sync
+               already running, TC_ERR_OPEN if the address could not be
+               resolved or a socket opened, TC_ERR_MALLOC if the thread
+               could not be started.
+ ****************************************************************************/
+TCstatusCode TCsyncFollow(
+  const char *host,
+  int         port)
+{
+	struct addrinfo hints,*res;
+	TCstatusCode    status;
+
+	if(syncRunning || !host || (port < 1) || (port > 65535))
+		return TC_ERR_VALUE;
+
+	bzero(&hints,sizeof(hints));
+	hints.ai_family   = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	if(getaddrinfo(host,NULL,&hints,&res)) return TC_ERR_OPEN;
+	memcpy(&syncPeer,res->ai_addr,sizeof(syncPeer));
+	syncPeer.sin_port = htons(port);
+	freeaddrinfo(res);
+
+	if(TC_OK != (status = syncOpen(0))) return status;
+
+	bzero(&syncStats,sizeof(syncStats));
+	syncPresentSum = 0.0;
+
+	return syncStart(syncFollowLoop);
+}
+
+/****************************************************************************
+ Function    : TCsyncFrame()
+ Description : Returns the number of the next frame due on the shared
+               timeline: the first whose presentation time is still
+               ahead.  Render this frame and pass it to TCrefreshAt().
+ Parameters  : None (void).
+ Returns     : Frame number, or -1 if sync isn't running or a follower
+               hasn't locked on yet.
+ ****************************************************************************/
+long TCsyncFrame(void)
+{
+	double leader;
+	long   frame = -1;
+
+	pthread_mutex_lock(&syncLock);
+	if(syncRunning && syncStats.locked)
+	{
+		leader = usecMono();
+		leader += syncOffset + syncSkew * (leader - syncRef);
+		frame  = (leader < syncEpoch) ? 0 :
+		  (long)((leader - syncEpoch) / syncPeriod) + 1;
+	}
+	pthread_mutex_unlock(&syncLock);
+
+	return frame;
+}
+
+/****************************************************************************
+ Function    : TCrefreshAt()
+ Description : Same as TCrefresh(), but the frame is presented at its time
+               on the shared timeline (see TCsyncLeader() and
+               TCsyncFollow()).  The image is encoded immediately, then
+               the write started early by the time recent writes have
+               taken, so that the frame latches as near its time as
+               possible.  Waits accordingly; if the time has already
+               passed, writes at once and counts the frame late.  If a
+               follower hasn't locked on yet, writes at once.
+ Parameters  : TCpixel *  Image data, as with TCrefresh().
+               int *      Optional remapping table, as TCrefresh().
+               TCstats *  Optional pointer to statistics structure.
+               long       Frame number, normally from TCsyncFrame().
+ Returns     : TC_OK on success, TC_ERR_VALUE if sync is not running,
+               TC_ERR_WRITE on I/O error.
+ ****************************************************************************/
+TCstatusCode TCrefreshAt(
+  TCpixel *pixelInBuffer,
+  int     *remap,
+  TCstats *stats,
+  long     frame)
+{
+	frameSource  src;
+	double       due,start,now,err;
+	int          locked,late = 0;
+	TCstatusCode status;
+
+	if(!syncRunning || (frame < 0)) return TC_ERR_VALUE;
+
+	src.type   = pixelInBuffer ? SOURCE_PIXELS : SOURCE_BLANK;
+	src.pixels = pixelInBuffer;
+	renderFrame(&src,remap);
+
+	pthread_mutex_lock(&syncLock);
+	if((locked = syncStats.locked))
+		due = syncToLocal(syncEpoch + (double)frame * syncPeriod);
+	pthread_mutex_unlock(&syncLock);
+
+	/* Sleep most of the way, then spin the rest: a wakeup can come a
+	   little late, never early. */
+	if(locked)
+	{
+		TRACE_BEGIN(sync_wait,frame);
+		start = due - writeUsec;
+		if((late = (usecMono() > start)) == 0)
+		{
+			syncSleep(start - SYNC_SPIN);
+			while(usecMono() < start);
+		}
+		TRACE_END(sync_wait,frame);
+	}
+
+	start  = usecMono();
+	status = sendFrame(stats);
+	now    = usecMono();
+	writeUsec += ((now - start) - writeUsec) / 8.0;
+
+	if(locked)
+	{
+		err = now - due;
+		pthread_mutex_lock(&syncLock);
+		syncStats.frames++;
+		if(late) syncStats.framesLate++;
+		if(err < 0.0) err = -err;
+		syncPresentSum += err;
+		syncStats.usecPresentAvg = syncPresentSum / syncStats.frames;
+		if(err > syncStats.usecPresentMax)
+			syncStats.usecPresentMax = err;
+		pthread_mutex_unlock(&syncLock);
+	}
+
+	return status;
+}
+
+/****************************************************************************
+ Function    : TCsyncGetStats()
+ Description : Returns the state of the sync clock and presentation
+               timing: the follower's estimate of the leader's clock
+               (offset and drift), the round trip of the latest exchange,
+               the typical error of the estimate at each exchange, and
+               how closely TCrefreshAt() has hit its frame times.
+ Parameters  : TCsyncStats *  Destination structure.
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCsyncGetStats(TCsyncStats *stats)
+{
+	pthread_mutex_lock(&syncLock);
+	*stats = syncStats;
+	pthread_mutex_unlock(&syncLock);
+}
+
+/****************************************************************************
+ Function    : TCsyncStop()
+ Description : Stops the sync leader or follower.  Followers lose track of
+               a stopped leader's clock and keep running on their last
+               estimate.
+ Parameters  : None (void).
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCsyncStop(void)
+{
+	if(!syncRunning) return;
+
+	syncRunning = 0;
+	pthread_join(syncThread,NULL);
+	close(syncSocket);
+	syncSocket = -1;
+	pthread_mutex_lock(&syncLock);
+	syncStats.locked = 0;
+	pthread_mutex_unlock(&syncLock);
 }
 
 /****************************************************************************
@@ -646,24 +4036,115 @@ TCstatusCode TCsetStrandPin(
 	   nStrands.  TCopen() may not have been called yet, so nStrands
 	   is unknown.  This function is best used before TCopen() so
 	   that initial latch and screen-clearing functions work. */
+	paramBlock *pb;
+
 	if((strand < 0) || (strand > 7) || !bit) return TC_ERR_VALUE;
+	if(!(pb = paramsBegin())) return TC_ERR_MALLOC;
 
-	strandBitMask[strand] = bit;
+	/* If the clock pin (strand 7) changes while open with a bitbang
+	   clock, the next frame rendered re-renders the latch too. */
+	pb->strandBitMask[strand] = bit;
+	paramsCommit(pb);
 
-	/* If using bitbang clock mode, and strand 7 (clock line) is
-	   requested, and pixelOutBuffer was previously allocated by
-	   TCopen(), re-render the clock bits for the latch signal at
-	   the end of the buffer. */
-	if((bytesPerPixel == 64) && (strand == 7) && pixelOutBuffer)
-	{
-		int i,latchOffset,latchLen;
+	return TC_OK;
+}
+
+/****************************************************************************
+ Function    : TCgetStrandPin()
+ Description : Returns the FTDI pin(s) currently assigned to a strand, as
+               set by TCsetStrandPin() (or the library defaults).
+ Parameters  : int  Strand number (0-7).
+ Returns     : Pin bitmask, or 0 if invalid strand number.
+ ****************************************************************************/
+unsigned char TCgetStrandPin(int strand)
+{
+	unsigned char bit;
 
-		latchOffset = bytesPerPixel * pixelsPerStrand;
-		latchLen    = bytesPerPixel * ((pixelsPerStrand + 63) / 64);
+	if((strand < 0) || (strand > 7)) return 0;
 
-		for(i=1;i<latchLen;i+=2)
-			pixelOutBuffer[latchOffset + i] = bit;
-	}
+	bit = paramsAcquire()->strandBitMask[strand];
+	paramsRelease();
+
+	return bit;
+}
+
+/****************************************************************************
+ Function    : TCsetMpsseClock()
+ Description : Sets the SPI clock rate used when the library is opened in
+               MPSSE mode (TC_MPSSE passed to TCopen()).  If already open
+               in that mode, the new rate takes effect immediately.  The
+               chip can only produce 30 MHz divided by an integer, so the
+               rate is rounded down to the nearest of these.  Long clock
+               runs to the first pixel may need a slower rate.
+ Parameters  : unsigned long  Clock rate in Hz, up to 30000000 (default
+                              is 6000000).
+ Returns     : TC_OK on success, TC_ERR_VALUE if invalid parameter received,
+               TC_ERR_WRITE on I/O error.
+ ****************************************************************************/
+TCstatusCode TCsetMpsseClock(unsigned long hz)
+{
+	unsigned char cmd[3];
+
+	if((hz < 458) || (hz > 30000000)) return TC_ERR_VALUE;
+
+	mpsseClock = hz;
+	if(!mpsse || !pixelOutBuffer) return TC_OK;
+
+	mpsseDivisor(cmd);
+	return rawWrite(cmd,sizeof(cmd));
+}
+
+/****************************************************************************
+ Function    : TCsetRecovery()
+ Description : Enables or disables automatic device recovery.  When
+               enabled, a write error (e.g. the USB adapter being
+               unplugged or resetting) does not fail TCrefresh() and its
+               variants; instead a background thread reopens the same
+               device by serial number and restores its output mode, baud
+               rate and divisor, and the next frame after that is
+               preceded by a latch.  Frames issued meanwhile are discarded
+               at once rather than blocking, and TCrefresh() returns TC_OK.
+               Outages, recoveries, discarded frames and time without the
+               device are reported in the statistics (TCstats).  Has no
+               effect with an output sink (TCsetSink()).  Disabled by
+               default.
+ Parameters  : int  Nonzero to enable recovery, zero to disable.
+ Returns     : TC_OK on success, TC_ERR_VALUE if output threads (frame
+               interpolation or the mailbox) are running.
+ ****************************************************************************/
+TCstatusCode TCsetRecovery(int enable)
+{
+	if(interpRunning || mbRunning) return TC_ERR_VALUE;
+
+	recoverOn = enable ? 1 : 0;
+
+	return TC_OK;
+}
+
+/****************************************************************************
+ Function    : TCsetSink()
+ Description : Redirects all library output to a function instead of the
+               FTDI device: every byte that would have been written to the
+               device (including MPSSE setup commands) is passed to the
+               function instead, and no device is opened.  Useful for
+               capturing and checking output, benchmarking, or driving
+               some other transport.  Must be called before TCopen().
+ Parameters  : TCsinkFunc  Function receiving output: buffer, length in
+                           bytes, and the pointer passed below.  Returns
+                           TC_OK, or an error code to pass along to the
+                           caller of TCrefresh() etc.  NULL restores normal
+                           FTDI output.
+               void *      Passed through to the function (may be NULL).
+ Returns     : TC_OK on success, TC_ERR_VALUE if library already open.
+ ****************************************************************************/
+TCstatusCode TCsetSink(
+  TCsinkFunc func,
+  void      *arg)
+{
+	if(pixelOutBuffer) return TC_ERR_VALUE;
+
+	sinkFunc = func;
+	sinkArg  = arg;
 
 	return TC_OK;
 }
@@ -677,21 +4158,284 @@ TCstatusCode TCsetStrandPin(
  ****************************************************************************/
 void TCclose(void)
 {
+	TCinterpStop();
+	TCsubmitStop();
+	TCunpublishStats();
+	TCrecordStop();
+	recoverEnd();
 	if(ftdiHandle)
 	{
+		/* Return the chip to its normal (non-MPSSE) state. */
+		if(mpsse) (void)FT_SetBitMode(ftdiHandle,0,0);
 		FT_Close(ftdiHandle);
 		ftdiHandle   = NULL;
 	}
+	TCclearCorrection();
+	if(mpsseBuffer)
+	{
+		free(mpsseBuffer);
+		mpsseBuffer    = NULL;
+		mpsseSize      = 0;
+	}
+	mpsse = 0;
+	if(batchBuffer)
+	{
+		free(batchBuffer);
+		batchBuffer    = NULL;
+		batchSize      = 0;
+	}
 	if(pixelCurrent)
 	{
 		free(pixelCurrent);
 		pixelCurrent   = NULL;
 		pixelOutBuffer = NULL;
+		latchData      = NULL;
 	}
+	encodedPixels   = NULL;
 	nStrands        = 0;
+
+	/* Output has stopped, so any parameter blocks replaced while
+	   frames were being rendered can go now. */
+	pthread_mutex_lock(&paramLock);
+	paramsReclaim();
+	pthread_mutex_unlock(&paramLock);
 	pixelsPerStrand = 0;
 }
 
+/****************************************************************************
+ Function    : TCpublishStats()
+ Description : Publishes output statistics to a shared memory page that
+               monitoring tools in other processes can read (see
+               TCstatsAttach()) without disturbing output: the same figures
+               as TCstats, plus write errors and frame mailbox counts,
+               updated as each frame is issued.  Costs a few stores per
+               frame; no locks or system calls.  Stays published until
+               TCunpublishStats() or TCclose().
+ Parameters  : const char *  Shared memory object name (beginning with '/'),
+                             or NULL for TC_STATS_NAME.
+ Returns     : TC_OK on success, TC_ERR_VALUE if output threads (frame
+               interpolation or the mailbox) are running or the name is
+               too long, TC_ERR_FILE if the page could not be created.
+ ****************************************************************************/
+TCstatusCode TCpublishStats(const char *name)
+{
+	int          fd;
+	TCstatsPage *page;
+
+	if(!name) name = TC_STATS_NAME;
+	if(interpRunning || mbRunning || (strlen(name) >= sizeof(statsName)))
+		return TC_ERR_VALUE;
+	TCunpublishStats();
+
+	if((fd = shm_open(name,O_RDWR | O_CREAT | O_TRUNC,0644)) < 0)
+		return TC_ERR_FILE;
+	if(ftruncate(fd,sizeof(TCstatsPage)) ||
+	   (MAP_FAILED == (page = (TCstatsPage *)mmap(NULL,sizeof(TCstatsPage),
+	   PROT_READ | PROT_WRITE,MAP_SHARED,fd,0))))
+	{
+		close(fd);
+		(void)shm_unlink(name);
+		return TC_ERR_FILE;
+	}
+	close(fd);
+
+	(void)TCinitStats(&page->stats);
+	page->pid       = (uint32_t)getpid();
+	page->usecStart = page->usecUpdated = usecNow();
+	if(rtPriority) (void)mlock(page,sizeof(TCstatsPage));
+	__sync_synchronize();
+	page->magic     = TC_STATS_MAGIC;
+
+	strcpy(statsName,name);
+	statsPage = page;
+	return TC_OK;
+}
+
+/****************************************************************************
+ Function    : TCunpublishStats()
+ Description : Removes the page created by TCpublishStats().  Processes
+               still attached keep a valid copy of the final figures.  Not
+               to be called while output threads are running; TCclose()
+               stops those first and calls this itself.
+ Parameters  : None (void).
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCunpublishStats(void)
+{
+	if(!statsPage || interpRunning || mbRunning) return;
+
+	(void)munmap(statsPage,sizeof(TCstatsPage));
+	(void)shm_unlink(statsName);
+	statsPage = NULL;
+}
+
+/****************************************************************************
+ Function    : TCstatsAttach()
+ Description : Maps a statistics page published by another process (or
+               this one), read-only.  TCopen() is not required.
+ Parameters  : const char *  Shared memory object name, or NULL for
+                             TC_STATS_NAME.
+ Returns     : Page, for TCstatsRead(), or NULL if not published.
+ ****************************************************************************/
+const TCstatsPage *TCstatsAttach(const char *name)
+{
+	int          fd;
+	struct stat  st;
+	TCstatsPage *page = NULL;
+
+	if((fd = shm_open(name ? name : TC_STATS_NAME,O_RDONLY,0)) < 0)
+		return NULL;
+	if(!fstat(fd,&st) && (st.st_size >= (off_t)sizeof(TCstatsPage)) &&
+	   (MAP_FAILED == (page = (TCstatsPage *)mmap(NULL,sizeof(TCstatsPage),
+	   PROT_READ,MAP_SHARED,fd,0)))) page = NULL;
+	close(fd);
+
+	return page;
+}
+
+/****************************************************************************
+ Function    : TCstatsRead()
+ Description : Copies a consistent snapshot of a statistics page, retrying
+               if it changes while being copied.  Never blocks the
+               publishing process.
+ Parameters  : const TCstatsPage *  Page from TCstatsAttach().
+               TCstatsPage *        Destination.
+ Returns     : TC_OK on success, TC_ERR_FILE if the page isn't set up (yet)
+               or couldn't be read in a reasonable number of tries.
+ ****************************************************************************/
+TCstatusCode TCstatsRead(
+  const TCstatsPage *page,
+  TCstatsPage       *copy)
+{
+	uint32_t seq;
+	int      tries;
+
+	for(tries=0;tries<1000;tries++)
+	{
+		if((seq = page->seq) & 1) continue;  /* Mid-update */
+		__sync_synchronize();
+		memcpy(copy,(const void *)page,sizeof(TCstatsPage));
+		__sync_synchronize();
+		if(page->seq == seq)
+			return (copy->magic == TC_STATS_MAGIC) ?
+			  TC_OK : TC_ERR_FILE;
+	}
+
+	return TC_ERR_FILE;
+}
+
+/****************************************************************************
+ Function    : TCstatsDetach()
+ Description : Unmaps a page from TCstatsAttach().
+ Parameters  : const TCstatsPage *  Page (NULL is ignored).
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCstatsDetach(const TCstatsPage *page)
+{
+	if(page) (void)munmap((void *)page,sizeof(TCstatsPage));
+}
+
+/****************************************************************************
+ Function    : TCtraceStart()
+ Description : Starts recording a trace of the library's activity in
+               memory: spans for opening the device ("open"), encoding
+               each frame ("encode") and writing it ("write"), and marks
+               for the latch at the end of each write, errors, and frames
+               submitted to the mailbox.  Spans from the application can
+               be added with TCtraceBegin() and TCtraceEnd().  Once full,
+               the oldest events are overwritten.  If already tracing,
+               the trace so far is discarded.
+ Parameters  : int  Number of events to keep; each frame takes five.
+ Returns     : TC_OK on success, TC_ERR_VALUE if the count is less than 1,
+               TC_ERR_MALLOC on malloc() failure.
+ ****************************************************************************/
+TCstatusCode TCtraceStart(int nEvents)
+{
+	traceEvent *buf;
+
+	if(nEvents < 1) return TC_ERR_VALUE;
+	(void)TCtraceStop(NULL);
+	if(!(buf = (traceEvent *)malloc(nEvents * sizeof(traceEvent))))
+		return TC_ERR_MALLOC;
+	if(rtPriority) (void)mlock(buf,nEvents * sizeof(traceEvent));
+
+	traceSize  = nEvents;
+	traceCount = 0;
+	__sync_synchronize();
+	traceBuf   = buf;
+
+	return TC_OK;
+}
+
+/****************************************************************************
+ Function    : TCtraceBegin(), TCtraceEnd()
+ Description : Mark the start and end of an application span in the trace,
+               such as rendering a frame, to see alongside the library's
+               own.  Spans on one thread must nest.  No effect when not
+               tracing.
+ Parameters  : const char *  Span name.  The pointer is stored, so this
+                             must remain valid until TCtraceStop(); a
+                             string constant is best.
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCtraceBegin(const char *name)
+{
+	if(traceBuf) traceRecord('B',name,0);
+}
+
+void TCtraceEnd(const char *name)
+{
+	if(traceBuf) traceRecord('E',name,0);
+}
+
+/****************************************************************************
+ Function    : TCtraceStop()
+ Description : Stops tracing and optionally writes the trace as a Chrome
+               trace (JSON) file, for viewing with chrome://tracing or
+               ui.perfetto.dev.  Times are in microseconds since the
+               epoch, so traces from several processes line up.  Safe to
+               call while other threads are producing frames; events
+               they record after this are discarded.
+ Parameters  : const char *  Filename to write, or NULL to discard the trace.
+ Returns     : TC_OK on success, TC_ERR_FILE on write error.
+ ****************************************************************************/
+TCstatusCode TCtraceStop(const char *filename)
+{
+	traceEvent    *buf,*e;
+	unsigned long  i,first;
+	FILE          *fp;
+	TCstatusCode   status = TC_OK;
+
+	/* Any thread still writing an event took its pointer before this;
+	   once they're done, the buffer is ours. */
+	if(!(buf = __sync_lock_test_and_set(&traceBuf,NULL))) return TC_OK;
+	__sync_synchronize();
+	while(__sync_add_and_fetch(&traceWriters,0)) usleep(10);
+
+	if(filename && (fp = fopen(filename,"w")))
+	{
+		first = (traceCount > traceSize) ? traceCount - traceSize : 0;
+		(void)fprintf(fp,"{\"traceEvents\":[\n");
+		for(i=first;i<traceCount;i++)
+		{
+			e = &buf[i % traceSize];
+			(void)fprintf(fp,"%s{\"name\":\"%s\",\"cat\":\"%s\","
+			  "\"ph\":\"%c\",\"ts\":%llu,\"pid\":%d,\"tid\":%lu,",
+			  (i > first) ? ",\n" : "",e->name,
+			  (e->phase == 'i') ? "mark" : "span",e->phase,e->usec,
+			  (int)getpid(),e->thread);
+			if(e->phase == 'i') (void)fprintf(fp,"\"s\":\"t\",");
+			(void)fprintf(fp,"\"args\":{\"value\":%ld}}",e->arg);
+		}
+		(void)fprintf(fp,"\n],\"displayTimeUnit\":\"ms\"}\n");
+		if(ferror(fp)) status = TC_ERR_FILE;
+		if(fclose(fp)) status = TC_ERR_FILE;
+	} else if(filename) status = TC_ERR_FILE;
+
+	free(buf);
+	return status;
+}
+
 /****************************************************************************
  Function    : TCprintStats()
  Description : Displays contents of a TCstats structure to stdout.
@@ -722,7 +4466,8 @@ void TCprintStats(TCstats *stats)
           "Average current            : %.3f mA (@5.0V)\n"
           "Peak current               : %.3f mA (@5.0V)\n"
           "Charge for prior frame     : %f mAH (@5.0V)\n"
-          "Total charge, all frames   : %.3f mAH (@5.0V)\n\n",
+          "Total charge, all frames   : %.3f mAH (@5.0V)\n"
+          "Frames current-limited     : %ld\n",
 	  stats->frames,
 	  stats->bits,
 	  stats->bitsTotal,
@@ -738,7 +4483,34 @@ void TCprintStats(TCstats *stats)
 	  stats->maAvg,
 	  stats->maMax,
 	  stats->mah,
-	  stats->mahTotal);
+	  stats->mahTotal,
+	  stats->framesLimited);
+
+	/* Device recovery figures, only if the device was ever lost. */
+	if(stats->outages)
+	{
+		(void)printf(
+		  "Device outages (recovered) : %ld (%ld)\n"
+		  "Frames dropped in outages  : %ld\n"
+		  "Last outage                : %ld uS\n"
+		  "Total time without device  : %ld uS\n",
+		  stats->outages,stats->recoveries,stats->framesDropped,
+		  stats->usecOutage,stats->usecOutageTotal);
+	}
+
+	/* Per-strand figures, only if there's more than one strand. */
+	if(nStrands > 1)
+	{
+		int i;
+
+		for(i=0;i<nStrands;i++)
+		{
+			(void)printf(
+			  "Strand %d current (peak)   : %.3f mA (%.3f mA)\n",
+			  i,stats->maStrand[i],stats->maStrandMax[i]);
+		}
+	}
+	(void)putchar('\n');
 }
 
 /****************************************************************************
@@ -772,7 +4544,12 @@ void TCprintError(TCstatusCode status)
 	  "         to continue with default setting.",
 	  "WARNING: Could not set I/O baud rate.  Library code may be \n"
 	  "         outside valid range for this FTDI device, but program\n"
-	  "         may choose to continue with default setting."
+	  "         may choose to continue with default setting.",
+	  "ERROR: Could not read or write file, or file is not in the\n"
+	  "       expected format.",
+	  "End of show file reached.",
+	  "ERROR: Could not enable real-time output.  Real-time scheduling\n"
+	  "       and memory locking normally require root privileges."
 	};
 
 	if((status >= 0) && (status < (sizeof(msg) / sizeof(msg[0]))))
@@ -51,10 +51,22 @@ typedef uint32_t TCpixel;
    work with standard FTDI adapter cable (e.g. LilyPad programmer).
    See README.txt for further explanation.                              */
 
+/* Alternate mode for TCopen(): single strand on the MPSSE engine of
+   high-speed FTDI parts (FT232H, FT2232H, FT4232H), clocked in hardware
+   as SPI.  Data is on ADBUS1 (D1), clock on ADBUS0 (D0).  Cannot be
+   combined with TC_CBUS_CLOCK. */
+#define TC_MPSSE      32
+
 /* Special constants for the optional remap array passed to TCrefresh() */
 #define TC_PIXEL_UNUSED       -1     /* Pixel is attached but not used  */
 #define TC_PIXEL_DISCONNECTED -2     /* Pixel is not attached to strand */
 
+/* Strand number for TCsetCurrentLimit() meaning the whole display */
+#define TC_ALL_STRANDS -1
+
+/* Number of layers available to TCsetLayer() and TCrefreshLayers() */
+#define TC_MAX_LAYERS 8
+
 /* FTDI pin-to-bitmask mappings */
 
 #define TC_FTDI_TX  0x01  /* Avail on all FTDI adapters,  strand 0 default */
@@ -76,9 +88,32 @@ typedef enum {
 	TC_ERR_WRITE,     /* Error writing to FTDI device         */
 	TC_ERR_MODE,      /* Could not enable async bit bang mode */
 	TC_ERR_DIVISOR,   /* Could not set baud divisor           */
-	TC_ERR_BAUDRATE   /* Could not set baud rate              */
+	TC_ERR_BAUDRATE,  /* Could not set baud rate              */
+	TC_ERR_FILE,      /* File I/O error or bad file format    */
+	TC_END_OF_SHOW,   /* No more frames in show file          */
+	TC_ERR_REALTIME   /* Could not set real-time scheduling   */
 } TCstatusCode;
 
+/* Layer blend modes for TCsetLayer() */
+
+typedef enum {
+	TC_BLEND_NORMAL = 0, /* Layer replaces what's beneath it   */
+	TC_BLEND_ADD,        /* Sum of components, clipped at 255  */
+	TC_BLEND_MULTIPLY,   /* Product of components (darkens)    */
+	TC_BLEND_MAX         /* Brighter of each component (HTP)   */
+} TCblendMode;
+
+/* Image formats accepted by TCrefreshFormat() */
+
+typedef enum {
+	TC_FORMAT_RGB24 = 0, /* 3 bytes/pixel: R, G, B                 */
+	TC_FORMAT_BGR24,     /* 3 bytes/pixel: B, G, R                 */
+	TC_FORMAT_RGBA32,    /* 4 bytes/pixel: R, G, B, (ignored)      */
+	TC_FORMAT_BGRA32,    /* 4 bytes/pixel: B, G, R, (ignored)      */
+	TC_FORMAT_RGB565,    /* 2 bytes/pixel, little-endian 5:6:5     */
+	TC_FORMAT_PLANAR     /* Separate R, G, B arrays, 1 byte/pixel  */
+} TCformat;
+
 /* Structure and variable types */
 
 typedef struct {
@@ -98,29 +133,317 @@ typedef struct {
 	double        maMax;          /* Peak current use               */
 	double        mah;            /* Charge used by prior frame     */
 	double        mahTotal;       /* Total charge used thus far     */
+	double        maStrand[8];    /* Current used by each strand    */
+	double        maStrandMax[8]; /* Peak current, each strand      */
+	unsigned long framesLimited;  /* Frames dimmed by current limit */
+	unsigned long outages;        /* Times the device was lost      */
+	unsigned long recoveries;     /* Times it was reopened          */
+	unsigned long framesDropped;  /* Frames discarded while lost    */
+	unsigned long usecOutage;     /* Current (or last) outage time  */
+	unsigned long usecOutageTotal;/* Total time without the device  */
 	unsigned long reserved;
 } TCstats;
 
+/* Parameters for TCrenderWave(): starting phase (at pixel 0) and
+   per-pixel phase step for each of red, green and blue.  Phases are
+   32-bit fixed-point angles, 2^32 being one full cycle. */
+typedef struct {
+	uint32_t phase[3];
+	int32_t  step[3];
+} TCwave;
+
+/* A run of pixels: 'n' pixels from index 'start' of an image.  Lists
+   of spans (e.g. the changes reported by an effect graph, for
+   TCrefreshDirty()) are in ascending order and don't overlap. */
+typedef struct {
+	int start;
+	int n;
+} TCspan;
+
+/* Policies for TCsubmitStart(): what happens when frames are submitted
+   faster than the device can send them. */
+typedef enum {
+	TC_SUBMIT_LATEST = 0,  /* Newest frame replaces unsent one       */
+	TC_SUBMIT_BLOCK,       /* Queue; TCsubmit() waits when full      */
+	TC_SUBMIT_DROP_OLDEST  /* Queue; oldest frame discarded if full  */
+} TCsubmitPolicy;
+
+/* Frame mailbox counts, from TCsubmitGetStats() */
+typedef struct {
+	unsigned long submitted;  /* Frames passed to TCsubmit()         */
+	unsigned long sent;       /* Frames issued to the device         */
+	unsigned long superseded; /* Replaced by newer (TC_SUBMIT_LATEST) */
+	unsigned long dropped;    /* Discarded from a full queue         */
+	unsigned long usecWire;   /* Mean time from TCsubmit() to sent   */
+	unsigned long usecWireMax; /* Longest such time                  */
+} TCsubmitStats;
+
+/* Output thread wakeup latency, from TCgetLatency() */
+typedef struct {
+	unsigned long samples;    /* Number of wakeups measured          */
+	unsigned long usecMin;    /* Shortest latency, microseconds      */
+	unsigned long usecMax;    /* Longest latency                     */
+	double        usecAvg;    /* Mean latency                        */
+	double        usecDev;    /* Standard deviation (jitter)         */
+	unsigned long hist[8];    /* Counts under 16,32,64...1024 uS, and
+	                             1024 uS or more                     */
+} TClatencyStats;
+
+/* Synchronized playback state, from TCsyncGetStats() */
+typedef struct {
+	int           leader;         /* Set if this process is the leader  */
+	int           locked;         /* Set once the timeline is known     */
+	unsigned long samples;        /* Clock exchanges (leader: answered) */
+	unsigned long rejected;       /* Exchanges discarded as too slow    */
+	double        usecOffset;     /* Leader clock minus local clock     */
+	double        ppmDrift;       /* Local clock rate relative to leader */
+	double        usecDelay;      /* Round trip of latest exchange      */
+	double        usecJitter;     /* RMS clock error at each exchange   */
+	unsigned long frames;         /* Frames presented by TCrefreshAt()  */
+	unsigned long framesLate;     /* Write started after frame's time   */
+	double        usecPresentAvg; /* Mean presentation error            */
+	double        usecPresentMax; /* Worst presentation error           */
+} TCsyncStats;
+
+/* Shared-memory statistics page, from TCpublishStats().  Other processes
+   map it with TCstatsAttach() and copy it out with TCstatsRead(); 'seq'
+   is odd while the library is updating it. */
+#define TC_STATS_NAME  "/p9813"    /* Default shared memory object name */
+#define TC_STATS_MAGIC 0x54435354  /* 'TCST'                            */
+typedef struct {
+	uint32_t            magic;         /* TC_STATS_MAGIC once set up     */
+	uint32_t            pid;           /* Publishing process             */
+	volatile uint32_t   seq;           /* Update sequence number         */
+	int                 nStrands;
+	int                 pixelsPerStrand;
+	unsigned long long  usecStart;     /* When published (epoch uS)      */
+	unsigned long long  usecUpdated;   /* Last update                    */
+	TCstats             stats;         /* Output statistics, as TCstats  */
+	unsigned long       writeErrors;   /* Frames with a write error      */
+	TCsubmitStats       mailbox;       /* Frame mailbox counts           */
+} TCstatsPage;
+
+/* Output sink for TCsetSink(): receives the bytes that would have been
+   written to the FTDI device, their count, and an application pointer. */
+typedef TCstatusCode (*TCsinkFunc)(const unsigned char*,int,void*);
+
 /* Function prototypes */
 
 /* Merge separate R,G,B into TCpixel format; not a real function.
    Might add actual functions for HSL, HSV, etc. later on. */
 #define TCrgb(R,G,B) (((R) << 16) | ((G) << 8) | (B))
 
+/* Convert a number of cycles (or radians) to a fixed-point phase for the
+   pattern functions; also not real functions.  Negative values wrap. */
+#define TC_PHASE_CYCLES(C)  ((uint32_t)(int64_t)((C) * 4294967296.0))
+#define TC_PHASE_RADIANS(R) ((uint32_t)(int64_t)((R) * 683565275.5764316))
+
 extern TCstatusCode
 	TCopen(unsigned char,int),
 	TCinitStats(TCstats*),
 	TCrefresh(TCpixel*,int*,TCstats*),
+	TCrefreshLayers(int*,TCstats*),
+	TCrefreshIndexed(unsigned char*,int*,TCstats*),
+	TCrefreshFormat(const void*,TCformat,int,int*,TCstats*),
+	TCrefreshBatch(TCpixel**,int,double,int*,TCstats*),
+	TCrefreshDirty(const TCpixel*,const TCspan*,int,int*,TCstats*),
+	TCsubmitStart(TCsubmitPolicy,int,int,int*,TCstats*),
+	TCsubmit(const TCpixel*),
+	TCframeSubmit(TCpixel*),
+	TCsetPalette(const TCpixel*,int),
+	TCsetLayer(int,TCpixel*,unsigned char,TCblendMode),
+	TCinterpStart(double,int,int*,TCstats*,int),
+	TCkeyframe(TCpixel*),
 	TCsetGamma(unsigned char,unsigned char,double,
 	           unsigned char,unsigned char,double,
 	           unsigned char,unsigned char,double),
 	TCsetGammaSimple(double),
-	TCsetStrandPin(int,unsigned char);
+	TCsetCurrentLimit(int,double),
+	TCsetCorrection(int,int,double,double,double),
+	TCsetMpsseClock(unsigned long),
+	TCsetSink(TCsinkFunc,void*),
+	TCsetRecovery(int),
+	TCrecordStart(double,unsigned long),
+	TCrecordDump(const char*),
+	TCrecordSignal(int,const char*),
+	TCsetRealtime(int,int),
+	TCsetStrandPin(int,unsigned char),
+	TCpublishStats(const char*),
+	TCtraceStart(int),
+	TCsyncLeader(int,double),
+	TCsyncFollow(const char*,int),
+	TCrefreshAt(TCpixel*,int*,TCstats*,long),
+	TCtraceStop(const char*),
+	TCstatsRead(const TCstatsPage*,TCstatsPage*);
+extern unsigned char
+	TCgetStrandPin(int);
+extern TCpixel
+	*TCframeAcquire(void);
+extern const TCstatsPage
+	*TCstatsAttach(const char*);
+extern long
+	TCsyncFrame(void);
 extern void
 	TCclose(void),
+	TCinterpStop(void),
+	TCsubmitGetStats(TCsubmitStats*),
+	TCsubmitStop(void),
+	TCgetLatency(TClatencyStats*),
 	TCdisableGamma(void),
+	TCclearCorrection(void),
+	TCsetFader(unsigned char),
 	TCprintStats(TCstats*),
-	TCprintError(TCstatusCode);
+	TCprintError(TCstatusCode),
+	TCunpublishStats(void),
+	TCsyncGetStats(TCsyncStats*),
+	TCsyncStop(void),
+	TCrecordStop(void),
+	TCtraceBegin(const char*),
+	TCtraceEnd(const char*),
+	TCstatsDetach(const TCstatsPage*);
+
+/* Offline estimates; TCopen() not required */
+extern double
+	TCestimateCurrent(const TCpixel*,int,float*);
+extern unsigned long
+	TCwireBytes(unsigned char,int);
+
+/* Procedural patterns (pattern.c) */
+extern unsigned char
+	TCsine8(uint32_t);
+extern TCstatusCode
+	TCmakePalette(TCpixel*,const TCpixel*,int);
+extern void
+	TCrenderWave(TCpixel*,int,int,const TCwave*),
+	TCrenderGradient(TCpixel*,int,int,TCpixel,TCpixel),
+	TCrenderPalette(TCpixel*,const unsigned char*,int,const TCpixel*,
+	  unsigned char),
+	TCrenderPlasma(TCpixel*,int,int,uint32_t,const TCpixel*),
+	TCrenderNoise(TCpixel*,int,int,uint32_t,uint32_t,uint32_t,
+	  const TCpixel*);
+
+/* Show files (show.c).  TCshow is opaque; use the functions below. */
+typedef struct TCshow TCshow;
+extern TCshow
+	*TCshowCreate(const char*,int),
+	*TCshowCreateOutput(const char*,unsigned char,int),
+	*TCshowOpen(const char*);
+extern int
+	TCshowPixels(TCshow*);
+extern unsigned char
+	TCshowStrands(TCshow*),
+	TCshowStrandPin(TCshow*,int);
+extern TCstatusCode
+	TCshowWrite(TCshow*,const TCpixel*,unsigned long long),
+	TCshowRead(TCshow*,TCpixel*,unsigned long long*),
+	TCshowClose(TCshow*);
+
+/* Strand planning (planner.c).  A segment is a run of pixels wired in
+   series; segments with the same chain number (0 or more) are wired to
+   one another, in the order listed, while -1 means a segment stands
+   alone.  Strand and offset are results. */
+typedef struct {
+	int length;   /* Number of pixels                              */
+	int chain;    /* Chain number, or -1 if not chained            */
+	int strand;   /* Assigned strand (set by TCplanStrands())      */
+	int offset;   /* Position of first pixel on that strand (ditto) */
+} TCsegment;
+extern TCstatusCode
+	TCplanStrands(TCsegment*,int,int,int*,int*),
+	TCplanRemap(const TCsegment*,int,int,int,int*);
+
+/* Compiled layouts (layout.c).  Tables are read-only, mapped from the
+   layout file: 'remap' is for TCrefresh() (nStrands * pixelsPerStrand
+   elements), 'led' gives the strand position (strand * pixelsPerStrand
+   + pixel) showing each of the imageSize image pixels, or -1, and
+   'coords' holds x,y,z for each strand position.  Image pixels are the
+   width x height grid, row by row, then any free-standing pixels. */
+typedef struct {
+	int          nStrands;        /* For TCopen()                      */
+	int          pixelsPerStrand;
+	int          width;           /* Image grid                        */
+	int          height;
+	int          imageSize;       /* Pixels in image for TCrefresh()   */
+	int         *remap;
+	const int   *led;
+	const float *coords;
+} TClayout;
+extern TClayout
+	*TClayoutOpen(const char*);
+extern TCstatusCode
+	TClayoutCompile(const char*,const char*,int*),
+	TCopenLayout(const char*,unsigned char,TClayout**);
+extern void
+	TClayoutClose(TClayout*);
+
+/* Area-averaging image resampler (resample.c).  TCresampler is opaque. */
+typedef struct TCresampler TCresampler;
+extern TCresampler
+	*TCresampleCreate(int,int,int,int,int);
+extern void
+	TCresample(TCresampler*,const unsigned char*,int,TCpixel*),
+	TCresampleDestroy(TCresampler*);
+
+/* Effect graphs (effect.c).  TCgraph is opaque.  An effect renders 'n'
+   pixels from 'start' of its output, given its input nodes' outputs
+   (full images) and its parameters.  TC_EFFECT_POINTWISE declares that
+   each output pixel depends only on the same pixel of the inputs, so
+   the effect can be re-run on just the spans that changed. */
+typedef struct TCgraph TCgraph;
+typedef void (*TCeffectFunc)(TCpixel*,const TCpixel**,const void*,int,int);
+#define TC_EFFECT_POINTWISE 1
+#define TC_GRAPH_MAX_INPUTS 8   /* Inputs per node                    */
+#define TC_GRAPH_MAX_SPANS  16  /* Changed spans reported per node    */
+extern TCgraph
+	*TCgraphCreate(int);
+extern int
+	TCgraphAdd(TCgraph*,TCeffectFunc,int,const int*,int,const void*,int);
+extern TCstatusCode
+	TCgraphSet(TCgraph*,int,const void*),
+	TCgraphEvaluate(TCgraph*);
+extern const TCpixel
+	*TCgraphOutput(TCgraph*,int,const TCspan**,int*);
+extern void
+	TCgraphDestroy(TCgraph*),
+	TCeffectFill(TCpixel*,const TCpixel**,const void*,int,int),
+	TCeffectWave(TCpixel*,const TCpixel**,const void*,int,int),
+	TCeffectFade(TCpixel*,const TCpixel**,const void*,int,int),
+	TCeffectMask(TCpixel*,const TCpixel**,const void*,int,int),
+	TCeffectMap(TCpixel*,const TCpixel**,const void*,int,int);
+
+/* Spatial index of pixel positions (spatial.c).  TCspatial is opaque.
+   Queries return spans of indices, owned by the index and valid until
+   its next query. */
+typedef struct TCspatial TCspatial;
+extern TCspatial
+	*TCspatialCreate(const float*,int,const int*);
+extern const TCspan
+	*TCspatialBox(TCspatial*,const float*,const float*,int*),
+	*TCspatialSphere(TCspatial*,const float*,float,int*),
+	*TCspatialSlab(TCspatial*,const float*,float,float,int*);
+extern int
+	TCspatialNearest(TCspatial*,const float*,int,int*,float*);
+extern void
+	TCspatialDestroy(TCspatial*);
+
+/* Pixel chain emulator (emulator.c).  TCemulator is opaque. */
+typedef struct TCemulator TCemulator;
+typedef struct {
+	unsigned long frames;      /* Latches seen (on strand 0)         */
+	unsigned long words;       /* Pixel words received, all strands  */
+	unsigned long badWords;    /* Words with bad flag/checksum byte  */
+	unsigned long overruns;    /* Words past the end of a strand     */
+	unsigned long shortFrames; /* Latches before all pixels received */
+} TCemuStats;
+extern TCemulator
+	*TCemuCreate(unsigned char,int);
+extern TCstatusCode
+	TCemuSink(const unsigned char*,int,void*);
+extern const TCpixel
+	*TCemuPixels(TCemulator*,int);
+extern void
+	TCemuGetStats(TCemulator*,TCemuStats*),
+	TCemuDestroy(TCemulator*);
 
 #if defined __cplusplus
 };
@@ -0,0 +1,334 @@
+/****************************************************************************
+ File        : pattern.c
+
+ Description : Procedural pattern generators for the p9813 library: sine
+               wave oscillators, plasma, gradients, noise and palette
+               cycling.  These write directly into a TCpixel array ready
+               for TCrefresh().  All of the per-pixel math is fixed-point:
+               phases are 32-bit accumulators (2^32 = one full cycle) and
+               waveforms come from an interpolated lookup table, so there
+               are no floating-point or libm calls in any inner loop.
+
+               Every function that walks a one-dimensional run of pixels
+               takes a starting pixel offset along with the count, so an
+               application may split a large display into spans (e.g. one
+               per strand) and render them from separate threads; the
+               results are identical to rendering the whole array at once.
+
+ License     : Copyright 2011 Phillip Burgess.    www.PaintYourDragon.com
+
+               This Program is free software: you can redistribute it and/or
+               modify it under the terms of the GNU General Public License as
+               published by the Free Software Foundation, either version 3 of
+               the License, or (at your option) any later version.
+
+               This Program is distributed in the hope that it will be
+               useful, but WITHOUT ANY WARRANTY; without even the implied
+               warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+               PURPOSE.  See the GNU General Public License for more details.
+
+               You should have received a copy of the GNU General Public
+               License along with this Program.  If not, see
+               <http://www.gnu.org/licenses/>.
+
+               Additional permission under GNU GPL version 3 section 7
+
+               If you modify this Program, or any covered work, by linking
+               or combining it with libftd2xx (or a modified version of that
+               library), containing parts covered by the license terms of
+               Future Technology Devices International Limited, the licensors
+               of this Program grant you additional permission to convey the
+               resulting work.
+ ****************************************************************************/
+
+#include <math.h>
+#include "p9813.h"
+
+/* Sine table covers one full cycle in 256 steps, plus a duplicate of the
+   first entry at the end so interpolation never needs to wrap.  Values
+   are (sin + 1.0) scaled to 0-65535; the extra precision is retained
+   through interpolation and dropped only on output. */
+static uint16_t
+	sineTable[257];
+static int
+	tablesReady = 0;
+
+static void initTables(void)
+{
+	int i;
+
+	for(i=0;i<256;i++)
+	{
+		sineTable[i] = (uint16_t)(
+		  (sin((double)i * M_PI / 128.0) + 1.0) * 32767.5 + 0.5);
+	}
+	sineTable[256] = sineTable[0];
+	tablesReady    = 1;
+}
+
+/* Interpolated table lookup.  The top 8 bits of the phase select a table
+   entry, the next 8 bits interpolate toward the following entry.
+   Returns 0-65535. */
+static inline uint32_t wave16(uint32_t phase)
+{
+	uint32_t i = phase >> 24,
+	         f = (phase >> 16) & 0xff;
+
+	return ((uint32_t)sineTable[i] * (256 - f) +
+	        (uint32_t)sineTable[i + 1] * f) >> 8;
+}
+
+/****************************************************************************
+ Function    : TCsine8()
+ Description : Fixed-point sine function.
+ Parameters  : uint32_t  Phase, where 2^32 is one full cycle (see
+                         TC_PHASE_CYCLES() macro in header).
+ Returns     : Sine of phase, scaled from -1.0 - +1.0 to 0 - 255.
+ ****************************************************************************/
+unsigned char TCsine8(uint32_t phase)
+{
+	if(!tablesReady) initTables();
+
+	return wave16(phase) >> 8;
+}
+
+/****************************************************************************
+ Function    : TCrenderWave()
+ Description : Renders independent sine waves in the red, green and blue
+               components along a run of pixels.  This is the fixed-point
+               equivalent of calling sin() three times per pixel.
+ Parameters  : TCpixel *       Pixel array.
+               int             Index of first pixel to render.
+               int             Number of pixels to render.
+               const TCwave *  Starting phase (at pixel 0) and per-pixel
+                               phase step for each color component.
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCrenderWave(
+  TCpixel      *pixels,
+  int           start,
+  int           n,
+  const TCwave *w)
+{
+	uint32_t pr,pg,pb,sr,sg,sb;
+
+	if(!tablesReady) initTables();
+
+	sr = (uint32_t)w->step[0];
+	sg = (uint32_t)w->step[1];
+	sb = (uint32_t)w->step[2];
+	pr = w->phase[0] + sr * (uint32_t)start;
+	pg = w->phase[1] + sg * (uint32_t)start;
+	pb = w->phase[2] + sb * (uint32_t)start;
+
+	for(pixels += start;n--;pr+=sr,pg+=sg,pb+=sb)
+	{
+		*pixels++ = ((wave16(pr) & 0xff00) << 8) |
+		             (wave16(pg) & 0xff00)       |
+		             (wave16(pb)           >> 8);
+	}
+}
+
+/****************************************************************************
+ Function    : TCmakePalette()
+ Description : Builds a 256-entry color palette as a smooth gradient
+               through a list of key colors.  The gradient wraps from the
+               last key back to the first, so the palette can be cycled
+               (see TCrenderPalette()) without a visible seam.
+ Parameters  : TCpixel *        Destination palette, 256 elements.
+               const TCpixel *  Key colors.
+               int              Number of key colors (1-256).
+ Returns     : TC_OK on success, TC_ERR_VALUE if invalid parameter received.
+ ****************************************************************************/
+TCstatusCode TCmakePalette(
+  TCpixel       *palette,
+  const TCpixel *keys,
+  int            nKeys)
+{
+	int      i,k;
+	uint32_t pos,f,a,b;
+
+	if(!palette || !keys || (nKeys < 1) || (nKeys > 256))
+		return TC_ERR_VALUE;
+
+	for(i=0;i<256;i++)
+	{
+		/* Position along key list in 8.8 fixed-point */
+		pos = (uint32_t)i * (uint32_t)nKeys;
+		k   = pos >> 8;
+		f   = pos & 0xff;
+		a   = keys[k];
+		b   = keys[(k + 1) % nKeys];
+		palette[i] =
+		  ((((a & 0xff00ff) * (256 - f) + (b & 0xff00ff) * f) >> 8) &
+		    0xff00ff) |
+		  ((((a & 0x00ff00) * (256 - f) + (b & 0x00ff00) * f) >> 8) &
+		    0x00ff00);
+	}
+
+	return TC_OK;
+}
+
+/****************************************************************************
+ Function    : TCrenderGradient()
+ Description : Renders a linear gradient between two colors along a run
+               of pixels.
+ Parameters  : TCpixel *  Pixel array.
+               int        Index of first pixel.
+               int        Number of pixels.
+               TCpixel    Color at first pixel.
+               TCpixel    Color at last pixel.
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCrenderGradient(
+  TCpixel *pixels,
+  int      start,
+  int      n,
+  TCpixel  from,
+  TCpixel  to)
+{
+	int32_t r,g,b,dr,dg,db;
+
+	if(n < 1) return;
+
+	/* 16.16 fixed-point component accumulators */
+	r  = (int32_t)((from >> 16) & 0xff) << 16;
+	g  = (int32_t)((from >>  8) & 0xff) << 16;
+	b  = (int32_t)( from        & 0xff) << 16;
+	dr = (n > 1) ? ((((int32_t)((to >> 16) & 0xff) << 16) - r) / (n-1)) : 0;
+	dg = (n > 1) ? ((((int32_t)((to >>  8) & 0xff) << 16) - g) / (n-1)) : 0;
+	db = (n > 1) ? ((((int32_t)( to        & 0xff) << 16) - b) / (n-1)) : 0;
+
+	for(pixels += start;n--;r+=dr,g+=dg,b+=db)
+	{
+		*pixels++ = ((r + 0x8000) & 0xff0000) |
+		            (((g + 0x8000) >> 8) & 0xff00) |
+		             ((b + 0x8000) >> 16);
+	}
+}
+
+/****************************************************************************
+ Function    : TCrenderPalette()
+ Description : Palette cycling: converts an array of 8-bit color indices
+               to TCpixels through a 256-entry palette, with a rotating
+               offset added to each index.  Animating the offset animates
+               the whole image at the cost of one lookup per pixel.
+ Parameters  : TCpixel *              Destination pixel array.
+               const unsigned char *  Color index for each pixel.
+               int                    Number of pixels.
+               const TCpixel *        Palette, 256 elements.
+               unsigned char          Offset added to every index.
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCrenderPalette(
+  TCpixel             *pixels,
+  const unsigned char *index,
+  int                  n,
+  const TCpixel       *palette,
+  unsigned char        offset)
+{
+	while(n--)
+		*pixels++ = palette[(unsigned char)(*index++ + offset)];
+}
+
+/****************************************************************************
+ Function    : TCrenderPlasma()
+ Description : Renders a classic "plasma" effect -- the sum of several
+               sine waves across a 2D grid -- mapped through a palette.
+               Pixels are assumed to be in row-major order; use a remap
+               table with TCrefresh() to match the physical layout.
+ Parameters  : TCpixel *        Pixel array, width * height elements.
+               int              Grid width in pixels.
+               int              Grid height in pixels.
+               uint32_t         Animation time, as a phase (2^32 = one
+                                cycle of the slowest component).
+               const TCpixel *  Palette, 256 elements.
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCrenderPlasma(
+  TCpixel       *pixels,
+  int            width,
+  int            height,
+  uint32_t       t,
+  const TCpixel *palette)
+{
+	int      x,y;
+	uint32_t dx,dy,py,px,pd,rowBase,sum;
+
+	if((width < 1) || (height < 1)) return;
+	if(!tablesReady) initTables();
+
+	/* Spatial frequencies give roughly one and a half cycles across
+	   each axis regardless of grid size. */
+	dx = (uint32_t)(6442450944.0 / width);   /* 1.5 * 2^32 / width  */
+	dy = (uint32_t)(6442450944.0 / height);  /* 1.5 * 2^32 / height */
+
+	for(py=t*2,y=0;y<height;y++,py+=dy)
+	{
+		rowBase = wave16(py);
+		px      = t * 3;
+		pd      = (uint32_t)y * (dy >> 1) - t;
+		for(x=0;x<width;x++,px+=dx,pd+=(dx >> 1))
+		{
+			sum = rowBase + wave16(px) + wave16(pd) +
+			      wave16(px + py);           /* 0 to 4*65535 */
+			*pixels++ = palette[sum >> 10];  /* 0 to 255     */
+		}
+	}
+}
+
+/* Integer hash for noise lattice points (from "Hash Functions for GPU
+   Rendering," with a seed folded in). */
+static inline uint32_t hash(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+/****************************************************************************
+ Function    : TCrenderNoise()
+ Description : Renders smooth one-dimensional value noise along a run of
+               pixels, mapped through a palette.  Scrolling the position
+               parameter from frame to frame gives a flowing texture.
+ Parameters  : TCpixel *        Pixel array.
+               int              Index of first pixel.
+               int              Number of pixels.
+               uint32_t         Noise coordinate of pixel 0, 16.16 fixed-
+                                point (lattice points at integer values).
+               uint32_t         Coordinate step between adjacent pixels,
+                                16.16 fixed-point; smaller = smoother.
+               uint32_t         Seed; different seeds give unrelated noise.
+               const TCpixel *  Palette, 256 elements.
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCrenderNoise(
+  TCpixel       *pixels,
+  int            start,
+  int            n,
+  uint32_t       pos,
+  uint32_t       step,
+  uint32_t       seed,
+  const TCpixel *palette)
+{
+	uint32_t cell = 0xffffffff,a = 0,b = 0,f;
+
+	pos += step * (uint32_t)start;
+	for(pixels += start;n--;pos+=step)
+	{
+		if((pos >> 16) != cell)
+		{
+			/* Crossed into a new lattice cell; hash its ends */
+			cell = pos >> 16;
+			a    = hash(cell ^ seed) >> 24;
+			b    = hash((cell + 1) ^ seed) >> 24;
+		}
+		/* Smoothstep the fraction: 3f^2 - 2f^3, in 8-bit fixed-point */
+		f = (pos >> 8) & 0xff;
+		f = (f * f * (768 - 2 * f)) >> 16;
+		*pixels++ = palette[(a * (256 - f) + b * f) >> 8];
+	}
+}
@@ -0,0 +1,270 @@
+/****************************************************************************
+ File        : plan.c
+
+ Description : Strand planner for the p9813 library.  Reads a list of the
+               segments of pixels in a physical layout and divides them
+               among the FTDI data pins so the longest strand -- which
+               sets the frame rate -- is as short as possible (see
+               TCplanStrands()).  Prints the resulting strands, the
+               TCsetStrandPin() and TCopen() calls to match, and the
+               predicted frame rate alongside that of simply filling
+               strands in the order listed.  Optionally writes the remap
+               table for TCrefresh() as C source.
+
+               Example calling sequences:
+
+               plan -s 7 layout.txt
+               plan -c -s 8 -o remap.h layout.txt
+
+               The layout file has one segment per line: its length in
+               pixels, optionally followed by a chain number.  Segments
+               with the same chain number are wired in series (in the
+               order listed) and must share a strand.  Anything after
+               '#' is a comment.  The image given to TCrefresh() holds
+               the segments' pixels in the order listed.
+
+               -s  Number of strands available (default 7, or 8 with -c).
+               -c  Hardware (CBUS) clock, as with TC_CBUS_CLOCK.
+               -o  Write remap table to this file, as a C array.
+               -b  FTDI baud rate for frame rate estimates (default
+                   3090000, as used by TCopen()).
+
+ License     : Copyright 2011 Phillip Burgess.    www.PaintYourDragon.com
+
+               This Program is free software: you can redistribute it and/or
+               modify it under the terms of the GNU General Public License as
+               published by the Free Software Foundation, either version 3 of
+               the License, or (at your option) any later version.
+
+               This Program is distributed in the hope that it will be
+               useful, but WITHOUT ANY WARRANTY; without even the implied
+               warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+               PURPOSE.  See the GNU General Public License for more details.
+
+               You should have received a copy of the GNU General Public
+               License along with this Program.  If not, see
+               <http://www.gnu.org/licenses/>.
+
+               Additional permission under GNU GPL version 3 section 7
+
+               If you modify this Program, or any covered work, by linking
+               or combining it with libftd2xx (or a modified version of that
+               library), containing parts covered by the license terms of
+               Future Technology Devices International Limited, the licensors
+               of this Program grant you additional permission to convey the
+               resulting work.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "p9813.h"
+
+#define MAX_SEGMENTS 4096
+
+/* Bitbang output bytes per baud; see simulate.c. */
+#define BYTES_PER_BAUD (960000.0 / 3090000.0)
+
+/* Data pins in the order strands are assigned to them.  With the
+   software clock, CTS is the clock; with the CBUS clock, all eight pins
+   carry data.  Up to three strands use the library's defaults, which
+   suit the FTDI cable as well as full breakout boards. */
+static const char *pinName[2][8] = {
+  { "TC_FTDI_TX","TC_FTDI_RX","TC_FTDI_RTS","TC_FTDI_DTR",
+    "TC_FTDI_DSR","TC_FTDI_DCD","TC_FTDI_RI",NULL },
+  { "TC_FTDI_TX","TC_FTDI_RX","TC_FTDI_RTS","TC_FTDI_CTS",
+    "TC_FTDI_DTR","TC_FTDI_DSR","TC_FTDI_DCD","TC_FTDI_RI" } };
+
+/* Frame rate for a given configuration, from bytes per frame. */
+static double frameRate(
+  int    nStrands,
+  int    pixelsPerStrand,
+  int    cbus,
+  double baud)
+{
+	return BYTES_PER_BAUD * baud / (double)TCwireBytes(
+	  nStrands | (cbus ? TC_CBUS_CLOCK : 0),pixelsPerStrand);
+}
+
+/* Longest strand if segments simply fill strands in the order listed,
+   moving to the next strand at about the average length (the obvious
+   hand split), without breaking chains. */
+static int inOrderLength(
+  const TCsegment *seg,
+  int              nSegments,
+  int              nStrands)
+{
+	int i,s,total,target,len,longest;
+
+	for(total=i=0;i<nSegments;i++) total += seg[i].length;
+	target = (total + nStrands - 1) / nStrands;
+
+	for(longest=len=s=i=0;i<nSegments;i++)
+	{
+		if(len && (len + seg[i].length > target) &&
+		   (s < nStrands - 1) &&
+		   ((seg[i].chain < 0) || (seg[i].chain != seg[i - 1].chain)))
+		{
+			s++;
+			len = 0;
+		}
+		len += seg[i].length;
+		if(len > longest) longest = len;
+	}
+
+	return longest;
+}
+
+int main(int argc,char *argv[])
+{
+	int        i,s,n,off,
+	  nStrands        = 0,
+	  cbus            = 0,
+	  nSegments       = 0,
+	  pixelsPerStrand,
+	  lowerBound,
+	  naive,
+	  *remap;
+	double     baud   = 3090000.0;
+	char      *outName = NULL,line[256],*c;
+	FILE      *in,*out;
+	TCsegment *seg;
+	TCstatusCode status;
+
+	while((i = getopt(argc,argv,"s:co:b:")) != -1)
+	{
+		switch(i)
+		{
+		   case 's':
+			nStrands = strtol(optarg,NULL,0);
+			break;
+		   case 'c':
+			cbus     = 1;
+			break;
+		   case 'o':
+			outName  = optarg;
+			break;
+		   case 'b':
+			baud     = strtod(optarg,NULL);
+			break;
+		   case '?':
+		   default:
+			(void)printf("usage: %s [-s strands] [-c] "
+			  "[-o remapfile] [-b baud] [layoutfile]\n",argv[0]);
+			return 1;
+		}
+	}
+
+	if(!nStrands) nStrands = cbus ? 8 : 7;
+	if((nStrands < 1) || (nStrands > (cbus ? 8 : 7)) || (baud <= 0.0))
+	{
+		(void)printf("Strand count must be 1-%d.\n",cbus ? 8 : 7);
+		return 1;
+	}
+
+	if(!(seg = (TCsegment *)malloc(MAX_SEGMENTS * sizeof(TCsegment))))
+	{
+		TCprintError(TC_ERR_MALLOC);
+		return 1;
+	}
+
+	if(optind < argc)
+	{
+		if(!(in = fopen(argv[optind],"r")))
+		{
+			TCprintError(TC_ERR_FILE);
+			return 1;
+		}
+	} else
+	{
+		in = stdin;
+	}
+	while(fgets(line,sizeof(line),in))
+	{
+		if((c = strchr(line,'#'))) *c = 0;
+		if((n = sscanf(line,"%d %d",&seg[nSegments].length,
+		  &seg[nSegments].chain)) < 1) continue;
+		if(n < 2) seg[nSegments].chain = -1;
+		if(++nSegments == MAX_SEGMENTS) break;
+	}
+	if(in != stdin) fclose(in);
+	if(!nSegments)
+	{
+		(void)printf("No segments in layout.\n");
+		return 1;
+	}
+
+	if((status = TCplanStrands(seg,nSegments,nStrands,&pixelsPerStrand,
+	  &lowerBound)) != TC_OK)
+	{
+		TCprintError(status);
+		return 1;
+	}
+
+	(void)printf("%d segments on %d strands:\n\n",nSegments,nStrands);
+	for(s=0;s<nStrands;s++)
+	{
+		for(n=i=0;i<nSegments;i++)
+			if(seg[i].strand == s) n += seg[i].length;
+		(void)printf("  Strand %d: %5d pixels, segments",s,n);
+
+		/* In wiring order, i.e. by offset on the strand */
+		for(off=0;off<n;off+=seg[i].length)
+		{
+			for(i=0;(seg[i].strand != s) ||
+			  (seg[i].offset != off);i++);
+			(void)printf(" %d",i);
+		}
+		(void)printf("\n");
+	}
+
+	(void)printf("\nPins:\n\n");
+	if(!cbus && (nStrands <= 3))
+	{
+		(void)printf(
+		  "  Library defaults (TX, RX, DTR+RTS); clock on CTS\n");
+	} else
+	{
+		for(s=0;s<nStrands;s++)
+			(void)printf("  TCsetStrandPin(%d,%s);\n",s,
+			  pinName[cbus][s]);
+	}
+	(void)printf("  TCopen(%d%s,%d);\n\n",nStrands,
+	  cbus ? " | TC_CBUS_CLOCK" : "",pixelsPerStrand);
+
+	naive = inOrderLength(seg,nSegments,nStrands);
+	(void)printf("Longest strand %d pixels (lower bound %d): %.1f fps\n",
+	  pixelsPerStrand,lowerBound,
+	  frameRate(nStrands,pixelsPerStrand,cbus,baud));
+	(void)printf("Filling strands in listed order: %d pixels, %.1f fps\n",
+	  naive,frameRate(nStrands,naive,cbus,baud));
+
+	if(outName)
+	{
+		n = nStrands * pixelsPerStrand;
+		if(!(remap = (int *)malloc(n * sizeof(int))))
+		{
+			TCprintError(TC_ERR_MALLOC);
+			return 1;
+		}
+		(void)TCplanRemap(seg,nSegments,nStrands,pixelsPerStrand,remap);
+		if(!(out = fopen(outName,"w")))
+		{
+			TCprintError(TC_ERR_FILE);
+			return 1;
+		}
+		fprintf(out,"/* Remap table from plan: TCopen(%d%s,%d) */\n"
+		  "int remap[%d] = {",nStrands,cbus ? " | TC_CBUS_CLOCK" : "",
+		  pixelsPerStrand,n);
+		for(i=0;i<n;i++)
+			fprintf(out,"%s%d%s",(i % 12) ? " " : "\n\t",remap[i],
+			  (i < n - 1) ? "," : "\n};\n");
+		fclose(out);
+		free(remap);
+		(void)printf("Remap table written to %s\n",outName);
+	}
+
+	free(seg);
+	return 0;
+}
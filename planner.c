@@ -0,0 +1,303 @@
+/****************************************************************************
+ File        : planner.c
+
+ Description : Strand planning for the p9813 library.  Frame rate is set by
+               the longest strand (TCopen() pads every strand to the same
+               length), so how a physical layout's segments of pixels are
+               divided among the FTDI data pins matters: a lopsided split
+               can cost up to half the attainable frame rate.  Given the
+               segments' lengths, and which of them are wired in series,
+               TCplanStrands() assigns them to strands so as to minimize
+               the longest, and TCplanRemap() compiles the matching remap
+               table for TCrefresh().
+
+               Balancing is the classic multiprocessor scheduling problem.
+               Groups of segments are placed longest-first on the least
+               loaded strand, then moves and swaps of groups off the
+               longest strand are tried until none helps.  Results are
+               generally optimal or within a few pixels of it for real
+               layouts; TCplanStrands() also reports a lower bound.
+
+ License     : Copyright 2011 Phillip Burgess.    www.PaintYourDragon.com
+
+               This Program is free software: you can redistribute it and/or
+               modify it under the terms of the GNU General Public License as
+               published by the Free Software Foundation, either version 3 of
+               the License, or (at your option) any later version.
+
+               This Program is distributed in the hope that it will be
+               useful, but WITHOUT ANY WARRANTY; without even the implied
+               warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+               PURPOSE.  See the GNU General Public License for more details.
+
+               You should have received a copy of the GNU General Public
+               License along with this Program.  If not, see
+               <http://www.gnu.org/licenses/>.
+
+               Additional permission under GNU GPL version 3 section 7
+
+               If you modify this Program, or any covered work, by linking
+               or combining it with libftd2xx (or a modified version of that
+               library), containing parts covered by the license terms of
+               Future Technology Devices International Limited, the licensors
+               of this Program grant you additional permission to convey the
+               resulting work.
+ ****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include "p9813.h"
+
+/* Segments wired in series (same chain number) must stay together on one
+   strand, so planning works on groups: each chain, or lone segment, is
+   one group. */
+typedef struct {
+	int length,  /* Total pixels in group               */
+	    first,   /* Lowest segment index, for ordering  */
+	    strand;
+} group;
+
+/* Longest group first; ties by segment order, so plans are repeatable. */
+static int groupCompare(const void *a,const void *b)
+{
+	const group *ga = (const group *)a,*gb = (const group *)b;
+
+	if(ga->length != gb->length) return gb->length - ga->length;
+	return ga->first - gb->first;
+}
+
+/* Strand with the greatest (or, if 'least' set, smallest) load. */
+static int extremeStrand(
+  const int *load,
+  int        nStrands,
+  int        least)
+{
+	int s,best = 0;
+
+	for(s=1;s<nStrands;s++)
+	{
+		if(least ? (load[s] < load[best]) : (load[s] > load[best]))
+			best = s;
+	}
+
+	return best;
+}
+
+/* One improvement step: move a group off the longest strand, or swap
+   one there for a shorter group elsewhere, whichever lowers the longer
+   of the two strands involved the most.  Returns 0 if nothing helps. */
+static int improve(
+  group *g,
+  int    nGroups,
+  int   *load,
+  int    nStrands)
+{
+	int i,j,d,peak,top,bestI = -1,bestJ = -1,bestPeak;
+
+	top      = extremeStrand(load,nStrands,0);
+	bestPeak = load[top];
+	for(i=0;i<nGroups;i++)
+	{
+		if(g[i].strand != top) continue;
+
+		/* Move to another strand */
+		for(j=0;j<nStrands;j++)
+		{
+			if(j == top) continue;
+			peak = load[j] + g[i].length;
+			if(load[top] - g[i].length > peak)
+				peak = load[top] - g[i].length;
+			if(peak < bestPeak)
+			{
+				bestPeak = peak;
+				bestI    = i;
+				bestJ    = -1 - j;
+			}
+		}
+
+		/* Swap with a shorter group on another strand */
+		for(j=0;j<nGroups;j++)
+		{
+			if((g[j].strand == top) ||
+			   ((d = g[i].length - g[j].length) <= 0)) continue;
+			peak = load[g[j].strand] + d;
+			if(load[top] - d > peak) peak = load[top] - d;
+			if(peak < bestPeak)
+			{
+				bestPeak = peak;
+				bestI    = i;
+				bestJ    = j;
+			}
+		}
+	}
+	if(bestI < 0) return 0;
+
+	if(bestJ < 0)
+	{
+		j                = -1 - bestJ;
+		load[top]       -= g[bestI].length;
+		load[j]         += g[bestI].length;
+		g[bestI].strand  = j;
+	} else
+	{
+		d                      = g[bestI].length - g[bestJ].length;
+		load[top]             -= d;
+		load[g[bestJ].strand] += d;
+		g[bestI].strand        = g[bestJ].strand;
+		g[bestJ].strand        = top;
+	}
+
+	return 1;
+}
+
+/****************************************************************************
+ Function    : TCplanStrands()
+ Description : Assigns segments of pixels to strands so that the longest
+               strand is as short as possible.  Segments sharing a chain
+               number are wired in series and are kept together on one
+               strand, in the order listed.  On each strand, groups are
+               placed in order of their first segment's position in the
+               list.
+ Parameters  : TCsegment *  Array of segments.  Each one's length and chain
+                            must be set; on return, strand and offset
+                            (position of its first pixel on that strand)
+                            are filled in.
+               int          Number of segments.
+               int          Number of strands available, 1 to 8.
+               int *        Returns the length of the longest strand (the
+                            pixel count to pass to TCopen()).
+               int *        Optional; returns a lower bound on that length
+                            for any plan (NULL if not needed).
+ Returns     : TC_OK on success, TC_ERR_VALUE if invalid parameter received,
+               TC_ERR_MALLOC on malloc() failure.
+ ****************************************************************************/
+TCstatusCode TCplanStrands(
+  TCsegment *seg,
+  int        nSegments,
+  int        nStrands,
+  int       *pixelsPerStrand,
+  int       *lowerBound)
+{
+	group *g;
+	int    i,j,s,nGroups,total,load[8],*groupOf;
+
+	if(!seg || (nSegments < 1) || (nStrands < 1) || (nStrands > 8) ||
+	   !pixelsPerStrand) return TC_ERR_VALUE;
+	for(i=0;i<nSegments;i++)
+		if((seg[i].length < 1) || (seg[i].chain < -1))
+			return TC_ERR_VALUE;
+
+	if(!(g = (group *)malloc(nSegments * (sizeof(group) + sizeof(int)))))
+		return TC_ERR_MALLOC;
+	groupOf = (int *)&g[nSegments];
+
+	/* Collect groups: a chained segment joins the group of the first
+	   earlier segment with the same chain number. */
+	for(nGroups=total=i=0;i<nSegments;i++)
+	{
+		total += seg[i].length;
+		for(j=0;(seg[i].chain >= 0) && (j<i);j++)
+			if(seg[j].chain == seg[i].chain) break;
+		if((seg[i].chain >= 0) && (j < i))
+		{
+			groupOf[i]                = groupOf[j];
+			g[groupOf[i]].length     += seg[i].length;
+		} else
+		{
+			groupOf[i]                = nGroups;
+			g[nGroups].length         = seg[i].length;
+			g[nGroups].first          = i;
+			nGroups++;
+		}
+	}
+
+	/* Longest-first onto the least loaded strand, then refine.  Each
+	   improvement lowers the longest strand or the number of strands
+	   at that length, so this terminates; the cap is just insurance. */
+	qsort(g,nGroups,sizeof(group),groupCompare);
+	bzero(load,sizeof(load));
+	for(i=0;i<nGroups;i++)
+	{
+		s           = extremeStrand(load,nStrands,1);
+		g[i].strand = s;
+		load[s]    += g[i].length;
+	}
+	for(i=0;(i<1000) && improve(g,nGroups,load,nStrands);i++);
+
+	*pixelsPerStrand = load[extremeStrand(load,nStrands,0)];
+	if(lowerBound)
+	{
+		*lowerBound = (total + nStrands - 1) / nStrands;
+		if(g[0].length > *lowerBound) *lowerBound = g[0].length;
+	}
+
+	/* Lay out each strand, groups in order of their first segment.
+	   Groups were sorted, so they're found by that segment.  A chain's
+	   segments follow one another, even if listed among others. */
+	for(i=0;i<nSegments;i++) groupOf[i] = -1;
+	for(i=0;i<nGroups;i++)   groupOf[g[i].first] = i;
+	bzero(load,sizeof(load));
+	for(i=0;i<nSegments;i++)
+	{
+		if(groupOf[i] < 0) continue;  /* Placed with its chain */
+		s = g[groupOf[i]].strand;
+		for(j=i;j<nSegments;j++)
+		{
+			if((j > i) && ((seg[i].chain < 0) ||
+			   (seg[j].chain != seg[i].chain))) continue;
+			seg[j].strand  = s;
+			seg[j].offset  = load[s];
+			load[s]       += seg[j].length;
+			if(seg[i].chain < 0) break;
+		}
+	}
+
+	free(g);
+	return TC_OK;
+}
+
+/****************************************************************************
+ Function    : TCplanRemap()
+ Description : Compiles the remap table for a plan from TCplanStrands().
+               The image passed to TCrefresh() is taken to hold the
+               segments' pixels in the order the segments are listed
+               (all of segment 0, then all of segment 1, and so forth).
+               Positions past the end of each strand are marked
+               TC_PIXEL_DISCONNECTED.
+ Parameters  : const TCsegment *  Segments, with strand and offset filled
+                                  in by TCplanStrands().
+               int                Number of segments.
+               int                Number of strands.
+               int                Pixels per strand.
+               int *              Destination remap table, nStrands *
+                                  pixelsPerStrand elements.
+ Returns     : TC_OK on success, TC_ERR_VALUE if invalid parameter received.
+ ****************************************************************************/
+TCstatusCode TCplanRemap(
+  const TCsegment *seg,
+  int              nSegments,
+  int              nStrands,
+  int              pixelsPerStrand,
+  int             *remap)
+{
+	int i,p,n,base;
+
+	if(!seg || !remap || (nSegments < 1) || (nStrands < 1) ||
+	   (pixelsPerStrand < 1)) return TC_ERR_VALUE;
+
+	n = nStrands * pixelsPerStrand;
+	for(i=0;i<n;i++) remap[i] = TC_PIXEL_DISCONNECTED;
+
+	for(base=i=0;i<nSegments;base+=seg[i++].length)
+	{
+		if((seg[i].strand < 0) || (seg[i].strand >= nStrands) ||
+		   (seg[i].offset < 0) ||
+		   (seg[i].offset + seg[i].length > pixelsPerStrand))
+			return TC_ERR_VALUE;
+		for(p=0;p<seg[i].length;p++)
+			remap[seg[i].strand * pixelsPerStrand +
+			  seg[i].offset + p] = base + p;
+	}
+
+	return TC_OK;
+}
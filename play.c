@@ -0,0 +1,221 @@
+/****************************************************************************
+ File        : play.c
+
+ Description : Show player for the p9813 library.  Plays a show file (see
+               TCshowCreate()) on the display with its original timing.
+               Flight recordings (see TCrecordStart()) carry their strand
+               configuration and pin assignments, and are played exactly
+               as they were first issued: gamma is disabled and no remap
+               table is used, so each pixel receives the same bits it did
+               the first time.
+               Ordinary shows are divided evenly among the strands given,
+               with the library's default gamma.
+
+               Example calling sequences:
+
+               play flight.tcs
+               play -s 4 -c -l myshow.tcs
+               play -F -o replay.bin flight.tcs
+
+               -s  Number of strands, for ordinary shows (default 1).
+               -c  Hardware (CBUS) clock, as with TC_CBUS_CLOCK, for
+                   ordinary shows.
+               -l  Loop the show until interrupted.
+               -F  Play as fast as possible, ignoring the show's timing.
+               -o  Write the output bytes to this file (as the "capture"
+                   program does) instead of the FTDI adapter.
+
+ License     : Copyright 2011 Phillip Burgess.    www.PaintYourDragon.com
+
+               This Program is free software: you can redistribute it and/or
+               modify it under the terms of the GNU General Public License as
+               published by the Free Software Foundation, either version 3 of
+               the License, or (at your option) any later version.
+
+               This Program is distributed in the hope that it will be
+               useful, but WITHOUT ANY WARRANTY; without even the implied
+               warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+               PURPOSE.  See the GNU General Public License for more details.
+
+               You should have received a copy of the GNU General Public
+               License along with this Program.  If not, see
+               <http://www.gnu.org/licenses/>.
+
+               Additional permission under GNU GPL version 3 section 7
+
+               If you modify this Program, or any covered work, by linking
+               or combining it with libftd2xx (or a modified version of that
+               library), containing parts covered by the license terms of
+               Future Technology Devices International Limited, the licensors
+               of this Program grant you additional permission to convey the
+               resulting work.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "p9813.h"
+
+static unsigned long long usecNow(void)
+{
+	struct timeval t;
+
+	gettimeofday(&t,NULL);
+	return (unsigned long long)t.tv_sec * 1000000 + t.tv_usec;
+}
+
+/* File sink, for -o */
+static TCstatusCode fileSink(
+  const unsigned char *data,
+  int                  len,
+  void                *arg)
+{
+	return (1 == fwrite(data,len,1,(FILE *)arg)) ? TC_OK : TC_ERR_WRITE;
+}
+
+int main(int argc,char *argv[])
+{
+	int                i,nPixels,
+	  strands         = 1,
+	  cbus            = 0,
+	  loop            = 0,
+	  fast            = 0,
+	  nStrands,
+	  pixelsPerStrand;
+	unsigned long      frames = 0;
+	unsigned long long usec,start = 0,now;
+	unsigned char      recorded;
+	char              *outName = NULL;
+	FILE              *out     = NULL;
+	TCshow            *show;
+	TCpixel           *pixelBuf;
+	TCstatusCode       status;
+
+	while((i = getopt(argc,argv,"s:clFo:")) != -1)
+	{
+		switch(i)
+		{
+		   case 's':
+			strands = strtol(optarg,NULL,0);
+			break;
+		   case 'c':
+			cbus    = 1;
+			break;
+		   case 'l':
+			loop    = 1;
+			break;
+		   case 'F':
+			fast    = 1;
+			break;
+		   case 'o':
+			outName = optarg;
+			break;
+		   case '?':
+		   default:
+			(void)printf("usage: %s [-s strands] [-c] [-l] [-F] "
+			  "[-o outfile] showfile\n",argv[0]);
+			return 1;
+		}
+	}
+
+	if(optind >= argc)
+	{
+		(void)printf("No show file given.\n");
+		return 1;
+	}
+	if(!(show = TCshowOpen(argv[optind])))
+	{
+		TCprintError(TC_ERR_FILE);
+		return 1;
+	}
+	nPixels = TCshowPixels(show);
+
+	/* A recording says how it was issued; otherwise divide the show's
+	   pixels among the strands asked for. */
+	if((recorded = TCshowStrands(show)))
+	{
+		if(recorded & TC_MPSSE)           nStrands = 1;
+		else if(recorded > TC_CBUS_CLOCK) nStrands = recorded -
+		                                    TC_CBUS_CLOCK;
+		else                              nStrands = recorded;
+
+		/* Pins, too, must be as recorded, and before TCopen() */
+		for(i=0;i<8;i++)
+		{
+			if(TCshowStrandPin(show,i))
+				(void)TCsetStrandPin(i,TCshowStrandPin(show,i));
+		}
+	} else
+	{
+		if((strands < 1) || (strands > (cbus ? 8 : 7)))
+		{
+			(void)printf("Strand count must be 1-%d.\n",
+			  cbus ? 8 : 7);
+			return 1;
+		}
+		nStrands = strands;
+		recorded = strands | (cbus ? TC_CBUS_CLOCK : 0);
+	}
+	pixelsPerStrand = (nPixels + nStrands - 1) / nStrands;
+
+	if(NULL == (pixelBuf = (TCpixel *)calloc(
+	  nStrands * pixelsPerStrand,sizeof(TCpixel))))
+	{
+		TCprintError(TC_ERR_MALLOC);
+		return 1;
+	}
+
+	if(outName)
+	{
+		if(!(out = fopen(outName,"wb")))
+		{
+			TCprintError(TC_ERR_FILE);
+			return 1;
+		}
+		TCsetSink(fileSink,out);
+	}
+	if((status = TCopen(recorded,pixelsPerStrand)) != TC_OK)
+	{
+		TCprintError(status);
+		if(status < TC_ERR_DIVISOR) return 1;
+	}
+	if(TCshowStrands(show)) TCdisableGamma();
+
+	(void)printf("%s: %d pixels, %d strand(s) x %d%s\n",argv[optind],
+	  nPixels,nStrands,pixelsPerStrand,TCshowStrands(show) ?
+	  ", recorded output" : "");
+
+	for(;;)
+	{
+		while(TC_OK == (status = TCshowRead(show,pixelBuf,&usec)))
+		{
+			if(!start) start = usecNow();
+			if(!fast && ((now = usecNow()) < start + usec))
+				usleep((useconds_t)(start + usec - now));
+			if((status = TCrefresh(pixelBuf,NULL,NULL)) != TC_OK)
+				break;
+			frames++;
+		}
+		if((status != TC_END_OF_SHOW) || !loop) break;
+
+		/* Start over */
+		TCshowClose(show);
+		if(!(show = TCshowOpen(argv[optind])))
+		{
+			status = TC_ERR_FILE;
+			break;
+		}
+		start = 0;
+	}
+	if(status != TC_END_OF_SHOW) TCprintError(status);
+
+	TCclose();
+	if(show) TCshowClose(show);  /* NULL if reopening for -l failed */
+	if(out) fclose(out);
+	(void)printf("%lu frames played\n",frames);
+
+	free(pixelBuf);
+	return 0;
+}
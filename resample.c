@@ -0,0 +1,344 @@
+/****************************************************************************
+ File        : resample.c
+
+ Description : Image resampling for the p9813 library.  Reduces a video
+               frame (packed 8-bit RGB, as from "ffmpeg -f rawvideo
+               -pix_fmt rgb24") to the pixel grid of an LED display by area
+               averaging: each LED shows the mean of the source pixels its
+               cell covers, weighted by how much of each is covered, which
+               is free of the aliasing and flicker of point sampling.
+
+               The sampling kernel is separable and computed once, in
+               TCresampleCreate(), as a short list of source pixels and
+               fixed-point weights for each destination column and row.
+               Per frame, each source row needed is reduced horizontally
+               to the destination width, then rows are summed vertically;
+               all integer arithmetic in simple loops over contiguous
+               arrays, which compilers vectorize.  Destination rows are
+               divided among worker threads, which sleep between frames.
+
+ License     : Copyright 2011 Phillip Burgess.    www.PaintYourDragon.com
+
+               This Program is free software: you can redistribute it and/or
+               modify it under the terms of the GNU General Public License as
+               published by the Free Software Foundation, either version 3 of
+               the License, or (at your option) any later version.
+
+               This Program is distributed in the hope that it will be
+               useful, but WITHOUT ANY WARRANTY; without even the implied
+               warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+               PURPOSE.  See the GNU General Public License for more details.
+
+               You should have received a copy of the GNU General Public
+               License along with this Program.  If not, see
+               <http://www.gnu.org/licenses/>.
+
+               Additional permission under GNU GPL version 3 section 7
+
+               If you modify this Program, or any covered work, by linking
+               or combining it with libftd2xx (or a modified version of that
+               library), containing parts covered by the license terms of
+               Future Technology Devices International Limited, the licensors
+               of this Program grant you additional permission to convey the
+               resulting work.
+ ****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "p9813.h"
+
+/* Weights per axis sum to 1 << WEIGHT_BITS, so a full two-axis sum of
+   255 * (1 << WEIGHT_BITS) squared still fits in 32 bits. */
+#define WEIGHT_BITS 12
+#define MAX_THREADS 32
+
+/* Color component from a two-axis sum, rounded. */
+#define SUM_BYTE(S) \
+	(((S) + (1UL << (2 * WEIGHT_BITS - 1))) >> (2 * WEIGHT_BITS))
+
+/* Kernel for one axis: destination index i takes 'count[i]' source
+   pixels from 'first[i]', with weights from 'weight[index[i]]'. */
+typedef struct {
+	int      *first,
+	         *count,
+	         *index;
+	uint16_t *weight;
+} axisKernel;
+
+/* Per-thread state: destination rows to do, and working space. */
+typedef struct {
+	TCresampler *r;
+	pthread_t    thread;
+	int          row0,row1;   /* Destination rows, row0 <= y < row1  */
+	uint32_t    *sum,         /* Vertical sums, 3 per dest column    */
+	            *h;           /* One source row, reduced horizontally */
+} worker;
+
+struct TCresampler {
+	int                  srcWidth,srcHeight,dstWidth,dstHeight,
+	                     nThreads,
+	                     busy,        /* Workers still on this frame   */
+	                     running;
+	unsigned long        generation;  /* Bumped for each frame         */
+	axisKernel           x,y;
+	const unsigned char *src;         /* Current frame                 */
+	int                  stride;
+	TCpixel             *dst;
+	pthread_mutex_t      lock;
+	pthread_cond_t       start,done;
+	worker               w[MAX_THREADS];
+};
+
+/* Builds the kernel for one axis, reducing 'src' pixels to 'dst'.  In
+   units of 1/dst source pixels, destination pixel i spans [i*src,
+   (i+1)*src), so coverage is exact; rounding error in the weights is
+   given to the largest, so each destination's weights sum exactly to
+   1 << WEIGHT_BITS. */
+static int axisInit(
+  axisKernel *k,
+  int         src,
+  int         dst)
+{
+	int       i,j,n,big,total;
+	long      w;
+	long long start,end,lo,hi;  /* Up to src * dst, past 32 bits */
+
+	n = dst * (src / dst + 2);  /* Most source pixels any dest covers */
+	if(!(k->first = (int *)malloc(dst * 3 * sizeof(int) +
+	  n * sizeof(uint16_t)))) return 0;
+	k->count  = &k->first[dst];
+	k->index  = &k->count[dst];
+	k->weight = (uint16_t *)&k->index[dst];
+
+	for(n=i=0;i<dst;i++)
+	{
+		start       = (long long)i * src;
+		end         = start + src;
+		k->first[i] = start / dst;
+		k->count[i] = (end + dst - 1) / dst - k->first[i];
+		k->index[i] = n;
+		for(big=total=j=0;j<k->count[i];j++)
+		{
+			lo = (long long)(k->first[i] + j) * dst;
+			hi = lo + dst;
+			if(lo < start) lo = start;
+			if(hi > end)   hi = end;
+			w  = ((long)(hi - lo) << WEIGHT_BITS) / src;
+			k->weight[n + j] = (uint16_t)w;
+			total           += w;
+			if(w > k->weight[n + big]) big = j;
+		}
+		k->weight[n + big] += (1 << WEIGHT_BITS) - total;
+		n += k->count[i];
+	}
+
+	return 1;
+}
+
+/* Resamples destination rows row0 to row1-1 of the current frame. */
+static void resampleRows(
+  TCresampler *r,
+  worker      *w,
+  int          row0,
+  int          row1)
+{
+	int                  x,y,i,j,n;
+	uint32_t             cr,cg,cb,wt;
+	const unsigned char *row,*p;
+	const uint16_t      *wx;
+	TCpixel             *out;
+
+	for(y=row0;y<row1;y++)
+	{
+		bzero(w->sum,r->dstWidth * 3 * sizeof(uint32_t));
+		for(j=0;j<r->y.count[y];j++)
+		{
+			row = r->src + (r->y.first[y] + j) * r->stride;
+			for(x=0;x<r->dstWidth;x++)
+			{
+				p  = &row[r->x.first[x] * 3];
+				wx = &r->x.weight[r->x.index[x]];
+				n  = r->x.count[x];
+				for(cr=cg=cb=i=0;i<n;i++,p+=3)
+				{
+					cr += wx[i] * p[0];
+					cg += wx[i] * p[1];
+					cb += wx[i] * p[2];
+				}
+				w->h[x * 3    ] = cr;
+				w->h[x * 3 + 1] = cg;
+				w->h[x * 3 + 2] = cb;
+			}
+			wt = r->y.weight[r->y.index[y] + j];
+			for(i=r->dstWidth*3-1;i>=0;i--)
+				w->sum[i] += wt * w->h[i];
+		}
+
+		out = &r->dst[y * r->dstWidth];
+		for(x=0;x<r->dstWidth;x++)
+			out[x] = TCrgb(SUM_BYTE(w->sum[x * 3    ]),
+			               SUM_BYTE(w->sum[x * 3 + 1]),
+			               SUM_BYTE(w->sum[x * 3 + 2]));
+	}
+}
+
+/* Worker thread: waits for each new frame, does its share of rows. */
+static void *workerLoop(void *arg)
+{
+	worker        *w = (worker *)arg;
+	TCresampler   *r = w->r;
+	unsigned long  seen = 0;
+
+	pthread_mutex_lock(&r->lock);
+	for(;;)
+	{
+		while(r->running && (r->generation == seen))
+			pthread_cond_wait(&r->start,&r->lock);
+		if(!r->running) break;
+		seen = r->generation;
+		pthread_mutex_unlock(&r->lock);
+
+		resampleRows(r,w,w->row0,w->row1);
+
+		pthread_mutex_lock(&r->lock);
+		if(!--r->busy) pthread_cond_signal(&r->done);
+	}
+	pthread_mutex_unlock(&r->lock);
+
+	return NULL;
+}
+
+/****************************************************************************
+ Function    : TCresampleCreate()
+ Description : Prepares to resample frames of one size to another by area
+               averaging.  The destination is normally the smaller (for
+               an LED display, the width and height of its pixel grid),
+               though enlarging works too.
+ Parameters  : int  Source width in pixels.
+               int  Source height.
+               int  Destination width.
+               int  Destination height.
+               int  Number of threads to use, including the caller of
+                    TCresample(); 1 for none.
+ Returns     : Resampler handle, or NULL on error.
+ ****************************************************************************/
+TCresampler *TCresampleCreate(
+  int srcWidth,
+  int srcHeight,
+  int dstWidth,
+  int dstHeight,
+  int nThreads)
+{
+	TCresampler *r;
+	int          i;
+
+	if((srcWidth < 1) || (srcHeight < 1) || (dstWidth < 1) ||
+	   (dstHeight < 1) || (srcWidth > 0x10000) || (srcHeight > 0x10000) ||
+	   (dstWidth > 0x10000) || (dstHeight > 0x10000) || (nThreads < 1))
+		return NULL;
+	if(nThreads > MAX_THREADS) nThreads = MAX_THREADS;
+	if(nThreads > dstHeight)   nThreads = dstHeight;
+
+	if(!(r = (TCresampler *)calloc(1,sizeof(TCresampler)))) return NULL;
+	r->srcWidth  = srcWidth;
+	r->srcHeight = srcHeight;
+	r->dstWidth  = dstWidth;
+	r->dstHeight = dstHeight;
+	r->running   = 1;
+	pthread_mutex_init(&r->lock,NULL);
+	pthread_cond_init(&r->start,NULL);
+	pthread_cond_init(&r->done,NULL);
+
+	if(!axisInit(&r->x,srcWidth,dstWidth) ||
+	   !axisInit(&r->y,srcHeight,dstHeight))
+	{
+		TCresampleDestroy(r);
+		return NULL;
+	}
+
+	/* Thread 0 is the caller; the rest are started here. */
+	for(i=0;i<nThreads;i++)
+	{
+		r->w[i].r    = r;
+		r->w[i].row0 = dstHeight * i / nThreads;
+		r->w[i].row1 = dstHeight * (i + 1) / nThreads;
+		if(!(r->w[i].sum = (uint32_t *)malloc(
+		  dstWidth * 6 * sizeof(uint32_t))) || (i &&
+		   pthread_create(&r->w[i].thread,NULL,workerLoop,&r->w[i])))
+		{
+			TCresampleDestroy(r);
+			return NULL;
+		}
+		r->w[i].h = &r->w[i].sum[dstWidth * 3];
+		r->nThreads++;
+	}
+
+	return r;
+}
+
+/****************************************************************************
+ Function    : TCresample()
+ Description : Resamples one frame.  Returns when the whole destination
+               image is done.  Must not be called from more than one
+               thread at once on the same resampler.
+ Parameters  : TCresampler *          Resampler from TCresampleCreate().
+               const unsigned char *  Source frame: rows of packed R,G,B
+                                      bytes.
+               int                    Bytes from one source row to the
+                                      next, or 0 for 3 * width.
+               TCpixel *              Destination image, row by row.
+ Returns     : void
+ ****************************************************************************/
+void TCresample(
+  TCresampler         *r,
+  const unsigned char *src,
+  int                  stride,
+  TCpixel             *dst)
+{
+	pthread_mutex_lock(&r->lock);
+	r->src    = src;
+	r->stride = stride ? stride : r->srcWidth * 3;
+	r->dst    = dst;
+	r->busy   = r->nThreads - 1;
+	r->generation++;
+	pthread_cond_broadcast(&r->start);
+	pthread_mutex_unlock(&r->lock);
+
+	resampleRows(r,&r->w[0],r->w[0].row0,r->w[0].row1);
+
+	pthread_mutex_lock(&r->lock);
+	while(r->busy) pthread_cond_wait(&r->done,&r->lock);
+	pthread_mutex_unlock(&r->lock);
+}
+
+/****************************************************************************
+ Function    : TCresampleDestroy()
+ Description : Stops a resampler's threads and frees it.
+ Parameters  : TCresampler *  Resampler from TCresampleCreate().
+ Returns     : void
+ ****************************************************************************/
+void TCresampleDestroy(TCresampler *r)
+{
+	int i;
+
+	pthread_mutex_lock(&r->lock);
+	r->running = 0;
+	pthread_cond_broadcast(&r->start);
+	pthread_mutex_unlock(&r->lock);
+
+	for(i=0;i<r->nThreads;i++)
+	{
+		if(i) pthread_join(r->w[i].thread,NULL);
+		free(r->w[i].sum);
+	}
+	/* Partly constructed: a buffer allocated, thread not started */
+	if((i < MAX_THREADS) && r->w[i].sum) free(r->w[i].sum);
+
+	free(r->x.first);
+	free(r->y.first);
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->start);
+	pthread_cond_destroy(&r->done);
+	free(r);
+}
@@ -0,0 +1,385 @@
+/****************************************************************************
+ File        : show.c
+
+ Description : Reading and writing "show" files for the p9813 library:
+               recorded sequences of TCpixel frames with timestamps, for
+               offline simulation, flight recording and playback.
+
+               File layout (all integers little-endian):
+
+                 Header   8 bytes  "TCSHOW1\0"
+                          4 bytes  Pixels per frame
+                          4 bytes  Strands: for recordings of library
+                                   output, the TCopen() strand parameter;
+                                   else 0
+                          8 bytes  Recordings of library output only:
+                                   pin mask for strands 0-7 (see
+                                   TCsetStrandPin())
+                 Frames   8 bytes  Timestamp, microseconds from start
+                          1 byte   'K' (keyframe) or 'D' (delta)
+                          Keyframe: 4 bytes per pixel, TCpixel values
+                          Delta:    4 bytes count, then count pairs of
+                                    4 byte pixel index, 4 byte TCpixel
+
+               A delta frame lists only the pixels that changed from the
+               prior frame.  The writer chooses whichever form is smaller
+               for each frame, so mostly-static content stays compact.
+
+               Recordings of library output (flight recordings, see
+               TCrecordStart()) hold each frame as issued: in strand
+               order, after remapping, gamma, correction and current
+               limiting.  Played back on the recorded pins with gamma
+               disabled and no remap table, they reproduce the original
+               output bit for bit.
+
+ License     : Copyright 2011 Phillip Burgess.    www.PaintYourDragon.com
+
+               This Program is free software: you can redistribute it and/or
+               modify it under the terms of the GNU General Public License as
+               published by the Free Software Foundation, either version 3 of
+               the License, or (at your option) any later version.
+
+               This Program is distributed in the hope that it will be
+               useful, but WITHOUT ANY WARRANTY; without even the implied
+               warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+               PURPOSE.  See the GNU General Public License for more details.
+
+               You should have received a copy of the GNU General Public
+               License along with this Program.  If not, see
+               <http://www.gnu.org/licenses/>.
+
+               Additional permission under GNU GPL version 3 section 7
+
+               If you modify this Program, or any covered work, by linking
+               or combining it with libftd2xx (or a modified version of that
+               library), containing parts covered by the license terms of
+               Future Technology Devices International Limited, the licensors
+               of this Program grant you additional permission to convey the
+               resulting work.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "p9813.h"
+
+#define SHOW_MAGIC "TCSHOW1"
+
+struct TCshow {
+	FILE          *fp;
+	int            nPixels,
+	               writing;
+	unsigned char  strands,  /* See TCshowStrands()                  */
+	               pins[8];  /* See TCshowStrandPin()                */
+	TCpixel       *prev;     /* Prior frame, for delta coding        */
+	unsigned char *io;       /* Staging buffer for file reads/writes */
+};
+
+static void put32(unsigned char *p,uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Allocate show structure with frame and I/O buffers.  The I/O buffer
+   is sized for the worst case, a delta frame touching every pixel. */
+static TCshow *showAlloc(
+  FILE *fp,
+  int   nPixels,
+  int   writing)
+{
+	TCshow *show;
+
+	if((show = (TCshow *)malloc(sizeof(TCshow) +
+	  nPixels * (sizeof(TCpixel) + 8))))
+	{
+		show->fp      = fp;
+		show->nPixels = nPixels;
+		show->writing = writing;
+		show->strands = 0;
+		bzero(show->pins,sizeof(show->pins));
+		show->prev    = (TCpixel *)&show[1];
+		show->io      = (unsigned char *)&show->prev[nPixels];
+		bzero(show->prev,nPixels * sizeof(TCpixel));
+	}
+
+	return show;
+}
+
+/* Creates a show file, with header, for writing. */
+static TCshow *showCreate(
+  const char    *filename,
+  int            nPixels,
+  unsigned char  strands)
+{
+	FILE          *fp;
+	TCshow        *show;
+	unsigned char  header[24];
+	int            i;
+
+	if(nPixels < 1) return NULL;
+
+	if((fp = fopen(filename,"wb")))
+	{
+		/* Recordings of output carry the pins they were issued on */
+		memcpy(header,SHOW_MAGIC,8);
+		put32(&header[8],nPixels);
+		put32(&header[12],strands);
+		for(i=0;i<8;i++) header[16 + i] = TCgetStrandPin(i);
+		if((1 == fwrite(header,strands ? 24 : 16,1,fp)) &&
+		   (show = showAlloc(fp,nPixels,1)))
+		{
+			show->strands = strands;
+			if(strands) memcpy(show->pins,&header[16],8);
+			return show;
+		}
+		fclose(fp);
+	}
+
+	return NULL;
+}
+
+/****************************************************************************
+ Function    : TCshowCreate()
+ Description : Creates a new show file for writing with TCshowWrite().
+ Parameters  : const char *  Filename.
+               int           Number of pixels in each frame.
+ Returns     : Show handle, or NULL on error.
+ ****************************************************************************/
+TCshow *TCshowCreate(
+  const char *filename,
+  int         nPixels)
+{
+	return showCreate(filename,nPixels,0);
+}
+
+/****************************************************************************
+ Function    : TCshowCreateOutput()
+ Description : Creates a new show file for a recording of library output:
+               frames as issued to the strands, after remapping, gamma and
+               so forth (see TCrecordStart()).  The strand configuration
+               and the current pin assignments (see TCsetStrandPin()) are
+               stored with it, for playback.
+ Parameters  : const char *    Filename.
+               unsigned char   Strands, as passed to TCopen().
+               int             Number of pixels in each frame (all
+                               strands).
+ Returns     : Show handle, or NULL on error.
+ ****************************************************************************/
+TCshow *TCshowCreateOutput(
+  const char    *filename,
+  unsigned char  strands,
+  int            nPixels)
+{
+	if(!strands) return NULL;
+
+	return showCreate(filename,nPixels,strands);
+}
+
+/****************************************************************************
+ Function    : TCshowOpen()
+ Description : Opens an existing show file for reading with TCshowRead().
+ Parameters  : const char *  Filename.
+ Returns     : Show handle, or NULL on error (including if the file is
+               not a show file).
+ ****************************************************************************/
+TCshow *TCshowOpen(const char *filename)
+{
+	FILE          *fp;
+	TCshow        *show;
+	unsigned char  header[24];
+	uint32_t       n;
+
+	if((fp = fopen(filename,"rb")))
+	{
+		if((1 == fread(header,16,1,fp)) &&
+		   !memcmp(header,SHOW_MAGIC,8) &&
+		   ((n = get32(&header[8])) > 0) && (n < 0x10000000) &&
+		   (get32(&header[12]) < 256) &&
+		   (!get32(&header[12]) || (1 == fread(&header[16],8,1,fp))) &&
+		   (show = showAlloc(fp,n,0)))
+		{
+			show->strands = get32(&header[12]);
+			if(show->strands) memcpy(show->pins,&header[16],8);
+			return show;
+		}
+		fclose(fp);
+	}
+
+	return NULL;
+}
+
+/****************************************************************************
+ Function    : TCshowPixels()
+ Description : Returns the number of pixels in each frame of a show.
+ Parameters  : TCshow *  Show handle.
+ Returns     : Pixels per frame.
+ ****************************************************************************/
+int TCshowPixels(TCshow *show)
+{
+	return show->nPixels;
+}
+
+/****************************************************************************
+ Function    : TCshowStrands()
+ Description : For a recording of library output (see TCshowCreateOutput()),
+               returns the strand configuration it was recorded with.  To
+               reproduce the output exactly, assign the recorded pins (see
+               TCshowStrandPin()), pass this to TCopen() (with
+               TCshowPixels() divided among the strands), disable gamma and
+               refresh without a remap table.
+ Parameters  : TCshow *  Show handle.
+ Returns     : Strands, as passed to TCopen(); 0 if an ordinary show.
+ ****************************************************************************/
+unsigned char TCshowStrands(TCshow *show)
+{
+	return show->strands;
+}
+
+/****************************************************************************
+ Function    : TCshowStrandPin()
+ Description : For a recording of library output, returns the pin(s) a
+               strand was assigned when it was recorded, for passing to
+               TCsetStrandPin() before TCopen().
+ Parameters  : TCshow *  Show handle.
+               int       Strand number (0-7).
+ Returns     : Pin bitmask; 0 if an ordinary show or invalid strand number.
+ ****************************************************************************/
+unsigned char TCshowStrandPin(
+  TCshow *show,
+  int     strand)
+{
+	return ((strand < 0) || (strand > 7)) ? 0 : show->pins[strand];
+}
+
+/****************************************************************************
+ Function    : TCshowWrite()
+ Description : Appends a frame to a show file, delta-coded against the
+               prior frame if that's smaller.
+ Parameters  : TCshow *             Show handle from TCshowCreate().
+               const TCpixel *      Frame data, TCshowPixels() elements.
+               unsigned long long   Timestamp in microseconds.
+ Returns     : TC_OK on success, TC_ERR_FILE on write error.
+ ****************************************************************************/
+TCstatusCode TCshowWrite(
+  TCshow             *show,
+  const TCpixel      *pixels,
+  unsigned long long  usec)
+{
+	int            i,n,len;
+	unsigned char  head[9],*p;
+
+	if(!show->writing) return TC_ERR_VALUE;
+
+	for(i=0;i<8;i++) head[i] = (unsigned char)(usec >> (i * 8));
+
+	/* Build delta list, bailing out to a keyframe as soon as it
+	   would be the larger of the two. */
+	for(n=i=0,p=&show->io[4];i<show->nPixels;i++)
+	{
+		if(pixels[i] != show->prev[i])
+		{
+			if(++n > show->nPixels / 2) break;
+			put32(p,i);
+			put32(&p[4],pixels[i]);
+			p += 8;
+		}
+	}
+
+	if(i < show->nPixels)
+	{
+		head[8] = 'K';
+		for(i=0,p=show->io;i<show->nPixels;i++,p+=4)
+			put32(p,pixels[i]);
+		len = show->nPixels * 4;
+	} else
+	{
+		head[8] = 'D';
+		put32(show->io,n);
+		len = 4 + n * 8;
+	}
+	memcpy(show->prev,pixels,show->nPixels * sizeof(TCpixel));
+
+	return ((1 == fwrite(head,sizeof(head),1,show->fp)) &&
+	        (1 == fwrite(show->io,len,1,show->fp))) ? TC_OK : TC_ERR_FILE;
+}
+
+/****************************************************************************
+ Function    : TCshowRead()
+ Description : Reads the next frame from a show file.
+ Parameters  : TCshow *             Show handle from TCshowOpen().
+               TCpixel *            Destination for frame data,
+                                    TCshowPixels() elements.
+               unsigned long long * Destination for frame timestamp in
+                                    microseconds (may be NULL).
+ Returns     : TC_OK on success, TC_END_OF_SHOW if no more frames,
+               TC_ERR_FILE on read error or corrupt file.
+ ****************************************************************************/
+TCstatusCode TCshowRead(
+  TCshow             *show,
+  TCpixel            *pixels,
+  unsigned long long *usec)
+{
+	int                i;
+	uint32_t           n,idx;
+	unsigned char      head[9],*p;
+	unsigned long long t;
+
+	if(show->writing) return TC_ERR_VALUE;
+
+	if(1 != fread(head,sizeof(head),1,show->fp))
+		return feof(show->fp) ? TC_END_OF_SHOW : TC_ERR_FILE;
+
+	for(t=0,i=7;i>=0;i--) t = (t << 8) | head[i];
+	if(usec) *usec = t;
+
+	if('K' == head[8])
+	{
+		if(1 != fread(show->io,show->nPixels * 4,1,show->fp))
+			return TC_ERR_FILE;
+		for(i=0,p=show->io;i<show->nPixels;i++,p+=4)
+			show->prev[i] = get32(p);
+	} else if('D' == head[8])
+	{
+		if((1 != fread(show->io,4,1,show->fp)) ||
+		   ((n = get32(show->io)) > (uint32_t)show->nPixels) ||
+		   (n && (1 != fread(show->io,n * 8,1,show->fp))))
+			return TC_ERR_FILE;
+		for(p=show->io;n--;p+=8)
+		{
+			if((idx = get32(p)) >= (uint32_t)show->nPixels)
+				return TC_ERR_FILE;
+			show->prev[idx] = get32(&p[4]);
+		}
+	} else
+	{
+		return TC_ERR_FILE;
+	}
+
+	memcpy(pixels,show->prev,show->nPixels * sizeof(TCpixel));
+	return TC_OK;
+}
+
+/****************************************************************************
+ Function    : TCshowClose()
+ Description : Closes a show file and frees associated memory.
+ Parameters  : TCshow *  Show handle.
+ Returns     : TC_OK on success, TC_ERR_FILE if buffered data couldn't be
+               written.
+ ****************************************************************************/
+TCstatusCode TCshowClose(TCshow *show)
+{
+	int status;
+
+	status = fclose(show->fp);
+	free(show);
+
+	return status ? TC_ERR_FILE : TC_OK;
+}
@@ -0,0 +1,376 @@
+/****************************************************************************
+ File        : simulate.c
+
+ Description : Offline power and throughput simulator for the p9813
+               library.  Runs a recorded show file, or one of the demo
+               patterns, through the same gamma and current model used by
+               TCrefresh(), without an FTDI adapter or any pixels attached.
+               For each strand configuration requested, reports the bytes
+               issued per frame, the resulting maximum frame rate at a
+               given baud rate, and peak, per-strand peak and average
+               current along with total charge used.  This is intended
+               for sizing power supplies and choosing strand counts before
+               the hardware exists, and runs far faster than real time.
+
+               Example calling sequences:
+
+               simulate -f show.tcs -s 1,2,4,8
+               simulate -g 1 -n 8000 -t 3600 -r 30 -s 4,7 -c
+
+               -f  Show file to simulate (see TCshowCreate()).  Frame
+                   timing comes from the file's timestamps.
+               -g  Pattern to generate instead of a show file: 0 = sine
+                   waves, 1 = plasma, 2 = noise, 3 = gradients, 4 = palette
+                   cycling (as in the "demo" program), 5 = solid white.
+               -n  Total pixel count for generated patterns (default 100).
+               -t  Duration of generated patterns in seconds (default 60).
+               -r  Frame rate of generated patterns (default 30).
+               -s  Comma-separated list of strand counts to evaluate
+                   (default 1).  Pixels are divided evenly among strands.
+               -b  FTDI baud rate (default 3090000, as used by TCopen()).
+               -c  Assume hardware (CBUS) clock, as with TC_CBUS_CLOCK.
+               -v  Print current estimate for every frame.
+
+               Gamma is the library default; current figures assume the
+               calibration in calibration.h.  Charge is integrated over
+               the show's own frame timing, while maximum frame rate is
+               what the wire could sustain regardless of that timing.
+
+ License     : Copyright 2011 Phillip Burgess.    www.PaintYourDragon.com
+
+               This Program is free software: you can redistribute it and/or
+               modify it under the terms of the GNU General Public License as
+               published by the Free Software Foundation, either version 3 of
+               the License, or (at your option) any later version.
+
+               This Program is distributed in the hope that it will be
+               useful, but WITHOUT ANY WARRANTY; without even the implied
+               warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+               PURPOSE.  See the GNU General Public License for more details.
+
+               You should have received a copy of the GNU General Public
+               License along with this Program.  If not, see
+               <http://www.gnu.org/licenses/>.
+
+               Additional permission under GNU GPL version 3 section 7
+
+               If you modify this Program, or any covered work, by linking
+               or combining it with libftd2xx (or a modified version of that
+               library), containing parts covered by the license terms of
+               Future Technology Devices International Limited, the licensors
+               of this Program grant you additional permission to convey the
+               resulting work.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "p9813.h"
+
+#define MAX_CONFIGS 16
+
+/* Bitbang output bytes per second at a given baud rate.  The FTDI chip
+   in async bitbang mode doesn't move one byte per baud; this factor is
+   from measured throughput (about 240,000 pixels/sec with 8 strands and
+   CBUS clock, or 960,000 bytes/sec, at the library's 3,090,000 baud). */
+#define BYTES_PER_BAUD (960000.0 / 3090000.0)
+
+typedef struct {
+	int    nStrands,
+	       pixelsPerStrand;
+	double ma[8],          /* Current for each strand, this frame */
+	       maStrandMax[8], /* Peak current for each strand        */
+	       maMax,          /* Peak total current                  */
+	       maSum,          /* Sum of per-frame totals, for avg    */
+	       mah;            /* Total charge                        */
+} Config;
+
+/* Sum of per-pixel current estimates for a span of pixels.  Four
+   independent partial sums keep the adds from serializing. */
+static double sumSpan(const float *ma,int n)
+{
+	double sum[4] = { 0.0,0.0,0.0,0.0 };
+	int    i;
+
+	for(i=0;i<(n & ~3);i+=4)
+	{
+		sum[0] += ma[i];
+		sum[1] += ma[i + 1];
+		sum[2] += ma[i + 2];
+		sum[3] += ma[i + 3];
+	}
+	for(;i<n;i++) sum[0] += ma[i];
+
+	return (sum[0] + sum[1]) + (sum[2] + sum[3]);
+}
+
+int main(int argc,char *argv[])
+{
+	char               *filename = NULL,*str;
+	int                 i,s,c,nConfigs = 0,totalPixels = 100,
+	                    pattern = -1,cbus = 0,verbose = 0,first,n;
+	double              duration = 60.0,fps = 30.0,baud = 3090000.0,
+	                    x,ma,hours,bytesPerSec;
+	unsigned long       frames;
+	unsigned long long  usec,prevUsec = 0,endUsec = 0;
+	TCpixel            *pixelBuf,palette[256];
+	float              *maPixel;
+	unsigned char      *indexBuf;
+	TCshow             *show = NULL;
+	TCwave              wave;
+	TCstatusCode        status;
+	Config              config[MAX_CONFIGS];
+	const TCpixel       keys[] = {
+	  TCrgb(255,0,0),TCrgb(255,160,0),TCrgb(0,255,40),
+	  TCrgb(0,80,255),TCrgb(160,0,255) };
+
+	while((i = getopt(argc,argv,"f:g:n:t:r:s:b:cv")) != -1)
+	{
+		switch(i)
+		{
+		   case 'f':
+			filename = optarg;
+			break;
+		   case 'g':
+			pattern     = strtol(optarg,NULL,0);
+			break;
+		   case 'n':
+			totalPixels = strtol(optarg,NULL,0);
+			break;
+		   case 't':
+			duration    = strtod(optarg,NULL);
+			break;
+		   case 'r':
+			fps         = strtod(optarg,NULL);
+			break;
+		   case 's':
+			for(str=optarg;*str && (nConfigs < MAX_CONFIGS);)
+			{
+				config[nConfigs++].nStrands =
+				  strtol(str,&str,0);
+				if(',' == *str) str++;
+				else        break;
+			}
+			break;
+		   case 'b':
+			baud        = strtod(optarg,NULL);
+			break;
+		   case 'c':
+			cbus        = 1;
+			break;
+		   case 'v':
+			verbose     = 1;
+			break;
+		   case '?':
+		   default:
+			(void)printf("usage: %s [-f showfile | -g pattern] "
+			  "[-n pixels] [-t seconds] [-r fps]\n"
+			  "       [-s strands[,strands...]] "
+			  "[-b baud] [-c] [-v]\n",
+			  argv[0]);
+			return 1;
+		}
+	}
+
+	if(!filename && (pattern < 0)) pattern = 0;
+
+	if(filename)
+	{
+		if(!(show = TCshowOpen(filename)))
+		{
+			TCprintError(TC_ERR_FILE);
+			return 1;
+		}
+		totalPixels = TCshowPixels(show);
+	}
+
+	if((totalPixels < 1) || (fps <= 0.0) || (duration <= 0.0) ||
+	   (baud <= 0.0))
+	{
+		TCprintError(TC_ERR_VALUE);
+		return 1;
+	}
+
+	if(!nConfigs) config[nConfigs++].nStrands = 1;
+	for(c=0;c<nConfigs;c++)
+	{
+		if((config[c].nStrands < 1) ||
+		   (config[c].nStrands > (cbus ? 8 : 7)))
+		{
+			(void)printf("Strand count must be 1-%d.\n",
+			  cbus ? 8 : 7);
+			return 1;
+		}
+		config[c].pixelsPerStrand =
+		  (totalPixels + config[c].nStrands - 1) / config[c].nStrands;
+		for(s=0;s<8;s++) config[c].maStrandMax[s] = 0.0;
+		config[c].maMax = config[c].maSum = config[c].mah = 0.0;
+	}
+
+	i = totalPixels * (sizeof(TCpixel) + sizeof(float) + 1);
+	if(NULL == (pixelBuf = (TCpixel *)malloc(i)))
+	{
+		printf("Could not allocate space for %d pixels (%d bytes).\n",
+		  totalPixels,i);
+		return 1;
+	}
+	maPixel  = (float *)&pixelBuf[totalPixels];
+	indexBuf = (unsigned char *)&maPixel[totalPixels];
+
+	/* Pattern setup mirrors the demo program, treating the display as
+	   one long strand (generated content is the same regardless of the
+	   strand configuration being evaluated). */
+	TCmakePalette(palette,keys,sizeof(keys) / sizeof(keys[0]));
+	for(i=0;i<totalPixels;i++) indexBuf[i] = i * 256 / totalPixels;
+	wave.step[0] = (int32_t)TC_PHASE_RADIANS( 0.273);
+	wave.step[1] = (int32_t)TC_PHASE_RADIANS(-0.231);
+	wave.step[2] = (int32_t)TC_PHASE_RADIANS( 0.428);
+
+	TCsetGammaSimple(2.4);
+
+	for(frames=0,first=1,x=0.0;;frames++,x += (double)totalPixels / 20000.0)
+	{
+		if(show)
+		{
+			if((status = TCshowRead(show,pixelBuf,&usec)) != TC_OK)
+			{
+				if(status != TC_END_OF_SHOW)
+					TCprintError(status);
+				break;
+			}
+		} else
+		{
+			usec = (unsigned long long)
+			  ((double)frames * 1000000.0 / fps);
+			if((double)usec >= duration * 1000000.0) break;
+			switch(pattern)
+			{
+			   case 0:
+				wave.phase[0] = TC_PHASE_RADIANS(sin(x) * 11.0);
+				wave.phase[1] = TC_PHASE_RADIANS(
+				  sin(x *  0.857 - 0.214) * -13.0);
+				wave.phase[2] = TC_PHASE_RADIANS(
+				  sin(x * -0.923 + 1.428) *  17.0);
+				TCrenderWave(pixelBuf,0,totalPixels,&wave);
+				break;
+			   case 1:
+				TCrenderPlasma(pixelBuf,totalPixels,1,
+				  frames << 22,palette);
+				break;
+			   case 2:
+				TCrenderNoise(pixelBuf,0,totalPixels,
+				  frames << 11,0x3000,0,palette);
+				break;
+			   case 3:
+				TCrenderGradient(pixelBuf,0,totalPixels,
+				  palette[frames & 255],
+				  palette[(frames + 128) & 255]);
+				break;
+			   case 4:
+				TCrenderPalette(pixelBuf,indexBuf,totalPixels,
+				  palette,frames);
+				break;
+			   default:
+				for(i=0;i<totalPixels;i++)
+					pixelBuf[i] = TCrgb(255,255,255);
+				break;
+			}
+		}
+
+		/* Charge for the prior frame is integrated over the time
+		   it was displayed, i.e. up to this frame's timestamp. */
+		if(!first)
+		{
+			hours = (double)(usec - prevUsec) / 3600000000.0;
+			for(c=0;c<nConfigs;c++)
+			{
+				for(ma=0.0,s=0;s<config[c].nStrands;s++)
+					ma += config[c].ma[s];
+				config[c].mah += ma * hours;
+			}
+		}
+
+		/* One pass through the current model for the whole frame,
+		   then per-pixel results are summed by strand for each
+		   configuration. */
+		TCestimateCurrent(pixelBuf,totalPixels,maPixel);
+		for(c=0;c<nConfigs;c++)
+		{
+			for(ma=0.0,s=0;s<config[c].nStrands;s++)
+			{
+				i = s * config[c].pixelsPerStrand;
+				n = totalPixels - i;
+				if(n > config[c].pixelsPerStrand)
+					n = config[c].pixelsPerStrand;
+				config[c].ma[s] = (n > 0) ?
+				  sumSpan(&maPixel[i],n) : 0.0;
+				if(config[c].ma[s] > config[c].maStrandMax[s])
+					config[c].maStrandMax[s] =
+					  config[c].ma[s];
+				ma += config[c].ma[s];
+			}
+			config[c].maSum += ma;
+			if(ma > config[c].maMax) config[c].maMax = ma;
+			if(verbose)
+			{
+				printf("%.6f s  %d strand(s)  %.1f mA",
+				  (double)usec / 1000000.0,config[c].nStrands,
+				  ma);
+				for(s=0;s<config[c].nStrands;s++)
+					printf(" %.1f",config[c].ma[s]);
+				printf("\n");
+			}
+		}
+
+		prevUsec = usec;
+		first    = 0;
+	}
+
+	/* Last frame is held for one frame period (generated patterns) or
+	   not counted at all (show files, which have no end time). */
+	if(!first && !show)
+	{
+		endUsec = prevUsec + (unsigned long long)(1000000.0 / fps);
+		hours   = (double)(endUsec - prevUsec) / 3600000000.0;
+		for(c=0;c<nConfigs;c++)
+		{
+			for(ma=0.0,s=0;s<config[c].nStrands;s++)
+				ma += config[c].ma[s];
+			config[c].mah += ma * hours;
+		}
+	} else endUsec = prevUsec;
+
+	if(show) TCshowClose(show);
+
+	bytesPerSec = baud * BYTES_PER_BAUD;
+	printf("%lu frames, %d pixels, %.1f seconds, %s clock, %.0f baud\n",
+	  frames,totalPixels,(double)endUsec / 1000000.0,
+	  cbus ? "CBUS" : "bitbang",baud);
+	for(c=0;c<nConfigs;c++)
+	{
+		unsigned long bytes = TCwireBytes(
+		  config[c].nStrands + (cbus ? TC_CBUS_CLOCK : 0),
+		  config[c].pixelsPerStrand);
+
+		printf("\n%d strand(s) of %d pixels\n"
+		  "  Bytes per frame          : %lu\n"
+		  "  Estimated max FPS        : %.1f\n"
+		  "  Peak current             : %.1f mA\n"
+		  "  Average current          : %.1f mA\n"
+		  "  Total charge             : %.3f mAh\n",
+		  config[c].nStrands,config[c].pixelsPerStrand,bytes,
+		  bytesPerSec / (double)bytes,config[c].maMax,
+		  frames ? config[c].maSum / (double)frames : 0.0,
+		  config[c].mah);
+		for(s=0;s<config[c].nStrands;s++)
+		{
+			printf("  Peak current, strand %d  : %.1f mA\n",
+			  s,config[c].maStrandMax[s]);
+		}
+	}
+
+	free(pixelBuf);
+	return 0;
+}
@@ -0,0 +1,713 @@
+/****************************************************************************
+ File        : spatial.c
+
+ Description : Spatial index for the p9813 library.  Effects computed in
+               space -- a plane sweeping across an installation, a sphere
+               expanding from a point, a spotlight -- need the pixels in
+               some region, and testing every pixel's position each frame
+               costs the same however few are lit.  Built once from the
+               pixels' coordinates, the index answers box, sphere, slab
+               and nearest-pixel queries in time proportional to the
+               pixels found, returning spans of indices that address a
+               TCpixel array directly.
+
+               Pixels are bucketed in a uniform grid of cells, averaging
+               about two pixels each, spanning their bounding box (axes
+               with less extent than a cell, such as z in a flat or
+               nearly flat layout, get a single cell).  A query visits
+               only the cells the region overlaps, a column at a time;
+               cells wholly inside the region are taken without testing
+               their pixels.  Within each cell, pixels are kept in index
+               order, so neighbouring pixels of a strand or grid row come
+               out as one span.
+
+ License     : Copyright 2011 Phillip Burgess.    www.PaintYourDragon.com
+
+               This Program is free software: you can redistribute it and/or
+               modify it under the terms of the GNU General Public License as
+               published by the Free Software Foundation, either version 3 of
+               the License, or (at your option) any later version.
+
+               This Program is distributed in the hope that it will be
+               useful, but WITHOUT ANY WARRANTY; without even the implied
+               warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+               PURPOSE.  See the GNU General Public License for more details.
+
+               You should have received a copy of the GNU General Public
+               License along with this Program.  If not, see
+               <http://www.gnu.org/licenses/>.
+
+               Additional permission under GNU GPL version 3 section 7
+
+               If you modify this Program, or any covered work, by linking
+               or combining it with libftd2xx (or a modified version of that
+               library), containing parts covered by the license terms of
+               Future Technology Devices International Limited, the licensors
+               of this Program grant you additional permission to convey the
+               resulting work.
+ ****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "p9813.h"
+
+#define PIXELS_PER_CELL 2
+
+typedef struct {
+	float x[3];
+	int   index;   /* Array index reported for this pixel */
+} point;
+
+struct TCspatial {
+	int     nPoints,
+	        dim[3],        /* Cells along each axis               */
+	       *cellStart,     /* First point of each cell, plus end  */
+	        nSpans,
+	        maxSpans;
+	float   min[3],        /* Corner of cell 0                    */
+	        size[3],       /* Cell size along each axis (0 if flat) */
+	        inv[3];        /* 1 / size, or 0 for a flat axis      */
+	point  *point;         /* Points, by cell, in index order     */
+	TCspan *span;          /* Results of the latest query         */
+};
+
+/* Query regions.  All are convex, so a cell is wholly inside if all of
+   its corners are. */
+typedef enum {
+	REGION_BOX = 0,
+	REGION_SPHERE,
+	REGION_SLAB
+} regionType;
+
+typedef struct {
+	regionType type;
+	float      a[3],      /* Box min, sphere center, or slab normal */
+	           b[3],      /* Box max                                */
+	           r,         /* Sphere radius, or slab near distance   */
+	           r2;        /* Squared radius, or slab far distance   */
+} region;
+
+static int regionHas(
+  const region *rg,
+  const float  *x)
+{
+	float d0,d1,d2;
+
+	switch(rg->type)
+	{
+	   case REGION_BOX:
+		return (x[0] >= rg->a[0]) && (x[0] <= rg->b[0]) &&
+		       (x[1] >= rg->a[1]) && (x[1] <= rg->b[1]) &&
+		       (x[2] >= rg->a[2]) && (x[2] <= rg->b[2]);
+	   case REGION_SPHERE:
+		d0 = x[0] - rg->a[0];
+		d1 = x[1] - rg->a[1];
+		d2 = x[2] - rg->a[2];
+		return d0 * d0 + d1 * d1 + d2 * d2 <= rg->r2;
+	   default:
+		d0 = x[0] * rg->a[0] + x[1] * rg->a[1] + x[2] * rg->a[2];
+		return (d0 >= rg->r) && (d0 <= rg->r2);
+	}
+}
+
+/* Cell number along an axis for a coordinate, clamped to the grid. */
+static int cellOf(
+  const TCspatial *sp,
+  int              axis,
+  double           v)
+{
+	double c = (v - sp->min[axis]) * sp->inv[axis];
+
+	if(c < 0.0) return 0;
+	if(c >= sp->dim[axis]) return sp->dim[axis] - 1;
+	return (int)c;
+}
+
+/* Appends a pixel's index to the results, extending the last span where
+   it follows on.  Returns 0 on malloc() failure. */
+static int spanPut(
+  TCspatial *sp,
+  int        index)
+{
+	TCspan *s;
+	int     n;
+
+	if(sp->nSpans)
+	{
+		s = &sp->span[sp->nSpans - 1];
+		if(index == s->start + s->n)
+		{
+			s->n++;
+			return 1;
+		}
+		if((index >= s->start) && (index < s->start + s->n)) return 1;
+	}
+	if(sp->nSpans == sp->maxSpans)
+	{
+		n = sp->maxSpans * 2;
+		if(!(s = (TCspan *)realloc(sp->span,n * sizeof(TCspan))))
+			return 0;
+		sp->span     = s;
+		sp->maxSpans = n;
+	}
+	sp->span[sp->nSpans].start = index;
+	sp->span[sp->nSpans].n     = 1;
+	sp->nSpans++;
+
+	return 1;
+}
+
+/* Span order for qsort(). */
+static int spanCompare(const void *a,const void *b)
+{
+	return ((const TCspan *)a)->start - ((const TCspan *)b)->start;
+}
+
+/* Point order for qsort(): by index, so bucketing (which is stable)
+   leaves each cell in index order. */
+static int pointCompare(const void *a,const void *b)
+{
+	return ((const point *)a)->index - ((const point *)b)->index;
+}
+
+/* Extent of the grid along an axis. */
+#define GRID_END(sp,a) ((sp)->min[a] + (sp)->size[a] * (sp)->dim[a])
+
+/* Collects the pixels inside the region from one column of cells, at
+   (i,j) across the other two axes and running along axis w.  Returns 0
+   on malloc() failure. */
+static int queryColumn(
+  TCspatial    *sp,
+  const region *rg,
+  int           w,
+  int           i,
+  int           j)
+{
+	int   u = (w + 1) % 3,v = (w + 2) % 3,k,k0,k1,c,p,cc[3],inside,corner;
+	float bx[2][3],x[3],d,t,w0,w1,pad;
+
+	cc[u]    = i;
+	bx[0][u] = sp->min[u] + sp->size[u] * i;
+	bx[1][u] = bx[0][u] + sp->size[u];
+	cc[v]    = j;
+	bx[0][v] = sp->min[v] + sp->size[v] * j;
+	bx[1][v] = bx[0][v] + sp->size[v];
+
+	/* Range along w the region covers in this column */
+	switch(rg->type)
+	{
+	   case REGION_BOX:
+		w0 = rg->a[w];
+		w1 = rg->b[w];
+		break;
+	   case REGION_SPHERE:
+		/* Half chord at the column's nearest point */
+		d  = (rg->a[u] < bx[0][u]) ? bx[0][u] - rg->a[u] :
+		     (rg->a[u] > bx[1][u]) ? rg->a[u] - bx[1][u] : 0.0;
+		t  = (rg->a[v] < bx[0][v]) ? bx[0][v] - rg->a[v] :
+		     (rg->a[v] > bx[1][v]) ? rg->a[v] - bx[1][v] : 0.0;
+		if((d = rg->r2 - d * d - t * t) < 0.0) return 1;
+		d  = sqrtf(d);
+		w0 = rg->a[w] - d;
+		w1 = rg->a[w] + d;
+		break;
+	   default:
+		/* Least and greatest of the u,v part over the column; w's
+		   component is the largest, so isn't zero. */
+		d  = bx[rg->a[u] < 0.0][u] * rg->a[u] +
+		     bx[rg->a[v] < 0.0][v] * rg->a[v];
+		t  = bx[rg->a[u] > 0.0][u] * rg->a[u] +
+		     bx[rg->a[v] > 0.0][v] * rg->a[v];
+		if(rg->a[w] > 0.0)
+		{
+			w0 = (rg->r  - t) / rg->a[w];
+			w1 = (rg->r2 - d) / rg->a[w];
+		} else
+		{
+			w0 = (rg->r2 - d) / rg->a[w];
+			w1 = (rg->r  - t) / rg->a[w];
+		}
+		break;
+	}
+	if((w1 < sp->min[w]) || (w0 > GRID_END(sp,w))) return 1;
+	k0 = cellOf(sp,w,w0);
+	k1 = cellOf(sp,w,w1);
+
+	for(k=k0;k<=k1;k++)
+	{
+		cc[w] = k;
+		c     = (cc[2] * sp->dim[1] + cc[1]) * sp->dim[0] + cc[0];
+		if(sp->cellStart[c] == sp->cellStart[c + 1]) continue;
+
+		/* Wholly inside?  The box is padded a little, as rounding may
+		   leave a pixel a hair outside it. */
+		bx[0][w] = sp->min[w] + sp->size[w] * k;
+		bx[1][w] = bx[0][w] + sp->size[w];
+		for(inside=1,corner=0;inside && (corner<8);corner++)
+		{
+			for(p=0;p<3;p++)
+			{
+				pad  = sp->size[p] * 0.0001f;
+				x[p] = (corner & (1 << p)) ?
+				  bx[1][p] + pad : bx[0][p] - pad;
+			}
+			inside = regionHas(rg,x);
+		}
+
+		for(p=sp->cellStart[c];p<sp->cellStart[c + 1];p++)
+		{
+			if((inside || regionHas(rg,sp->point[p].x)) &&
+			   !spanPut(sp,sp->point[p].index)) return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Runs a query: visits each column of cells (along axis w) that the
+   region may overlap, over the range of cells the region may span in
+   it, and collects the pixels inside.  Columns run along z, except for
+   slabs, where they follow the normal's largest component so a sweep
+   across a flat display visits only the cells it crosses.  Results are
+   then sorted and merged into ascending, non-overlapping spans. */
+static const TCspan *query(
+  TCspatial    *sp,
+  const region *rg,
+  int          *nSpans)
+{
+	int     i,j,k,u,v,w,lo[2],hi[2];
+	float   r0,r1;
+	TCspan *s;
+
+	sp->nSpans = 0;
+	if(nSpans) *nSpans = 0;
+
+	w = 2;
+	if(REGION_SLAB == rg->type)
+	{
+		if(fabsf(rg->a[0]) > fabsf(rg->a[w])) w = 0;
+		if(fabsf(rg->a[1]) > fabsf(rg->a[w])) w = 1;
+	}
+	u = (w + 1) % 3;
+	v = (w + 2) % 3;
+
+	/* Range of columns across u and v */
+	for(i=0;i<2;i++)
+	{
+		k = i ? v : u;
+		switch(rg->type)
+		{
+		   case REGION_BOX:
+			r0 = rg->a[k];
+			r1 = rg->b[k];
+			break;
+		   case REGION_SPHERE:
+			r0 = rg->a[k] - rg->r;
+			r1 = rg->a[k] + rg->r;
+			break;
+		   default:
+			r0 = sp->min[k];
+			r1 = GRID_END(sp,k);
+			break;
+		}
+		if((r1 < sp->min[k]) || (r0 > GRID_END(sp,k))) return sp->span;
+		lo[i] = cellOf(sp,k,r0);
+		hi[i] = cellOf(sp,k,r1);
+	}
+
+	for(i=lo[0];i<=hi[0];i++)
+	{
+		for(j=lo[1];j<=hi[1];j++)
+			if(!queryColumn(sp,rg,w,i,j)) return NULL;
+	}
+
+	/* Cells were visited out of index order; sort and merge. */
+	qsort(sp->span,sp->nSpans,sizeof(TCspan),spanCompare);
+	for(s=sp->span,i=1;i<sp->nSpans;i++)
+	{
+		if(sp->span[i].start <= s->start + s->n)
+		{
+			k = sp->span[i].start + sp->span[i].n - s->start;
+			if(k > s->n) s->n = k;
+		} else
+		{
+			*++s = sp->span[i];
+		}
+	}
+	if(sp->nSpans) sp->nSpans = s - sp->span + 1;
+
+	if(nSpans) *nSpans = sp->nSpans;
+	return sp->span;
+}
+
+/****************************************************************************
+ Function    : TCspatialCreate()
+ Description : Builds a spatial index of pixel positions.
+ Parameters  : const float *  x,y,z of each pixel, three floats each (e.g.
+                              a layout's coords; see TClayoutOpen()).
+               int            Number of pixels.
+               const int *    Optional; the array index to report for
+                              each pixel, e.g. a layout's remap table so
+                              that results index its image.  Pixels with
+                              negative entries (unused or disconnected)
+                              are left out.  NULL reports each pixel's
+                              own number (its position in the list, i.e.
+                              strand * pixelsPerStrand + pixel for a
+                              layout).
+ Returns     : Index handle, or NULL on error (including no pixels).
+ ****************************************************************************/
+TCspatial *TCspatialCreate(
+  const float *coords,
+  int          nPixels,
+  const int   *map)
+{
+	TCspatial *sp;
+	point     *pt;
+	float      max[3],e[3];
+	double     vol,s;
+	int        i,a,n,c,nFlat,flat[3],*count;
+
+	if(!coords || (nPixels < 1)) return NULL;
+	if(!(sp = (TCspatial *)calloc(1,sizeof(TCspatial)))) return NULL;
+	sp->maxSpans = 64;
+	if(!(sp->span = (TCspan *)malloc(sp->maxSpans * sizeof(TCspan))) ||
+	   !(pt = (point *)malloc(nPixels * sizeof(point))))
+	{
+		TCspatialDestroy(sp);
+		return NULL;
+	}
+
+	for(n=i=0;i<nPixels;i++)
+	{
+		if(map && (map[i] < 0)) continue;
+		memcpy(pt[n].x,&coords[i * 3],3 * sizeof(float));
+		pt[n].index = map ? map[i] : i;
+		for(a=0;a<3;a++)
+		{
+			if(!n || (pt[n].x[a] < sp->min[a]))
+				sp->min[a] = pt[n].x[a];
+			if(!n || (pt[n].x[a] > max[a]))
+				max[a]     = pt[n].x[a];
+		}
+		n++;
+	}
+	sp->nPoints = n;
+	if(!n)
+	{
+		free(pt);
+		TCspatialDestroy(sp);
+		return NULL;
+	}
+	qsort(pt,n,sizeof(point),pointCompare);
+
+	/* Cell size giving about PIXELS_PER_CELL per cell if they were
+	   spread evenly through the bounding box's non-flat axes.  An axis
+	   shorter than one cell is flat too, and the size is worked out
+	   again without it; else a nearly flat layout would be cut into
+	   more cells than it has pixels, by far. */
+	for(a=0;a<3;a++)
+	{
+		e[a]    = max[a] - sp->min[a];
+		flat[a] = (e[a] <= 0.0);
+	}
+	do
+	{
+		for(vol=1.0,nFlat=a=0;a<3;a++)
+		{
+			if(flat[a]) nFlat++;
+			else        vol *= e[a];
+		}
+		s = (nFlat < 3) ?
+		  pow(vol * PIXELS_PER_CELL / n,1.0 / (3 - nFlat)) : 1.0;
+		for(i=a=0;a<3;a++)
+		{
+			if(!flat[a] && (e[a] < s)) flat[a] = i = 1;
+		}
+	} while(i);
+	for(c=1,a=0;a<3;a++)
+	{
+		if(e[a] > 0.0)
+		{
+			/* 1 or more, as the extent is at least s if not flat */
+			sp->dim[a] = flat[a] ? 1 : (int)(e[a] / s + 0.5);
+			if(sp->dim[a] > n) sp->dim[a] = n;
+			sp->size[a] = e[a] / sp->dim[a];
+			sp->inv[a]  = 1.0 / sp->size[a];
+		} else
+		{
+			sp->dim[a]  = 1;
+			sp->size[a] = 0.0;
+			sp->inv[a]  = 0.0;
+		}
+		c *= sp->dim[a];
+	}
+
+	/* Bucket by cell: count, then place (stable, so in index order) */
+	if(!(sp->cellStart = (int *)calloc(c + 1,sizeof(int))) ||
+	   !(count = (int *)malloc(n * sizeof(int))) )
+	{
+		free(pt);
+		TCspatialDestroy(sp);
+		return NULL;
+	}
+	for(i=0;i<n;i++)
+	{
+		count[i] = (cellOf(sp,2,pt[i].x[2]) * sp->dim[1] +
+		  cellOf(sp,1,pt[i].x[1])) * sp->dim[0] +
+		  cellOf(sp,0,pt[i].x[0]);
+		sp->cellStart[count[i] + 1]++;
+	}
+	for(a=0;a<c;a++) sp->cellStart[a + 1] += sp->cellStart[a];
+	if(!(sp->point = (point *)malloc(n * sizeof(point))))
+	{
+		free(count);
+		free(pt);
+		TCspatialDestroy(sp);
+		return NULL;
+	}
+	for(i=0;i<n;i++) sp->point[sp->cellStart[count[i]]++] = pt[i];
+	for(a=c;a>0;a--) sp->cellStart[a] = sp->cellStart[a - 1];
+	sp->cellStart[0] = 0;
+	free(count);
+	free(pt);
+
+	return sp;
+}
+
+/****************************************************************************
+ Function    : TCspatialBox()
+ Description : Finds the pixels inside an axis-aligned box (edges
+               included).
+ Parameters  : TCspatial *    Index from TCspatialCreate().
+               const float *  Minimum corner, x,y,z.
+               const float *  Maximum corner.
+               int *          Returns number of spans.
+ Returns     : Spans of pixel indices, ascending and not overlapping;
+               owned by the index and valid until its next query.  NULL
+               on error.
+ ****************************************************************************/
+const TCspan *TCspatialBox(
+  TCspatial   *sp,
+  const float *min,
+  const float *max,
+  int         *nSpans)
+{
+	region rg;
+
+	if(nSpans) *nSpans = 0;
+	if(!sp || !min || !max) return NULL;
+
+	rg.type = REGION_BOX;
+	memcpy(rg.a,min,sizeof(rg.a));
+	memcpy(rg.b,max,sizeof(rg.b));
+
+	return query(sp,&rg,nSpans);
+}
+
+/****************************************************************************
+ Function    : TCspatialSphere()
+ Description : Finds the pixels within a distance of a point, e.g. for an
+               expanding sphere or a spotlight.
+ Parameters  : TCspatial *    Index from TCspatialCreate().
+               const float *  Center, x,y,z.
+               float          Radius.
+               int *          Returns number of spans.
+ Returns     : Spans of pixel indices, as TCspatialBox().
+ ****************************************************************************/
+const TCspan *TCspatialSphere(
+  TCspatial   *sp,
+  const float *center,
+  float        radius,
+  int         *nSpans)
+{
+	region rg;
+
+	if(nSpans) *nSpans = 0;
+	if(!sp || !center || !(radius >= 0.0)) return NULL;
+
+	rg.type = REGION_SPHERE;
+	memcpy(rg.a,center,sizeof(rg.a));
+	rg.r    = radius;
+	rg.r2   = radius * radius;
+
+	return query(sp,&rg,nSpans);
+}
+
+/****************************************************************************
+ Function    : TCspatialSlab()
+ Description : Finds the pixels between two parallel planes, i.e. those
+               whose position dotted with the plane normal lies between
+               two values -- a plane sweeping through a display is a thin
+               slab moving along its normal.
+ Parameters  : TCspatial *    Index from TCspatialCreate().
+               const float *  Plane normal, x,y,z (need not be unit
+                              length; distances are in its units).
+               float          Near plane distance along normal.
+               float          Far plane distance (not less than near).
+               int *          Returns number of spans.
+ Returns     : Spans of pixel indices, as TCspatialBox().
+ ****************************************************************************/
+const TCspan *TCspatialSlab(
+  TCspatial   *sp,
+  const float *normal,
+  float        d0,
+  float        d1,
+  int         *nSpans)
+{
+	region rg;
+
+	if(nSpans) *nSpans = 0;
+	if(!sp || !normal || !(d1 >= d0) ||
+	   (!normal[0] && !normal[1] && !normal[2])) return NULL;
+
+	rg.type = REGION_SLAB;
+	memcpy(rg.a,normal,sizeof(rg.a));
+	rg.r    = d0;
+	rg.r2   = d1;
+
+	return query(sp,&rg,nSpans);
+}
+
+/* Offers the pixels of one cell to the nearest-pixel list: the n nearest
+   so far (at most k), in best[] and index[], nearest first.  Returns the
+   new n. */
+static int nearestCell(
+  const TCspatial *sp,
+  const float     *x,
+  int              cell,
+  int              k,
+  int              n,
+  int             *index,
+  float           *best)
+{
+	int   p,m;
+	float d,dx,dy,dz;
+
+	for(p=sp->cellStart[cell];p<sp->cellStart[cell + 1];p++)
+	{
+		dx = sp->point[p].x[0] - x[0];
+		dy = sp->point[p].x[1] - x[1];
+		dz = sp->point[p].x[2] - x[2];
+		d  = sqrtf(dx * dx + dy * dy + dz * dz);
+		if((n == k) && (d >= best[k - 1])) continue;
+		/* Insert in order */
+		for(m=(n < k) ? n++ : k - 1;(m > 0) && (best[m - 1] > d);m--)
+		{
+			best[m]  = best[m - 1];
+			index[m] = index[m - 1];
+		}
+		best[m]  = d;
+		index[m] = sp->point[p].index;
+	}
+
+	return n;
+}
+
+/* As nearestCell(), for each cell of the shell r cells out from cell c
+   (a cube's surface, clipped to the grid). */
+static int nearestShell(
+  const TCspatial *sp,
+  const float     *x,
+  const int       *c,
+  int              r,
+  int              k,
+  int              n,
+  int             *index,
+  float           *best)
+{
+	int i,j,l,lo[3],hi[3],cell,edge;
+
+	for(i=0;i<3;i++)
+	{
+		lo[i] = c[i] - r;
+		hi[i] = c[i] + r;
+		if(lo[i] < 0)               lo[i] = 0;
+		if(hi[i] > sp->dim[i] - 1)  hi[i] = sp->dim[i] - 1;
+	}
+	for(l=lo[2];l<=hi[2];l++)
+	{
+		for(j=lo[1];j<=hi[1];j++)
+		{
+			for(i=lo[0];i<=hi[0];i++)
+			{
+				/* Shell only; the inside was done before */
+				edge = (abs(i - c[0]) == r) ||
+				       (abs(j - c[1]) == r) ||
+				       (abs(l - c[2]) == r);
+				if(!edge) continue;
+				cell = (l * sp->dim[1] + j) * sp->dim[0] + i;
+				n    = nearestCell(sp,x,cell,k,n,index,best);
+			}
+		}
+	}
+
+	return n;
+}
+
+/****************************************************************************
+ Function    : TCspatialNearest()
+ Description : Finds the pixels nearest a point, searching outward from
+               the point's cell until no closer pixel can remain.
+ Parameters  : TCspatial *    Index from TCspatialCreate().
+               const float *  Point, x,y,z.
+               int            Number of pixels wanted.
+               int *          Returns their indices, nearest first (k
+                              elements).
+               float *        Optional; returns their distances (NULL if
+                              not needed).
+ Returns     : Number of pixels found (k, or fewer if the index holds
+               fewer), or -1 on error.
+ ****************************************************************************/
+int TCspatialNearest(
+  TCspatial   *sp,
+  const float *x,
+  int          k,
+  int         *index,
+  float       *dist)
+{
+	int    n = 0,r,c[3],i,more;
+	float  step,*best;
+
+	if(!sp || !x || (k < 1) || !index) return -1;
+	if(!(best = dist ? dist : (float *)malloc(k * sizeof(float))))
+		return -1;
+
+	for(step=0.0,i=0;i<3;i++)
+	{
+		c[i] = cellOf(sp,i,x[i]);
+		if((sp->size[i] > 0.0) && (!step || (sp->size[i] < step)))
+			step = sp->size[i];
+	}
+
+	/* Shells of cells around the point's cell.  Pixels beyond shell r
+	   are at least r cells' width away. */
+	for(r=0;;r++)
+	{
+		for(more=0,i=0;i<3;i++)
+		{
+			if(c[i] - r > 0)               more = 1;
+			if(c[i] + r < sp->dim[i] - 1)  more = 1;
+		}
+		n = nearestShell(sp,x,c,r,k,n,index,best);
+		if(!more || ((n == k) && (best[k - 1] <= step * r))) break;
+	}
+
+	if(!dist) free(best);
+	return n;
+}
+
+/****************************************************************************
+ Function    : TCspatialDestroy()
+ Description : Frees a spatial index.
+ Parameters  : TCspatial *  Index from TCspatialCreate().
+ Returns     : Nothing (void).
+ ****************************************************************************/
+void TCspatialDestroy(TCspatial *sp)
+{
+	if(!sp) return;
+	free(sp->cellStart);
+	free(sp->point);
+	free(sp->span);
+	free(sp);
+}
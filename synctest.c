@@ -0,0 +1,224 @@
+/****************************************************************************
+ File        : synctest.c
+
+ Description : Synchronized playback test for the p9813 library.  Runs as
+               the sync leader or as a follower (see TCsyncLeader() and
+               TCsyncFollow()), presenting frames on the shared timeline
+               with TCrefreshAt() to a null sink in place of the FTDI
+               device, then reports the follower's clock estimate and how
+               closely frames met their times.  Start one leader and any
+               number of followers, on one machine over loopback or on
+               several; no adapter is needed.  On one machine, the -v
+               output of each process can be compared directly, as all
+               share the same monotonic clock.
+
+               Example calling sequences:
+
+               synctest -L &
+               synctest -F localhost & synctest -F localhost
+
+               -L  Run as leader.
+               -F  Run as follower of the leader on this host.
+               -P  UDP port (default 9814).
+               -f  Frame rate of the timeline, leader only (default 60).
+               -t  Duration in seconds (default 10).
+               -s  Number of strands (default 1).
+               -p  Pixels per strand (default 100).
+               -w  Time the null sink spends on each write, in
+                   microseconds, to stand in for USB I/O (default 0).
+               -v  Print each frame's number and the time its write
+                   completed (monotonic clock, microseconds).
+
+ License     : Copyright 2011 Phillip Burgess.    www.PaintYourDragon.com
+
+               This Program is free software: you can redistribute it and/or
+               modify it under the terms of the GNU General Public License as
+               published by the Free Software Foundation, either version 3 of
+               the License, or (at your option) any later version.
+
+               This Program is distributed in the hope that it will be
+               useful, but WITHOUT ANY WARRANTY; without even the implied
+               warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+               PURPOSE.  See the GNU General Public License for more details.
+
+               You should have received a copy of the GNU General Public
+               License along with this Program.  If not, see
+               <http://www.gnu.org/licenses/>.
+
+               Additional permission under GNU GPL version 3 section 7
+
+               If you modify this Program, or any covered work, by linking
+               or combining it with libftd2xx (or a modified version of that
+               library), containing parts covered by the license terms of
+               Future Technology Devices International Limited, the licensors
+               of this Program grant you additional permission to convey the
+               resulting work.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "p9813.h"
+
+static double wireTime;  /* When the latest write completed */
+
+static double usecMono(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return (double)t.tv_sec * 1000000.0 + (double)t.tv_nsec / 1000.0;
+}
+
+/* Null sink: discards output, optionally after sleeping for a while to
+   stand in for the time a USB write would take (blocked on I/O rather
+   than busy, so processes on one machine don't compete for the CPU),
+   and notes when the write completed. */
+static TCstatusCode nullSink(
+  const unsigned char *data,
+  int                  len,
+  void                *arg)
+{
+	struct timespec t;
+
+	if(*(long *)arg)
+	{
+		clock_gettime(CLOCK_MONOTONIC,&t);
+		t.tv_nsec += *(long *)arg * 1000;
+		t.tv_sec  += t.tv_nsec / 1000000000;
+		t.tv_nsec %= 1000000000;
+		while(clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&t,NULL));
+	}
+	wireTime = usecMono();
+
+	return TC_OK;
+}
+
+int main(int argc,char *argv[])
+{
+	int          i,
+	  leader          = 0,
+	  port            = 9814,
+	  nStrands        = 1,
+	  pixelsPerStrand = 100,
+	  verbose         = 0;
+	long         frame,last = -1,writeTime = 0;
+	double       fps      = 60.0,
+	             duration = 10.0,
+	             stop;
+	char        *host     = NULL;
+	TCpixel     *pixelBuf;
+	TCstatusCode status;
+	TCsyncStats  sync;
+
+	while((i = getopt(argc,argv,"LF:P:f:t:s:p:w:v")) != -1)
+	{
+		switch(i)
+		{
+		   case 'L':
+			leader          = 1;
+			break;
+		   case 'F':
+			host            = optarg;
+			break;
+		   case 'P':
+			port            = strtol(optarg,NULL,0);
+			break;
+		   case 'f':
+			fps             = strtod(optarg,NULL);
+			break;
+		   case 't':
+			duration        = strtod(optarg,NULL);
+			break;
+		   case 's':
+			nStrands        = strtol(optarg,NULL,0);
+			break;
+		   case 'p':
+			pixelsPerStrand = strtol(optarg,NULL,0);
+			break;
+		   case 'w':
+			writeTime       = strtol(optarg,NULL,0);
+			break;
+		   case 'v':
+			verbose         = 1;
+			break;
+		   case '?':
+		   default:
+			(void)printf("usage: %s -L | -F host [-P port] "
+			  "[-f fps] [-t seconds]\n"
+			  "       [-s strands] [-p pixels] [-w usec] [-v]\n",
+			  argv[0]);
+			return 1;
+		}
+	}
+
+	if((leader == !!host) || (duration <= 0.0) || (writeTime < 0))
+	{
+		TCprintError(TC_ERR_VALUE);
+		return 1;
+	}
+
+	if(NULL == (pixelBuf = (TCpixel *)malloc(
+	  nStrands * pixelsPerStrand * sizeof(TCpixel))))
+	{
+		TCprintError(TC_ERR_MALLOC);
+		return 1;
+	}
+
+	TCsetSink(nullSink,&writeTime);
+	if((status = TCopen(nStrands,pixelsPerStrand)) != TC_OK)
+	{
+		TCprintError(status);
+		if(status < TC_ERR_DIVISOR) return 1;
+	}
+	if((status = leader ? TCsyncLeader(port,fps) :
+	  TCsyncFollow(host,port)) != TC_OK)
+	{
+		TCprintError(status);
+		TCclose();
+		return 1;
+	}
+
+	/* Wait for the leader, then present each frame as it comes due.
+	   Pixel colors follow the frame number, so displays that are in
+	   step show the same thing. */
+	for(stop=usecMono()+duration*1000000.0;usecMono() < stop;)
+	{
+		if((frame = TCsyncFrame()) < 0)
+		{
+			usleep(10000);
+			continue;
+		}
+		if(frame <= last) frame = last + 1;
+		for(i=nStrands*pixelsPerStrand-1;i>=0;i--)
+			pixelBuf[i] = TCrgb(frame & 0xff,i & 0xff,
+			  (frame + i) & 0xff);
+		if((status = TCrefreshAt(pixelBuf,NULL,NULL,frame)) != TC_OK)
+		{
+			TCprintError(status);
+			break;
+		}
+		if(verbose) (void)printf("%ld %.1f\n",frame,wireTime);
+		last = frame;
+	}
+
+	TCsyncGetStats(&sync);
+	TCsyncStop();
+	TCclose();
+
+	(void)printf("%s: %lu exchanges (%lu rejected), round trip %.1f uS\n",
+	  sync.leader ? "Leader" : "Follower",sync.samples,sync.rejected,
+	  sync.usecDelay);
+	if(!sync.leader)
+		(void)printf("Clock: offset %.1f uS, drift %.2f ppm, "
+		  "jitter %.1f uS\n",sync.usecOffset,sync.ppmDrift,
+		  sync.usecJitter);
+	(void)printf("Frames: %lu presented, %lu late, error avg %.1f uS, "
+	  "max %.1f uS\n",sync.frames,sync.framesLate,sync.usecPresentAvg,
+	  sync.usecPresentMax);
+
+	free(pixelBuf);
+	return 0;
+}
@@ -0,0 +1,412 @@
+/****************************************************************************
+ File        : video.c
+
+ Description : Video ingest for the p9813 library.  Reads raw video frames
+               (packed 8-bit RGB, as from "ffmpeg -f rawvideo -pix_fmt
+               rgb24") from standard input or a FIFO, reduces each to the
+               display's pixel grid by area averaging (TCresample(), on
+               several threads) directly into a frame mailbox buffer
+               (TCframeAcquire()), submitted with latest-wins policy.  A
+               reader thread keeps pulling frames into a ring of
+               preallocated buffers whatever the rest is doing; if
+               resampling or output falls behind, stale frames are
+               skipped rather than queued, so the display shows the
+               newest frame available.  Reports frame counts and the
+               latency from a frame's arrival to its being written to
+               the device.
+
+               Example calling sequences:
+
+               ffmpeg -re -i clip.mp4 -f rawvideo -pix_fmt rgb24 - |
+                 video -w 1920 -h 1080 -l wall.tcl
+               video -w 640 -h 360 -s 8 -p 100 -c -W 100 -H 8 < clip.rgb
+
+               -w  Source frame width (default 1920).
+               -h  Source frame height (default 1080).
+               -l  Layout file (see TClayoutCompile()); the image is
+                   resampled to the layout's grid.
+               -s  Number of strands, without -l (default 1).
+               -p  Pixels per strand, without -l (default 100).
+               -c  Hardware (CBUS) clock, as with TC_CBUS_CLOCK.
+               -W  Grid width, without -l (default pixels per strand).
+               -H  Grid height, without -l (default number of strands):
+                   grid rows run along strands in turn.
+               -t  Number of resampling threads (default number of CPUs).
+               -b  Number of ring buffers, 3 to 16 (default 4).
+               -n  Discard output rather than opening the FTDI device, to
+                   measure throughput without an adapter.
+               -T  Record a trace to this file (see TCtraceStart()).
+
+ License     : Copyright 2011 Phillip Burgess.    www.PaintYourDragon.com
+
+               This Program is free software: you can redistribute it and/or
+               modify it under the terms of the GNU General Public License as
+               published by the Free Software Foundation, either version 3 of
+               the License, or (at your option) any later version.
+
+               This Program is distributed in the hope that it will be
+               useful, but WITHOUT ANY WARRANTY; without even the implied
+               warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+               PURPOSE.  See the GNU General Public License for more details.
+
+               You should have received a copy of the GNU General Public
+               License along with this Program.  If not, see
+               <http://www.gnu.org/licenses/>.
+
+               Additional permission under GNU GPL version 3 section 7
+
+               If you modify this Program, or any covered work, by linking
+               or combining it with libftd2xx (or a modified version of that
+               library), containing parts covered by the license terms of
+               Future Technology Devices International Limited, the licensors
+               of this Program grant you additional permission to convey the
+               resulting work.
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "p9813.h"
+
+#define MAX_BUFS 16
+
+/* Ring buffer states.  The reader fills a free buffer, or failing that
+   the oldest full one (that frame is skipped); the main thread takes the
+   newest full buffer, freeing any older. */
+enum { BUF_FREE, BUF_READING, BUF_FULL, BUF_BUSY };
+
+static unsigned char
+	*ring[MAX_BUFS];
+static int
+	state[MAX_BUFS],
+	nBufs      = 4,
+	frameBytes,
+	eof        = 0;
+static unsigned long
+	seq[MAX_BUFS],
+	nRead      = 0,
+	nSkipped   = 0;
+static unsigned long long
+	arrival[MAX_BUFS];
+static FILE
+	*in;
+static pthread_mutex_t
+	ringLock   = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t
+	ringFull   = PTHREAD_COND_INITIALIZER;
+
+static unsigned long long usecNow(void)
+{
+	struct timeval t;
+
+	gettimeofday(&t,NULL);
+	return (unsigned long long)t.tv_sec * 1000000 + t.tv_usec;
+}
+
+static TCstatusCode nullSink(
+  const unsigned char *data,
+  int                  len,
+  void                *arg)
+{
+	return TC_OK;
+}
+
+/* Reader thread: fills ring buffers from the input until end of file. */
+static void *readLoop(void *arg)
+{
+	int b,i;
+
+	for(;;)
+	{
+		pthread_mutex_lock(&ringLock);
+		for(b=-1,i=0;i<nBufs;i++)
+		{
+			if(state[i] == BUF_FREE) break;
+			if((state[i] == BUF_FULL) &&
+			   ((b < 0) || (seq[i] < seq[b])))
+				b = i;
+		}
+		if(i < nBufs) b = i;
+		else          nSkipped++;  /* Overwriting an unused frame */
+		state[b] = BUF_READING;
+		pthread_mutex_unlock(&ringLock);
+
+		i = (1 == fread(ring[b],frameBytes,1,in));
+
+		pthread_mutex_lock(&ringLock);
+		if(i)
+		{
+			state[b]   = BUF_FULL;
+			seq[b]     = ++nRead;
+			arrival[b] = usecNow();
+		} else
+		{
+			state[b]   = BUF_FREE;
+			eof        = 1;
+		}
+		pthread_cond_signal(&ringFull);
+		pthread_mutex_unlock(&ringLock);
+		if(!i) break;
+	}
+
+	return NULL;
+}
+
+int main(int argc,char *argv[])
+{
+	int                i,b,nPixels = 0,
+	  srcWidth        = 1920,
+	  srcHeight       = 1080,
+	  nStrands        = 1,
+	  pixelsPerStrand = 100,
+	  gridWidth       = 0,
+	  gridHeight      = 0,
+	  cbus            = 0,
+	  nullOut         = 0,
+	  nThreads        = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	char              *layoutName = NULL,
+	                  *traceName  = NULL;
+	unsigned long      nShown = 0;
+	unsigned long long t,latency,latencyMax = 0,resampleTime = 0,
+	                   latencySum = 0,lastReport,arrived;
+	TCpixel           *frame;
+	TClayout          *layout = NULL;
+	TCresampler       *resampler;
+	TCstats            stats;
+	TCsubmitStats      counts;
+	TCstatusCode       status;
+	pthread_t          reader;
+
+	while((i = getopt(argc,argv,"w:h:l:s:p:cW:H:t:b:nT:")) != -1)
+	{
+		switch(i)
+		{
+		   case 'w':
+			srcWidth        = strtol(optarg,NULL,0);
+			break;
+		   case 'h':
+			srcHeight       = strtol(optarg,NULL,0);
+			break;
+		   case 'l':
+			layoutName      = optarg;
+			break;
+		   case 's':
+			nStrands        = strtol(optarg,NULL,0);
+			break;
+		   case 'p':
+			pixelsPerStrand = strtol(optarg,NULL,0);
+			break;
+		   case 'c':
+			cbus            = TC_CBUS_CLOCK;
+			break;
+		   case 'W':
+			gridWidth       = strtol(optarg,NULL,0);
+			break;
+		   case 'H':
+			gridHeight      = strtol(optarg,NULL,0);
+			break;
+		   case 't':
+			nThreads        = strtol(optarg,NULL,0);
+			break;
+		   case 'b':
+			nBufs           = strtol(optarg,NULL,0);
+			break;
+		   case 'n':
+			nullOut         = 1;
+			break;
+		   case 'T':
+			traceName       = optarg;
+			break;
+		   case '?':
+		   default:
+			(void)printf("usage: %s [-w width] [-h height] "
+			  "[-l layoutfile | -s strands -p pixels\n"
+			  "       [-W gridwidth] [-H gridheight]] [-c] "
+			  "[-t threads] [-b buffers] [-n]\n"
+			  "       [-T tracefile] [inputfile]\n",argv[0]);
+			return 1;
+		}
+	}
+
+	if(nThreads < 1) nThreads = 1;
+	if((srcWidth < 1) || (srcHeight < 1) || (nBufs < 3) ||
+	   (nBufs > MAX_BUFS))
+	{
+		TCprintError(TC_ERR_VALUE);
+		return 1;
+	}
+
+	if(optind < argc)
+	{
+		if(!(in = fopen(argv[optind],"rb")))
+		{
+			TCprintError(TC_ERR_FILE);
+			return 1;
+		}
+	} else in = stdin;
+
+	if(nullOut) TCsetSink(nullSink,NULL);
+	if(traceName && ((status = TCtraceStart(100000)) != TC_OK))
+	{
+		TCprintError(status);
+		return 1;
+	}
+	if(layoutName)
+	{
+		status = TCopenLayout(layoutName,cbus,&layout);
+		if(layout)
+		{
+			gridWidth  = layout->width;
+			gridHeight = layout->height;
+			nPixels    = layout->imageSize;
+		}
+	} else
+	{
+		if(!gridWidth)  gridWidth  = pixelsPerStrand;
+		if(!gridHeight) gridHeight = nStrands;
+		nPixels = nStrands * pixelsPerStrand;
+		status  = (gridWidth * gridHeight > nPixels) ? TC_ERR_VALUE :
+		  TCopen(nStrands | cbus,pixelsPerStrand);
+	}
+	if(status != TC_OK)
+	{
+		TCprintError(status);
+		if((status < TC_ERR_DIVISOR) || (status > TC_ERR_BAUDRATE))
+			return 1;
+	}
+	if(!gridWidth || !gridHeight)
+	{
+		(void)printf("Layout has no grid to show video on.\n");
+		return 1;
+	}
+
+	frameBytes = srcWidth * srcHeight * 3;
+	TCinitStats(&stats);
+	if(!(resampler = TCresampleCreate(srcWidth,srcHeight,gridWidth,
+	   gridHeight,nThreads)))
+	{
+		TCprintError(TC_ERR_MALLOC);
+		return 1;
+	}
+	for(i=0;i<nBufs;i++)
+	{
+		if(!(ring[i] = (unsigned char *)malloc(frameBytes)))
+		{
+			TCprintError(TC_ERR_MALLOC);
+			return 1;
+		}
+		state[i] = BUF_FREE;
+	}
+	if((status = TCsubmitStart(TC_SUBMIT_LATEST,0,nPixels,
+	  layout ? layout->remap : NULL,&stats)) != TC_OK)
+	{
+		TCprintError(status);
+		return 1;
+	}
+	if(pthread_create(&reader,NULL,readLoop,NULL))
+	{
+		TCprintError(TC_ERR_MALLOC);
+		return 1;
+	}
+
+	(void)fprintf(stderr,"%d x %d video onto %d x %d grid, %d thread(s)\n",
+	  srcWidth,srcHeight,gridWidth,gridHeight,nThreads);
+
+	for(lastReport=usecNow();;)
+	{
+		/* Newest frame; any older ones are skipped. */
+		pthread_mutex_lock(&ringLock);
+		for(;;)
+		{
+			for(b=-1,i=0;i<nBufs;i++)
+			{
+				if((state[i] == BUF_FULL) &&
+				   ((b < 0) || (seq[i] > seq[b])))
+					b = i;
+			}
+			if((b >= 0) || eof) break;
+			pthread_cond_wait(&ringFull,&ringLock);
+		}
+		if(b < 0)
+		{
+			pthread_mutex_unlock(&ringLock);
+			break;
+		}
+		for(i=0;i<nBufs;i++)
+		{
+			if((i != b) && (state[i] == BUF_FULL))
+			{
+				state[i] = BUF_FREE;
+				nSkipped++;
+			}
+		}
+		state[b] = BUF_BUSY;
+		arrived  = arrival[b];  /* Reader may reuse b once freed */
+		pthread_mutex_unlock(&ringLock);
+
+		if(!(frame = TCframeAcquire()))
+		{
+			pthread_mutex_lock(&ringLock);
+			state[b] = BUF_FREE;
+			pthread_mutex_unlock(&ringLock);
+			break;
+		}
+		t = usecNow();
+		TCtraceBegin("resample");
+		TCresample(resampler,ring[b],0,frame);
+		TCtraceEnd("resample");
+		resampleTime += usecNow() - t;
+
+		pthread_mutex_lock(&ringLock);
+		state[b] = BUF_FREE;
+		pthread_mutex_unlock(&ringLock);
+
+		(void)TCframeSubmit(frame);
+		latency     = usecNow() - arrived;
+		latencySum += latency;
+		if(latency > latencyMax) latencyMax = latency;
+		nShown++;
+
+		if((t = usecNow()) - lastReport >= 1000000)
+		{
+			TCsubmitGetStats(&counts);
+			(void)fprintf(stderr,"%lu frames read, %lu skipped, "
+			  "%lu sent; arrival to wire %lu uS\r",nRead,nSkipped,
+			  counts.sent,(unsigned long)(latencySum / nShown) +
+			  counts.usecWire);
+			lastReport = t;
+		}
+	}
+
+	pthread_join(reader,NULL);
+	if(in != stdin) fclose(in);
+	TCsubmitGetStats(&counts);
+	TCsubmitStop();
+	if(traceName && ((status = TCtraceStop(traceName)) != TC_OK))
+		TCprintError(status);
+	TCclose();
+	TClayoutClose(layout);
+
+	(void)printf("\nFrames: %lu read, %lu skipped in ring, %lu resampled, "
+	  "%lu sent, %lu superseded\n",nRead,nSkipped,nShown,counts.sent,
+	  counts.superseded);
+	if(nShown)
+	{
+		(void)printf("Resample: %.1f uS per frame\n",
+		  (double)resampleTime / nShown);
+		(void)printf("Arrival to submit: avg %lu uS, max %llu uS\n",
+		  (unsigned long)(latencySum / nShown),latencyMax);
+		(void)printf("Submit to wire: avg %lu uS, max %lu uS\n",
+		  counts.usecWire,counts.usecWireMax);
+		(void)printf("Arrival to wire: avg %lu uS\n",
+		  (unsigned long)(latencySum / nShown) + counts.usecWire);
+	}
+	TCprintStats(&stats);
+
+	TCresampleDestroy(resampler);
+	for(i=0;i<nBufs;i++) free(ring[i]);
+	return 0;
+}